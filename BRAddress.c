@@ -229,6 +229,67 @@ size_t BRScriptPushData(uint8_t *script, size_t scriptLen, const uint8_t *data,
     return (! script || len <= scriptLen) ? len : 0;
 }
 
+// returns the standard template script matches, recognized by its exact byte layout without parsing its elements
+// if hash is non-NULL, it's set to point to the 20 or 32 byte hash within script that the template pays to
+BRScriptTemplate BRScriptPubKeyTemplate(const uint8_t *script, size_t scriptLen, const uint8_t **hash)
+{
+    BRScriptTemplate tmpl = BRScriptTemplateNone;
+    const uint8_t *h = NULL;
+
+    assert(script != NULL || scriptLen == 0);
+
+    if (! script || scriptLen < 22 || scriptLen > 34) {
+        // too short or long for any template
+    }
+    else if (scriptLen == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+             script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        tmpl = BRScriptTemplateP2PKH, h = &script[3];
+    }
+    else if (scriptLen == 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+        tmpl = BRScriptTemplateP2SH, h = &script[2];
+    }
+    else if (scriptLen == 22 && script[0] == OP_0 && script[1] == 20) {
+        tmpl = BRScriptTemplateP2WPKH, h = &script[2];
+    }
+    else if (scriptLen == 34 && script[0] == OP_0 && script[1] == 32) {
+        tmpl = BRScriptTemplateP2WSH, h = &script[2];
+    }
+
+    if (hash) *hash = h;
+    return tmpl;
+}
+
+// writes the scriptPubKey for a standard template paying to hash, 32 bytes for BRScriptTemplateP2WSH, 20 otherwise
+// returns the number of bytes written, or scriptLen needed if script is NULL
+size_t BRScriptPubKeyFromTemplate(uint8_t *script, size_t scriptLen, BRScriptTemplate tmpl, const uint8_t *hash)
+{
+    uint8_t s[34];
+    size_t len = 0;
+
+    assert(hash != NULL || tmpl == BRScriptTemplateNone);
+
+    switch (tmpl) {
+        case BRScriptTemplateP2PKH:
+            s[0] = OP_DUP, s[1] = OP_HASH160, s[2] = 20, memcpy(&s[3], hash, 20);
+            s[23] = OP_EQUALVERIFY, s[24] = OP_CHECKSIG, len = 25;
+            break;
+        case BRScriptTemplateP2SH:
+            s[0] = OP_HASH160, s[1] = 20, memcpy(&s[2], hash, 20), s[22] = OP_EQUAL, len = 23;
+            break;
+        case BRScriptTemplateP2WPKH:
+            s[0] = OP_0, s[1] = 20, memcpy(&s[2], hash, 20), len = 22;
+            break;
+        case BRScriptTemplateP2WSH:
+            s[0] = OP_0, s[1] = 32, memcpy(&s[2], hash, 32), len = 34;
+            break;
+        default:
+            break;
+    }
+
+    if (script && len <= scriptLen) memcpy(script, s, len);
+    return (! script || len <= scriptLen) ? len : 0;
+}
+
 // NOTE: It's important here to be permissive with scriptSig (spends) and strict with scriptPubKey (receives). If we
 // miss a receive transaction, only that transaction's funds are missed, however if we accept a receive transaction that
 // we are unable to correctly sign later, then the entire wallet balance after that point would become stuck with the
@@ -242,9 +303,31 @@ size_t BRAddressFromScriptPubKey(char *addr, size_t addrLen, const uint8_t *scri
     if (! script || scriptLen == 0 || scriptLen > MAX_SCRIPT_LENGTH) return 0;
     
     uint8_t data[21];
-    const uint8_t *d, *elems[BRScriptElements(NULL, 0, script, scriptLen)];
+    const uint8_t *d;
     char a[91];
-    size_t r = 0, l = 0, count = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), script, scriptLen);
+    size_t r = 0, l = 0;
+
+    switch (BRScriptPubKeyTemplate(script, scriptLen, &d)) { // standard scripts don't need their elements parsed
+        case BRScriptTemplateP2PKH:
+            data[0] = BITCOIN_PUBKEY_ADDRESS;
+#if BITCOIN_TESTNET
+            data[0] = BITCOIN_PUBKEY_ADDRESS_TEST;
+#endif
+            memcpy(&data[1], d, 20);
+            return BRBase58CheckEncode(addr, addrLen, data, 21);
+        case BRScriptTemplateP2SH:
+            data[0] = BITCOIN_SCRIPT_ADDRESS;
+#if BITCOIN_TESTNET
+            data[0] = BITCOIN_SCRIPT_ADDRESS_TEST;
+#endif
+            memcpy(&data[1], d, 20);
+            return BRBase58CheckEncode(addr, addrLen, data, 21);
+        default: // witness scripts are bech32 encoded below, the same as other witness versions
+            break;
+    }
+
+    const uint8_t *elems[BRScriptElements(NULL, 0, script, scriptLen)];
+    size_t count = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), script, scriptLen);
     
     if (count == 5 && *elems[0] == OP_DUP && *elems[1] == OP_HASH160 && *elems[2] == 20 &&
         *elems[3] == OP_EQUALVERIFY && *elems[4] == OP_CHECKSIG) {
@@ -353,26 +436,10 @@ size_t BRAddressScriptPubKey(uint8_t *script, size_t scriptLen, const char *addr
     
     if (BRBase58CheckDecode(data, sizeof(data), addr) == 21) {
         if (data[0] == pubkeyAddress) {
-            if (script && 25 <= scriptLen) {
-                script[0] = OP_DUP;
-                script[1] = OP_HASH160;
-                script[2] = 20;
-                memcpy(&script[3], &data[1], 20);
-                script[23] = OP_EQUALVERIFY;
-                script[24] = OP_CHECKSIG;
-            }
-            
-            r = (! script || 25 <= scriptLen) ? 25 : 0;
+            r = BRScriptPubKeyFromTemplate(script, scriptLen, BRScriptTemplateP2PKH, &data[1]);
         }
         else if (data[0] == scriptAddress) {
-            if (script && 23 <= scriptLen) {
-                script[0] = OP_HASH160;
-                script[1] = 20;
-                memcpy(&script[2], &data[1], 20);
-                script[22] = OP_EQUAL;
-            }
-            
-            r = (! script || 23 <= scriptLen) ? 23 : 0;
+            r = BRScriptPubKeyFromTemplate(script, scriptLen, BRScriptTemplateP2SH, &data[1]);
         }
     }
     else {
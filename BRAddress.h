@@ -79,6 +79,22 @@ const uint8_t *BRScriptData(const uint8_t *elem, size_t *dataLen);
 // returns the number of bytes written, or scriptLen needed if script is NULL
 size_t BRScriptPushData(uint8_t *script, size_t scriptLen, const uint8_t *data, size_t dataLen);
 
+typedef enum {
+    BRScriptTemplateNone = 0, // not one of the standard scriptPubKeys below
+    BRScriptTemplateP2PKH,    // OP_DUP OP_HASH160 <20 byte hash> OP_EQUALVERIFY OP_CHECKSIG
+    BRScriptTemplateP2SH,     // OP_HASH160 <20 byte hash> OP_EQUAL
+    BRScriptTemplateP2WPKH,   // OP_0 <20 byte hash>
+    BRScriptTemplateP2WSH     // OP_0 <32 byte hash>
+} BRScriptTemplate;
+
+// returns the standard template script matches, recognized by its exact byte layout without parsing its elements
+// if hash is non-NULL, it's set to point to the 20 or 32 byte hash within script that the template pays to
+BRScriptTemplate BRScriptPubKeyTemplate(const uint8_t *script, size_t scriptLen, const uint8_t **hash);
+
+// writes the scriptPubKey for a standard template paying to hash, 32 bytes for BRScriptTemplateP2WSH, 20 otherwise
+// returns the number of bytes written, or scriptLen needed if script is NULL
+size_t BRScriptPubKeyFromTemplate(uint8_t *script, size_t scriptLen, BRScriptTemplate tmpl, const uint8_t *hash);
+
 typedef struct {
     char s[75];
 } BRAddress;
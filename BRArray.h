@@ -53,6 +53,9 @@ extern "C" {
 // }
 //
 // array_rm_range(myArray, 3, 3);           // remove 'a', 'b', 'c' from end of myArray
+// array_rm_swap(myArray, 0);               // replace 'x' with the last item 'z', without shifting: z, y,
+// array_filter(myArray, NULL, isVowel);    // remove items where isVowel(NULL, &item) is false, in a single pass
+// array_reserve(myArray, 100);             // make room for 100 items so adding up to that many won't reallocate
 // array_clear(myArray);                    // myArray is now empty
 // array_free(myArray);                     // free memory allocated for myArray
 //
@@ -144,9 +147,19 @@ extern "C" {
     assert((array) != NULL);\
     assert(_array_i >= 0 && _array_i < array_count(array));\
     array_count(array)--;\
-    while (_array_i < array_count(array))\
-        (array)[_array_i] = (array)[_array_i + 1], _array_i++;\
-    memset((array) + _array_i, 0, sizeof(*(array)));\
+    memmove((array) + _array_i, (array) + _array_i + 1, (array_count(array) - _array_i)*sizeof(*(array)));\
+    memset((array) + array_count(array), 0, sizeof(*(array)));\
+} while (0)
+
+// removes the item at index in constant time by moving the last item into its place, so item order isn't kept
+#define array_rm_swap(array, index) do {\
+    size_t _array_i = (index);\
+    assert((array) != NULL);\
+    assert(_array_i >= 0 && _array_i < array_count(array));\
+    array_count(array)--;\
+    if (_array_i < array_count(array))\
+        (array)[_array_i] = (array)[array_count(array)];\
+    memset((array) + array_count(array), 0, sizeof(*(array)));\
 } while (0)
 
 #define array_rm_last(array) do {\
@@ -161,11 +174,33 @@ extern "C" {
     assert(_array_i >= 0 && _array_i < array_count(array));\
     assert(_array_len >= 0 && _array_i + _array_len <= array_count(array));\
     array_count(array) -= _array_len;\
-    while (_array_i < array_count(array))\
-        (array)[_array_i] = (array)[_array_i + _array_len], _array_i++;\
-    memset((array) + _array_i, 0, _array_len*sizeof(*(array)));\
+    memmove((array) + _array_i, (array) + _array_i + _array_len, (array_count(array) - _array_i)*sizeof(*(array)));\
+    memset((array) + array_count(array), 0, _array_len*sizeof(*(array)));\
 } while(0)
 
+// removes every item for which keep(info, &item) returns false, keeping the order of the rest, in a single pass
+#define array_filter(array, info, keep) do {\
+    size_t _array_i = 0, _array_j = 0;\
+    assert((array) != NULL);\
+    while (_array_i < array_count(array)) {\
+        if ((keep)((info), &(array)[_array_i])) {\
+            if (_array_j != _array_i) (array)[_array_j] = (array)[_array_i];\
+            _array_j++;\
+        }\
+        _array_i++;\
+    }\
+    memset((array) + _array_j, 0, (array_count(array) - _array_j)*sizeof(*(array)));\
+    array_count(array) = _array_j;\
+} while (0)
+
+// increases capacity to at least the given number of items, so adding up to that many won't reallocate
+#define array_reserve(array, capacity) do {\
+    size_t _array_rsv = (capacity);\
+    assert((array) != NULL);\
+    if (_array_rsv > array_capacity(array))\
+        array_set_capacity(array, _array_rsv);\
+} while (0)
+
 #define array_clear(array) do {\
     assert((array) != NULL);\
     memset((array), 0, array_count(array)*sizeof(*(array)));\
@@ -177,6 +212,104 @@ extern "C" {
     free((size_t *)(array) - 2);\
 } while (0)
 
+// double ended queues, ring buffers with constant time adds and removes at either end, such as for FIFO queues that
+// arrays would have to shift on every removal from the front
+//
+// example:
+//
+// int *myDeque;                            // deque of ints
+//
+// deque_new(myDeque, 2);                   // initialize myDeque with a capacity of 2 items
+// deque_add(myDeque, 1);                   // add 1 to the back of myDeque
+// deque_add(myDeque, 2);                   // add 2 to the back of myDeque
+// deque_add_front(myDeque, 0);             // add 0 to the front of myDeque (capacity is auto-increased)
+//
+// for (int i = 0; i < deque_count(myDeque); i++) {
+//     printf("%d, ", deque_item(myDeque, i)); // 0, 1, 2,
+// }
+//
+// deque_rm_first(myDeque);                 // remove 0 from the front of myDeque
+// deque_rm_last(myDeque);                  // remove 2 from the back of myDeque
+// deque_clear(myDeque);                    // myDeque is now empty
+// deque_free(myDeque);                     // free memory allocated for myDeque
+//
+// NOTE: items wrap around the end of the buffer, so access them with deque_item() rather than by indexing directly
+
+#define deque_new(deque, capacity) do {\
+    size_t _deque_cap = (capacity);\
+    (deque) = (void *)((size_t *)calloc(1, _deque_cap*sizeof(*(deque)) + sizeof(size_t)*4) + 4);\
+    assert((deque) != NULL);\
+    deque_capacity(deque) = _deque_cap;\
+    deque_count(deque) = 0;\
+    deque_head(deque) = 0;\
+} while (0)
+
+#define deque_capacity(deque) (((size_t *)(deque))[-2])
+
+#define deque_count(deque) (((size_t *)(deque))[-1])
+
+// index in the buffer of the front item, [-4] is unused so items have the same alignment as array items
+#define deque_head(deque) (((size_t *)(deque))[-3])
+
+// the item at index, counting from the front
+#define deque_item(deque, index) ((deque)[(deque_head(deque) + (index)) % deque_capacity(deque)])
+
+#define _deque_grow(deque) do {\
+    size_t _deque_old = deque_capacity(deque), _deque_cap = (_deque_old + 1)*3/2;\
+    (deque) = (void *)((size_t *)realloc((size_t *)(deque) - 4, _deque_cap*sizeof(*(deque)) + sizeof(size_t)*4) + 4);\
+    assert((deque) != NULL);\
+    if (deque_head(deque) + deque_count(deque) > _deque_old) {\
+        memmove((deque) + deque_head(deque) + _deque_cap - _deque_old, (deque) + deque_head(deque),\
+                (_deque_old - deque_head(deque))*sizeof(*(deque)));\
+        deque_head(deque) += _deque_cap - _deque_old;\
+    }\
+    deque_capacity(deque) = _deque_cap;\
+} while (0)
+
+#define deque_add(deque, item) do {\
+    assert((deque) != NULL);\
+    if (deque_count(deque) + 1 > deque_capacity(deque))\
+        _deque_grow(deque);\
+    deque_item(deque, deque_count(deque)) = (item);\
+    deque_count(deque)++;\
+} while (0)
+
+#define deque_add_front(deque, item) do {\
+    assert((deque) != NULL);\
+    if (deque_count(deque) + 1 > deque_capacity(deque))\
+        _deque_grow(deque);\
+    deque_head(deque) = (deque_head(deque) + deque_capacity(deque) - 1) % deque_capacity(deque);\
+    (deque)[deque_head(deque)] = (item);\
+    deque_count(deque)++;\
+} while (0)
+
+#define deque_rm_first(deque) do {\
+    assert((deque) != NULL);\
+    if (deque_count(deque) > 0) {\
+        memset(&deque_item(deque, 0), 0, sizeof(*(deque)));\
+        deque_head(deque) = (deque_head(deque) + 1) % deque_capacity(deque);\
+        deque_count(deque)--;\
+    }\
+} while (0)
+
+#define deque_rm_last(deque) do {\
+    assert((deque) != NULL);\
+    if (deque_count(deque) > 0)\
+        memset(&deque_item(deque, --deque_count(deque)), 0, sizeof(*(deque)));\
+} while (0)
+
+#define deque_clear(deque) do {\
+    assert((deque) != NULL);\
+    memset((deque), 0, deque_capacity(deque)*sizeof(*(deque)));\
+    deque_count(deque) = 0;\
+    deque_head(deque) = 0;\
+} while (0)
+
+#define deque_free(deque) do {\
+    assert((deque) != NULL);\
+    free((size_t *)(deque) - 4);\
+} while (0)
+
 #ifdef __cplusplus
 }
 #endif
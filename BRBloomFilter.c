@@ -64,6 +64,23 @@ BRBloomFilter *BRBloomFilterNew(double falsePositiveRate, size_t elemCount, uint
     return filter;
 }
 
+// returns the false positive rate, from minRate to maxRate, that minimizes the expected bytes downloaded when a filter
+// of elemCount elements is sent filterCount times, and each unit of false positive rate costs fpBytes of unwanted
+// transactions (the number of blocks the filter is used for, times transactions per block, times average tx size)
+double BRBloomFilterOptimalRate(size_t elemCount, size_t filterCount, double fpBytes, double minRate, double maxRate)
+{
+    double rate = maxRate;
+
+    assert(minRate <= maxRate);
+
+    // filter length is -elemCount*ln(rate)/(8*ln(2)^2) bytes, so total cost is filterCount*length + rate*fpBytes, which
+    // is lowest where its derivative -filterCount*elemCount/(8*ln(2)^2*rate) + fpBytes is zero
+    if (fpBytes > DBL_EPSILON) rate = filterCount*elemCount/(8.0*M_LN2*M_LN2*fpBytes);
+    if (rate < minRate) rate = minRate;
+    if (rate > maxRate) rate = maxRate;
+    return rate;
+}
+
 // buf must contain a serialized filter
 // returns a bloom filter struct that must be freed by calling BRBloomFilterFree()
 BRBloomFilter *BRBloomFilterParse(const uint8_t *buf, size_t bufLen)
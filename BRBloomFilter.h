@@ -58,6 +58,11 @@ typedef struct {
 // returns a newly allocated bloom filter struct that must be freed by calling BRBloomFilterFree()
 BRBloomFilter *BRBloomFilterNew(double falsePositiveRate, size_t elemCount, uint32_t tweak, uint8_t flags);
 
+// returns the false positive rate, from minRate to maxRate, that minimizes the expected bytes downloaded when a filter
+// of elemCount elements is sent filterCount times, and each unit of false positive rate costs fpBytes of unwanted
+// transactions (the number of blocks the filter is used for, times transactions per block, times average tx size)
+double BRBloomFilterOptimalRate(size_t elemCount, size_t filterCount, double fpBytes, double minRate, double maxRate);
+
 // buf must contain a serialized filter
 // returns a bloom filter struct that must be freed by calling BRBloomFilterFree()
 BRBloomFilter *BRBloomFilterParse(const uint8_t *buf, size_t bufLen);
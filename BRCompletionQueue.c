@@ -0,0 +1,211 @@
+//
+//  BRCompletionQueue.c
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRCompletionQueue.h"
+#include "BRArray.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <assert.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+struct BRCompletionQueueStruct {
+    BRCompletion *completions; // deque
+    uint64_t lastHandle;
+    int fd[2]; // read and write ends of the pipe, or the same eventfd twice
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+typedef struct {
+    BRCompletionQueue *queue;
+    BRCompletion completion;
+} BRCompletionPending;
+
+// returns a newly allocated completion queue that must be freed by calling BRCompletionQueueFree()
+BRCompletionQueue *BRCompletionQueueNew(void)
+{
+    BRCompletionQueue *queue = calloc(1, sizeof(*queue));
+
+    assert(queue != NULL);
+    deque_new(queue->completions, 10);
+    queue->fd[0] = queue->fd[1] = -1;
+#if defined(__linux__)
+    queue->fd[0] = queue->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    if (pipe(queue->fd) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(queue->fd[i], F_SETFL, fcntl(queue->fd[i], F_GETFL) | O_NONBLOCK);
+            fcntl(queue->fd[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+    else queue->fd[0] = queue->fd[1] = -1;
+#endif
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return queue;
+}
+
+// file descriptor that's readable while the queue has completions, for poll(), select() or epoll in level triggered
+// mode, an eventfd on linux and a pipe elsewhere, owned by queue, returns -1 if it couldn't be created
+int BRCompletionQueueFd(BRCompletionQueue *queue)
+{
+    assert(queue != NULL);
+    return queue->fd[0];
+}
+
+// returns a new handle, unique to queue and never 0, for an operation that will post its result to queue
+uint64_t BRCompletionQueueNewHandle(BRCompletionQueue *queue)
+{
+    uint64_t handle;
+
+    assert(queue != NULL);
+    pthread_mutex_lock(&queue->lock);
+    handle = ++queue->lastHandle;
+    pthread_mutex_unlock(&queue->lock);
+    return handle;
+}
+
+// adds completion to the end of the queue, waking any thread waiting on it, may be called from any thread
+void BRCompletionQueuePost(BRCompletionQueue *queue, BRCompletion completion)
+{
+    uint64_t one = 1;
+
+    assert(queue != NULL);
+    pthread_mutex_lock(&queue->lock);
+
+    // the fd is signaled when the queue becomes non-empty and reset when it's emptied, so it stays readable in between
+    if (deque_count(queue->completions) == 0 && queue->fd[1] >= 0) (void)! write(queue->fd[1], &one, sizeof(one));
+
+    deque_add(queue->completions, completion);
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// must hold queue->lock
+static int _BRCompletionQueueGet(BRCompletionQueue *queue, BRCompletion *completion)
+{
+    uint64_t n;
+
+    if (deque_count(queue->completions) == 0) return 0;
+    *completion = deque_item(queue->completions, 0);
+    deque_rm_first(queue->completions);
+    if (deque_count(queue->completions) == 0 && queue->fd[0] >= 0) (void)! read(queue->fd[0], &n, sizeof(n));
+    return 1;
+}
+
+// removes the completion at the front of the queue and writes it to completion without waiting
+// returns true on success, or false if the queue is empty
+int BRCompletionQueueTryGet(BRCompletionQueue *queue, BRCompletion *completion)
+{
+    int r;
+
+    assert(queue != NULL);
+    assert(completion != NULL);
+    pthread_mutex_lock(&queue->lock);
+    r = _BRCompletionQueueGet(queue, completion);
+    pthread_mutex_unlock(&queue->lock);
+    return r;
+}
+
+// same as BRCompletionQueueTryGet(), but waits up to timeout seconds if the queue is empty
+int BRCompletionQueueWait(BRCompletionQueue *queue, BRCompletion *completion, double timeout)
+{
+    struct timeval tv;
+    struct timespec ts;
+    int r, error = 0;
+
+    assert(queue != NULL);
+    assert(completion != NULL);
+    gettimeofday(&tv, NULL);
+    timeout += tv.tv_sec + (double)tv.tv_usec/1000000;
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - ts.tv_sec)*1000000000);
+    pthread_mutex_lock(&queue->lock);
+
+    while (deque_count(queue->completions) == 0 && error != ETIMEDOUT) {
+        error = pthread_cond_timedwait(&queue->cond, &queue->lock, &ts);
+    }
+
+    r = _BRCompletionQueueGet(queue, completion);
+    pthread_mutex_unlock(&queue->lock);
+    return r;
+}
+
+// number of completions in the queue
+size_t BRCompletionQueueCount(BRCompletionQueue *queue)
+{
+    size_t count;
+
+    assert(queue != NULL);
+    pthread_mutex_lock(&queue->lock);
+    count = deque_count(queue->completions);
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+// returns a pending completion for adapting a callback based operation, to be passed as its callback info along with
+// BRCompletionPendingPost() as the callback, handle is set to the new handle for the operation
+void *BRCompletionPendingNew(BRCompletionQueue *queue, BRCompletionType type, void *info, uint64_t *handle)
+{
+    BRCompletionPending *pending = calloc(1, sizeof(*pending));
+
+    assert(pending != NULL);
+    assert(queue != NULL);
+    pending->queue = queue;
+    pending->completion.handle = BRCompletionQueueNewHandle(queue);
+    pending->completion.type = type;
+    pending->completion.info = info;
+    if (handle) *handle = pending->completion.handle;
+    return pending;
+}
+
+// posts pending to its queue with the given result and frees it, has the signature of a void (*)(void *, int) callback
+void BRCompletionPendingPost(void *pending, int result)
+{
+    BRCompletionPending *p = pending;
+
+    assert(pending != NULL);
+    p->completion.result = result;
+    BRCompletionQueuePost(p->queue, p->completion);
+    free(p);
+}
+
+// frees memory allocated for queue and closes its file descriptor, any operations posting to queue must be finished
+void BRCompletionQueueFree(BRCompletionQueue *queue)
+{
+    assert(queue != NULL);
+    if (queue->fd[0] >= 0) close(queue->fd[0]);
+    if (queue->fd[1] >= 0 && queue->fd[1] != queue->fd[0]) close(queue->fd[1]);
+    deque_free(queue->completions);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
@@ -0,0 +1,92 @@
+//
+//  BRCompletionQueue.h
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRCompletionQueue_h
+#define BRCompletionQueue_h
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// an alternative to result callbacks, which are called on internal peer threads: asynchronous operations return a
+// handle and post their result to a completion queue, which the host polls or waits on from a thread of its choosing
+// the queue has a file descriptor that's readable while completions are pending, for use in the host's own event loop
+typedef struct BRCompletionQueueStruct BRCompletionQueue;
+
+typedef enum {
+    BRCompletionPublishTx = 1, // result is 0 on success, otherwise an errno.h code
+    BRCompletionPing, // result is true if a pong was received
+    BRCompletionMempool, // result is true once the peer's mempool tx have been received
+    BRCompletionSyncStarted, // handle is 0
+    BRCompletionSyncStopped, // handle is 0, result is 0 on success, otherwise an errno.h code
+    BRCompletionTxStatusUpdate // handle is 0
+} BRCompletionType;
+
+typedef struct {
+    uint64_t handle; // handle returned by the operation, or 0 for events that weren't requested
+    BRCompletionType type;
+    int result;
+    void *info; // info passed to the operation
+} BRCompletion;
+
+// returns a newly allocated completion queue that must be freed by calling BRCompletionQueueFree()
+BRCompletionQueue *BRCompletionQueueNew(void);
+
+// file descriptor that's readable while the queue has completions, for poll(), select() or epoll in level triggered
+// mode, an eventfd on linux and a pipe elsewhere, owned by queue, returns -1 if it couldn't be created
+int BRCompletionQueueFd(BRCompletionQueue *queue);
+
+// returns a new handle, unique to queue and never 0, for an operation that will post its result to queue
+uint64_t BRCompletionQueueNewHandle(BRCompletionQueue *queue);
+
+// adds completion to the end of the queue, waking any thread waiting on it, may be called from any thread
+void BRCompletionQueuePost(BRCompletionQueue *queue, BRCompletion completion);
+
+// removes the completion at the front of the queue and writes it to completion without waiting
+// returns true on success, or false if the queue is empty
+int BRCompletionQueueTryGet(BRCompletionQueue *queue, BRCompletion *completion);
+
+// same as BRCompletionQueueTryGet(), but waits up to timeout seconds if the queue is empty
+int BRCompletionQueueWait(BRCompletionQueue *queue, BRCompletion *completion, double timeout);
+
+// number of completions in the queue
+size_t BRCompletionQueueCount(BRCompletionQueue *queue);
+
+// returns a pending completion for adapting a callback based operation, to be passed as its callback info along with
+// BRCompletionPendingPost() as the callback, handle is set to the new handle for the operation
+void *BRCompletionPendingNew(BRCompletionQueue *queue, BRCompletionType type, void *info, uint64_t *handle);
+
+// posts pending to its queue with the given result and frees it, has the signature of a void (*)(void *, int) callback
+void BRCompletionPendingPost(void *pending, int result);
+
+// frees memory allocated for queue and closes its file descriptor, any operations posting to queue must be finished
+void BRCompletionQueueFree(BRCompletionQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRCompletionQueue_h
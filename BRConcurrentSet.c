@@ -0,0 +1,316 @@
+//
+//  BRConcurrentSet.c
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRConcurrentSet.h"
+#include "BRCrypto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+
+#define SLOT_EMPTY   0
+#define SLOT_FULL    1
+#define SLOT_DELETED 2
+#define SLOT_BUSY    3 // a writer is storing a new key in the slot
+#define SLOT_STATE   3 // low bits of a slot state word are the state, the rest a version bumped on each change
+
+// open addressed table, each slot is a state word followed by the key, stored as 32bit words so readers can load them
+// atomically while a writer is updating the table, readers retry a slot if its state word changed while reading it
+typedef struct _BRConcurrentSetTable {
+    size_t size; // number of slots
+    struct _BRConcurrentSetTable *next; // next table in a list of replaced tables waiting to be freed
+    atomic_uint_least32_t words[];
+} BRConcurrentSetTable;
+
+struct BRConcurrentSetStruct {
+    size_t keySize, keyWords; // key length in bytes, and in 32bit words rounded up
+    size_t itemCount, deletedCount;
+    _Atomic(BRConcurrentSetTable *) table;
+    atomic_uint epoch; // readers register in the current epoch, writers flip it to find when old tables are unused
+    atomic_size_t readers[2]; // number of readers registered in each epoch
+    BRConcurrentSetTable *retired, *draining; // replaced since the last epoch flip, and before it
+    pthread_mutex_t lock; // serializes writers
+};
+
+static BRConcurrentSetTable *_BRConcurrentSetTableNew(const BRConcurrentSet *set, size_t size)
+{
+    BRConcurrentSetTable *table = calloc(1, sizeof(*table) + size*(1 + set->keyWords)*sizeof(*table->words));
+
+    assert(table != NULL);
+    table->size = size;
+    return table;
+}
+
+// copies key into words, zero padding the last word
+static void _BRConcurrentSetKeyWords(const BRConcurrentSet *set, const void *key, uint32_t words[])
+{
+    words[set->keyWords - 1] = 0;
+    memcpy(words, key, set->keySize);
+}
+
+// returns the index of the slot holding key, or the empty slot ending the probe sequence, or SIZE_MAX if there's
+// neither, found is set to true if key was found, and firstDeleted to the first deleted slot passed, or SIZE_MAX
+// safe to call without set->lock, slots are only emptied by BRConcurrentSetClear(), so a key that stays in the set
+// is always found, even while other keys are added and removed
+static size_t _BRConcurrentSetFind(const BRConcurrentSet *set, BRConcurrentSetTable *table, const uint32_t words[],
+                                   uint32_t hash, int *found, size_t *firstDeleted)
+{
+    size_t i = hash % table->size, n, j, stride = 1 + set->keyWords;
+    atomic_uint_least32_t *slot;
+    uint32_t state;
+
+    *found = 0;
+    if (firstDeleted) *firstDeleted = SIZE_MAX;
+
+    for (n = 0; n < table->size; n++, i = (i + 1) % table->size) {
+        slot = &table->words[i*stride];
+
+        for (;;) {
+            state = atomic_load_explicit(&slot[0], memory_order_acquire);
+            if ((state & SLOT_STATE) == SLOT_BUSY) { sched_yield(); continue; } // let the writer finish storing the key
+            if ((state & SLOT_STATE) != SLOT_FULL) break;
+            for (j = 0; j < set->keyWords && atomic_load_explicit(&slot[1 + j], memory_order_relaxed) == words[j];
+                 j++);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot[0], memory_order_relaxed) == state) break; // else slot changed while reading
+        }
+
+        if ((state & SLOT_STATE) == SLOT_EMPTY) break;
+        if ((state & SLOT_STATE) == SLOT_FULL && j == set->keyWords) { *found = 1; break; }
+        if ((state & SLOT_STATE) == SLOT_DELETED && firstDeleted && *firstDeleted == SIZE_MAX) *firstDeleted = i;
+    }
+
+    return (n < table->size) ? i : SIZE_MAX;
+}
+
+// sets the state of slot i, storing words as its key if not NULL, must hold set->lock
+static void _BRConcurrentSetStore(const BRConcurrentSet *set, BRConcurrentSetTable *table, size_t i,
+                                  uint32_t state, const uint32_t words[])
+{
+    atomic_uint_least32_t *slot = &table->words[i*(1 + set->keyWords)];
+    uint32_t version = (atomic_load_explicit(&slot[0], memory_order_relaxed) | SLOT_STATE) + 1;
+
+    if (words) {
+        atomic_store_explicit(&slot[0], version | SLOT_BUSY, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        version += SLOT_STATE + 1;
+
+        for (size_t j = 0; j < set->keyWords; j++) {
+            atomic_store_explicit(&slot[1 + j], words[j], memory_order_relaxed);
+        }
+    }
+
+    atomic_store_explicit(&slot[0], version | state, memory_order_release);
+}
+
+// frees tables replaced before the last epoch flip once no readers are left in the old epoch, then flips the epoch
+// again if there are newer replaced tables, readers registering after a flip only see tables published before it,
+// so a replaced table is unused once the readers from the epochs it was visible in are gone, must hold set->lock
+static void _BRConcurrentSetReclaim(BRConcurrentSet *set)
+{
+    unsigned epoch = atomic_load(&set->epoch);
+    BRConcurrentSetTable *table;
+
+    if (set->draining && atomic_load(&set->readers[epoch ^ 1]) == 0) {
+        while ((table = set->draining)) set->draining = table->next, free(table);
+    }
+
+    if (! set->draining && set->retired) {
+        set->draining = set->retired;
+        set->retired = NULL;
+        atomic_store(&set->epoch, epoch ^ 1);
+    }
+}
+
+// moves all keys to a new table of the given size, dropping deleted slots, the old table is kept for any readers
+// until _BRConcurrentSetReclaim() finds it's unused
+static void _BRConcurrentSetResize(BRConcurrentSet *set, size_t size)
+{
+    BRConcurrentSetTable *old = atomic_load_explicit(&set->table, memory_order_relaxed),
+                         *table = _BRConcurrentSetTableNew(set, size);
+    size_t i, j, stride = 1 + set->keyWords;
+    uint32_t words[set->keyWords];
+    int found;
+
+    for (i = 0; i < old->size; i++) {
+        if ((atomic_load_explicit(&old->words[i*stride], memory_order_relaxed) & SLOT_STATE) != SLOT_FULL) continue;
+
+        for (j = 0; j < set->keyWords; j++) {
+            words[j] = atomic_load_explicit(&old->words[i*stride + 1 + j], memory_order_relaxed);
+        }
+
+        j = _BRConcurrentSetFind(set, table, words, BRMurmur3_32(words, set->keySize, 0), &found, NULL);
+        _BRConcurrentSetStore(set, table, j, SLOT_FULL, words);
+    }
+
+    old->next = set->retired;
+    set->retired = old;
+    set->deletedCount = 0;
+    atomic_store_explicit(&set->table, table, memory_order_release);
+}
+
+// returns a newly allocated set of keySize byte keys that must be freed by calling BRConcurrentSetFree()
+BRConcurrentSet *BRConcurrentSetNew(size_t keySize, size_t capacity)
+{
+    BRConcurrentSet *set = calloc(1, sizeof(*set));
+
+    assert(set != NULL);
+    assert(keySize > 0);
+    set->keySize = keySize;
+    set->keyWords = (keySize + sizeof(uint32_t) - 1)/sizeof(uint32_t);
+    atomic_init(&set->table, _BRConcurrentSetTableNew(set, (capacity < 8) ? 16 : capacity*2));
+    pthread_mutex_init(&set->lock, NULL);
+    return set;
+}
+
+// adds a copy of key to set, returns true if it wasn't already in set
+int BRConcurrentSetAdd(BRConcurrentSet *set, const void *key)
+{
+    BRConcurrentSetTable *table;
+    uint32_t words[set->keyWords];
+    size_t i, deleted;
+    int found;
+
+    assert(set != NULL);
+    assert(key != NULL);
+    _BRConcurrentSetKeyWords(set, key, words);
+    pthread_mutex_lock(&set->lock);
+    _BRConcurrentSetReclaim(set);
+    table = atomic_load_explicit(&set->table, memory_order_relaxed);
+
+    // keep at least a quarter of the slots empty, so probes for missing keys stay short
+    if ((set->itemCount + set->deletedCount + 1)*4 > table->size*3) {
+        _BRConcurrentSetResize(set, (set->itemCount + 1)*4);
+        table = atomic_load_explicit(&set->table, memory_order_relaxed);
+    }
+
+    i = _BRConcurrentSetFind(set, table, words, BRMurmur3_32(words, set->keySize, 0), &found, &deleted);
+    assert(i != SIZE_MAX);
+
+    if (! found) {
+        if (deleted != SIZE_MAX) i = deleted, set->deletedCount--;
+        _BRConcurrentSetStore(set, table, i, SLOT_FULL, words);
+        set->itemCount++;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return ! found;
+}
+
+// removes key from set, returns true if it was in set
+int BRConcurrentSetRemove(BRConcurrentSet *set, const void *key)
+{
+    BRConcurrentSetTable *table;
+    uint32_t words[set->keyWords];
+    size_t i;
+    int found;
+
+    assert(set != NULL);
+    assert(key != NULL);
+    _BRConcurrentSetKeyWords(set, key, words);
+    pthread_mutex_lock(&set->lock);
+    _BRConcurrentSetReclaim(set);
+    table = atomic_load_explicit(&set->table, memory_order_relaxed);
+    i = _BRConcurrentSetFind(set, table, words, BRMurmur3_32(words, set->keySize, 0), &found, NULL);
+
+    if (found) {
+        _BRConcurrentSetStore(set, table, i, SLOT_DELETED, NULL);
+        set->itemCount--;
+        set->deletedCount++;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return found;
+}
+
+// removes all keys from set
+void BRConcurrentSetClear(BRConcurrentSet *set)
+{
+    BRConcurrentSetTable *table;
+
+    assert(set != NULL);
+    pthread_mutex_lock(&set->lock);
+    table = atomic_load_explicit(&set->table, memory_order_relaxed);
+
+    for (size_t i = 0; i < table->size; i++) {
+        _BRConcurrentSetStore(set, table, i, SLOT_EMPTY, NULL);
+    }
+
+    set->itemCount = set->deletedCount = 0;
+    pthread_mutex_unlock(&set->lock);
+}
+
+// true if key is in set, doesn't take set's lock, but may briefly wait for a writer storing a key in a slot it probes
+int BRConcurrentSetContains(const BRConcurrentSet *set, const void *key)
+{
+    BRConcurrentSet *s = (BRConcurrentSet *)set; // only the reader counts are modified
+    BRConcurrentSetTable *table;
+    uint32_t words[set->keyWords];
+    unsigned epoch;
+    int found;
+
+    assert(set != NULL);
+    assert(key != NULL);
+    _BRConcurrentSetKeyWords(set, key, words);
+
+    for (;;) { // register in the current epoch, retrying if a writer flipped it before the registration was seen
+        epoch = atomic_load(&s->epoch);
+        atomic_fetch_add(&s->readers[epoch], 1);
+        if (atomic_load(&s->epoch) == epoch) break;
+        atomic_fetch_sub_explicit(&s->readers[epoch], 1, memory_order_release);
+    }
+
+    table = atomic_load_explicit(&s->table, memory_order_acquire);
+    _BRConcurrentSetFind(set, table, words, BRMurmur3_32(words, set->keySize, 0), &found, NULL);
+    atomic_fetch_sub_explicit(&s->readers[epoch], 1, memory_order_release);
+    return found;
+}
+
+// number of keys in set
+size_t BRConcurrentSetCount(const BRConcurrentSet *set)
+{
+    BRConcurrentSet *s = (BRConcurrentSet *)set;
+    size_t count;
+
+    assert(set != NULL);
+    pthread_mutex_lock(&s->lock);
+    count = s->itemCount;
+    pthread_mutex_unlock(&s->lock);
+    return count;
+}
+
+// frees memory allocated for set, no other thread may be using it
+void BRConcurrentSetFree(BRConcurrentSet *set)
+{
+    BRConcurrentSetTable *table;
+
+    assert(set != NULL);
+    while ((table = set->retired)) set->retired = table->next, free(table);
+    while ((table = set->draining)) set->draining = table->next, free(table);
+    free(atomic_load(&set->table));
+
+    pthread_mutex_destroy(&set->lock);
+    free(set);
+}
@@ -0,0 +1,64 @@
+//
+//  BRConcurrentSet.h
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRConcurrentSet_h
+#define BRConcurrentSet_h
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a hash set of fixed size keys, such as UInt256 transaction hashes, that are copied into the set
+// lookups don't take a lock, so any number of threads can check for keys while another thread adds or removes them
+// writers are serialized by an internal lock, and readers retry any slot that a writer changed while they read it
+typedef struct BRConcurrentSetStruct BRConcurrentSet;
+
+// returns a newly allocated set of keySize byte keys that must be freed by calling BRConcurrentSetFree()
+BRConcurrentSet *BRConcurrentSetNew(size_t keySize, size_t capacity);
+
+// adds a copy of key to set, returns true if it wasn't already in set
+int BRConcurrentSetAdd(BRConcurrentSet *set, const void *key);
+
+// removes key from set, returns true if it was in set
+int BRConcurrentSetRemove(BRConcurrentSet *set, const void *key);
+
+// removes all keys from set
+void BRConcurrentSetClear(BRConcurrentSet *set);
+
+// true if key is in set, doesn't take set's lock, but may briefly wait for a writer storing a key in a slot it probes
+int BRConcurrentSetContains(const BRConcurrentSet *set, const void *key);
+
+// number of keys in set
+size_t BRConcurrentSetCount(const BRConcurrentSet *set);
+
+// frees memory allocated for set, no other thread may be using it
+void BRConcurrentSetFree(BRConcurrentSet *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRConcurrentSet_h
@@ -110,19 +110,19 @@ void BRSHA1(void *md20, const void *data, size_t len)
 #define s2(x) (ror32((x), 7) ^ ror32((x), 18) ^ ((x) >> 3))
 #define s3(x) (ror32((x), 17) ^ ror32((x), 19) ^ ((x) >> 10))
 
+static const uint32_t sha256K[] = { // sha256 round constants
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 static void _BRSHA256Compress(uint32_t *r, const uint32_t *x)
 {
-    static const uint32_t k[] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-    };
-    
     int i;
     uint32_t a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[64];
     
@@ -130,7 +130,7 @@ static void _BRSHA256Compress(uint32_t *r, const uint32_t *x)
     for (; i < 64; i++) w[i] = s3(w[i - 2]) + w[i - 7] + s2(w[i - 15]) + w[i - 16];
     
     for (i = 0; i < 64; i++) {
-        t1 = h + s1(e) + ch(e, f, g) + k[i] + w[i];
+        t1 = h + s1(e) + ch(e, f, g) + sha256K[i] + w[i];
         t2 = s0(a) + maj(a, b, c);
         h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
     }
@@ -202,6 +202,62 @@ void BRSHA256_2(void *md32, const void *data, size_t len)
     BRSHA256(md32, t, sizeof(t));
 }
 
+// initializes an incremental sha-1 (mdLen 20), sha-224 (mdLen 28) or sha-256 (mdLen 32) hash context
+void BRSHAInit(BRSHAContext *ctx, size_t mdLen)
+{
+    static const uint32_t sha1IV[] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0, 0, 0, 0 },
+        sha224IV[] = { 0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4 },
+        sha256IV[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    
+    assert(ctx != NULL);
+    assert(mdLen == 20 || mdLen == 28 || mdLen == 32);
+    
+    memset(ctx, 0, sizeof(*ctx));
+    memcpy(ctx->h, (mdLen == 20) ? sha1IV : (mdLen == 28) ? sha224IV : sha256IV, sizeof(ctx->h));
+    ctx->mdLen = mdLen;
+}
+
+static void _BRSHACompress(BRSHAContext *ctx)
+{
+    if (ctx->mdLen == 20) _BRSHA1Compress(ctx->h, ctx->x);
+    else _BRSHA256Compress(ctx->h, ctx->x);
+}
+
+// hashes len bytes of data, may be called any number of times
+void BRSHAUpdate(BRSHAContext *ctx, const void *data, size_t len)
+{
+    size_t off, n;
+    
+    assert(ctx != NULL);
+    assert(data != NULL || len == 0);
+    
+    for (off = ctx->len % 64, ctx->len += len; len > 0; off = (off + n) % 64) { // fill and compress 64 byte blocks
+        n = (64 - off < len) ? 64 - off : len;
+        memcpy((uint8_t *)ctx->x + off, data, n);
+        data = (const uint8_t *)data + n, len -= n;
+        if (off + n == 64) _BRSHACompress(ctx);
+    }
+}
+
+// writes the ctx->mdLen byte digest to md and wipes ctx
+void BRSHAFinal(BRSHAContext *ctx, void *md)
+{
+    size_t i, off;
+    
+    assert(ctx != NULL);
+    assert(md != NULL);
+    
+    off = ctx->len % 64;
+    memset((uint8_t *)ctx->x + off, 0, 64 - off); // clear remainder of x
+    ((uint8_t *)ctx->x)[off] = 0x80; // append padding
+    if (off >= 56) _BRSHACompress(ctx), memset(ctx->x, 0, 64); // length goes to next block
+    ctx->x[14] = be32((uint32_t)(ctx->len >> 29)), ctx->x[15] = be32((uint32_t)(ctx->len << 3)); // length in bits
+    _BRSHACompress(ctx); // finalize
+    for (i = 0; i < ctx->mdLen/4; i++) ctx->h[i] = be32(ctx->h[i]); // endian swap
+    memcpy(md, ctx->h, ctx->mdLen); // write to md
+    mem_clean(ctx, sizeof(*ctx));
+}
+
 // bitwise right rotation
 #define ror64(a, b) (((a) >> (b)) | ((a) << (64 - (b))))
 
@@ -312,33 +368,33 @@ void BRSHA512(void *md64, const void *data, size_t len)
 #define rmd(a, b, c, d, e, f, g, h, i, j) ((a) = rol32((f) + (b) + le32(c) + (d), (e)) + (g), (f) = (g), (g) = (h),\
                                            (h) = rol32((i), 10), (i) = (j), (j) = (a))
 
+// left line
+static const int rl1[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }, // round 1, id
+                 rl2[] = { 7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8 }, // round 2, rho
+                 rl3[] = { 3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12 }, // round 3, rho^2
+                 rl4[] = { 1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2 }, // round 4, rho^3
+                 rl5[] = { 4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13 }; // round 5, rho^4
+// right line
+static const int rr1[] = { 5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12 }, // round 1, pi
+                 rr2[] = { 6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2 }, // round 2, rho pi
+                 rr3[] = { 15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13 }, // round 3, rho^2 pi
+                 rr4[] = { 8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14 }, // round 4, rho^3 pi
+                 rr5[] = { 12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11 }; // round 5, rho^4 pi
+// left line shifts
+static const int sl1[] = { 11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8 }, // round 1
+                 sl2[] = { 7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12 }, // round 2
+                 sl3[] = { 11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5 }, // round 3
+                 sl4[] = { 11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12 }, // round 4
+                 sl5[] = { 9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6 }; // round 5
+// right line shifts
+static const int sr1[] = { 8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6 }, // round 1
+                 sr2[] = { 9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11 }, // round 2
+                 sr3[] = { 9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5 }, // round 3
+                 sr4[] = { 15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8 }, // round 4
+                 sr5[] = { 8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11 }; // round 5
+
 static void _BRRMDCompress(uint32_t *r, const uint32_t *x)
 {
-    // left line
-    static const int rl1[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }, // round 1, id
-                     rl2[] = { 7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8 }, // round 2, rho
-                     rl3[] = { 3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12 }, // round 3, rho^2
-                     rl4[] = { 1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2 }, // round 4, rho^3
-                     rl5[] = { 4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13 }; // round 5, rho^4
-    // right line
-    static const int rr1[] = { 5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12 }, // round 1, pi
-                     rr2[] = { 6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2 }, // round 2, rho pi
-                     rr3[] = { 15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13 }, // round 3, rho^2 pi
-                     rr4[] = { 8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14 }, // round 4, rho^3 pi
-                     rr5[] = { 12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11 }; // round 5, rho^4 pi
-    // left line shifts
-    static const int sl1[] = { 11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8 }, // round 1
-                     sl2[] = { 7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12 }, // round 2
-                     sl3[] = { 11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5 }, // round 3
-                     sl4[] = { 11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12 }, // round 4
-                     sl5[] = { 9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6 }; // round 5
-    // right line shifts
-    static const int sr1[] = { 8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6 }, // round 1
-                     sr2[] = { 9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11 }, // round 2
-                     sr3[] = { 9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5 }, // round 3
-                     sr4[] = { 15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8 }, // round 4
-                     sr5[] = { 8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11 }; // round 5
-
     int i;
     uint32_t al = r[0], bl = r[1], cl = r[2], dl = r[3], el = r[4], ar = al, br = bl, cr = cl, dr = dl, er = el, t;
     
@@ -396,10 +452,143 @@ void BRHash160(void *md20, const void *data, size_t len)
     BRRMD160(md20, t, sizeof(t));
 }
 
+// number of messages processed side by side by BRHash160Batch()
+// lane loops have no cross-lane dependencies, so compilers map them onto simd registers
+#define HASH_LANES 8
+
+static void _BRSHA256CompressLanes(uint32_t r[8][HASH_LANES], uint32_t w[64][HASH_LANES])
+{
+    size_t i, l;
+    uint32_t v[8][HASH_LANES], t1, t2;
+    
+    for (i = 16; i < 64; i++) {
+        for (l = 0; l < HASH_LANES; l++) w[i][l] = s3(w[i - 2][l]) + w[i - 7][l] + s2(w[i - 15][l]) + w[i - 16][l];
+    }
+    
+    memcpy(v, r, sizeof(v));
+    
+    for (i = 0; i < 64; i++) {
+        for (l = 0; l < HASH_LANES; l++) {
+            t1 = v[7][l] + s1(v[4][l]) + ch(v[4][l], v[5][l], v[6][l]) + sha256K[i] + w[i][l];
+            t2 = s0(v[0][l]) + maj(v[0][l], v[1][l], v[2][l]);
+            v[7][l] = v[6][l], v[6][l] = v[5][l], v[5][l] = v[4][l], v[4][l] = v[3][l] + t1;
+            v[3][l] = v[2][l], v[2][l] = v[1][l], v[1][l] = v[0][l], v[0][l] = t1 + t2;
+        }
+    }
+    
+    for (i = 0; i < 8; i++) {
+        for (l = 0; l < HASH_LANES; l++) r[i][l] += v[i][l];
+    }
+    
+    mem_clean(v, sizeof(v));
+    var_clean(&t1, &t2);
+}
+
+// x holds message words as they appear in memory, the same as the x argument to _BRRMDCompress()
+static void _BRRMDCompressLanes(uint32_t r[5][HASH_LANES], uint32_t x[16][HASH_LANES])
+{
+    size_t n, l;
+    uint32_t v[10][HASH_LANES], t; // al, bl, cl, dl, el, ar, br, cr, dr, er
+    
+    for (n = 0; n < 5; n++) {
+        for (l = 0; l < HASH_LANES; l++) v[n][l] = v[n + 5][l] = r[n][l];
+    }
+
+#define rmdl(fn, xi, k, s) rmd(t, fn(v[1][l], v[2][l], v[3][l]), xi, k, s, v[0][l], v[4][l], v[3][l], v[2][l], v[1][l])
+#define rmdr(fn, xi, k, s) rmd(t, fn(v[6][l], v[7][l], v[8][l]), xi, k, s, v[5][l], v[9][l], v[8][l], v[7][l], v[6][l])
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdl(f, x[rl1[n]][l], 0x00000000, sl1[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdr(j, x[rr1[n]][l], 0x50a28be6, sr1[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdl(g, x[rl2[n]][l], 0x5a827999, sl2[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdr(i, x[rr2[n]][l], 0x5c4dd124, sr2[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdl(h, x[rl3[n]][l], 0x6ed9eba1, sl3[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdr(h, x[rr3[n]][l], 0x6d703ef3, sr3[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdl(i, x[rl4[n]][l], 0x8f1bbcdc, sl4[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdr(g, x[rr4[n]][l], 0x7a6d76e9, sr4[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdl(j, x[rl5[n]][l], 0xa953fd4e, sl5[n]);
+    for (n = 0; n < 16; n++) for (l = 0; l < HASH_LANES; l++) rmdr(f, x[rr5[n]][l], 0x00000000, sr5[n]);
+#undef rmdl
+#undef rmdr
+
+    for (l = 0; l < HASH_LANES; l++) { // combine
+        t = r[1][l] + v[2][l] + v[8][l], r[1][l] = r[2][l] + v[3][l] + v[9][l], r[2][l] = r[3][l] + v[4][l] + v[5][l];
+        r[3][l] = r[4][l] + v[0][l] + v[6][l], r[4][l] = r[0][l] + v[1][l] + v[7][l], r[0][l] = t;
+    }
+    
+    mem_clean(v, sizeof(v));
+    var_clean(&t);
+}
+
+// hash-160 of count messages, each len bytes long and stored back to back in data, with count 20 byte digests written
+// to md20s in the same order, HASH_LANES messages at a time
+void BRHash160Batch(void *md20s, const void *data, size_t len, size_t count)
+{
+    static const uint32_t sha256IV[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                         0x1f83d9ab, 0x5be0cd19 },
+                          rmdIV[] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    size_t i, j, k, l, n, off, blockCount = (len + 9 + 63)/64; // message, 0x80 padding and 64bit length
+    uint32_t x[16], w[64][HASH_LANES], s[8][HASH_LANES], r[5][HASH_LANES];
+    
+    assert(md20s != NULL || count == 0);
+    assert(data != NULL || len == 0 || count == 0);
+    
+    for (i = 0; i < count; i += HASH_LANES) {
+        n = (count - i < HASH_LANES) ? count - i : HASH_LANES; // lanes past n only hash padding and are discarded
+        
+        for (j = 0; j < 8; j++) {
+            for (l = 0; l < HASH_LANES; l++) s[j][l] = sha256IV[j];
+        }
+        
+        for (k = 0, off = 0; k < blockCount; k++, off += 64) { // sha-256 of each message, one block per lane at a time
+            for (l = 0; l < HASH_LANES; l++) {
+                memset(x, 0, sizeof(x));
+                
+                if (l < n && off < len) {
+                    memcpy(x, (const uint8_t *)data + (i + l)*len + off, (len - off < 64) ? len - off : 64);
+                }
+                
+                if (off <= len && len - off < 64) ((uint8_t *)x)[len - off] = 0x80; // append padding
+                if (k + 1 == blockCount) x[14] = be32((uint32_t)(len >> 29)), x[15] = be32((uint32_t)(len << 3));
+                for (j = 0; j < 16; j++) w[j][l] = be32(x[j]);
+            }
+            
+            _BRSHA256CompressLanes(s, w);
+        }
+        
+        for (j = 0; j < 16; j++) { // ripemd-160 of each 32 byte sha-256 digest, a single padded block
+            for (l = 0; l < HASH_LANES; l++) w[j][l] = (j < 8) ? be32(s[j][l]) : 0;
+        }
+
+        for (l = 0; l < HASH_LANES; l++) w[8][l] = le32(0x80), w[14][l] = le32(32 << 3); // padding and length in bits
+        
+        for (j = 0; j < 5; j++) {
+            for (l = 0; l < HASH_LANES; l++) r[j][l] = rmdIV[j];
+        }
+        
+        _BRRMDCompressLanes(r, w);
+        
+        for (l = 0; l < n; l++) {
+            for (j = 0; j < 5; j++) x[j] = le32(r[j][l]); // endian swap
+            memcpy((uint8_t *)md20s + (i + l)*20, x, 20); // write to md
+        }
+    }
+    
+    mem_clean(x, sizeof(x));
+    mem_clean(w, sizeof(w));
+    mem_clean(s, sizeof(s));
+}
+
 // bitwise left rotation
 #define rol64(a, b) ((a) << (b) ^ ((a) >> (64 - (b))))
 
-static void _BRSHA3Compress(uint64_t *r, const uint64_t *x, size_t blockSize)
+// keccak chi step for the row of lanes starting at a[y]
+#define chi(a, b, y) ((a)[(y)] = (b)[(y)] ^ (~(b)[(y) + 1] & (b)[(y) + 2]),\
+                      (a)[(y) + 1] = (b)[(y) + 1] ^ (~(b)[(y) + 2] & (b)[(y) + 3]),\
+                      (a)[(y) + 2] = (b)[(y) + 2] ^ (~(b)[(y) + 3] & (b)[(y) + 4]),\
+                      (a)[(y) + 3] = (b)[(y) + 3] ^ (~(b)[(y) + 4] & (b)[(y)]),\
+                      (a)[(y) + 4] = (b)[(y) + 4] ^ (~(b)[(y)] & (b)[(y) + 1]))
+
+// keccak-f[1600] permutation, lanes are indexed x + 5*y and every step is unrolled so the state can stay in registers
+static void _BRKeccakF(uint64_t *a)
 {
     static const uint64_t k[] = { // keccak round constants
         0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000, 0x000000000000808b,
@@ -409,93 +598,136 @@ static void _BRSHA3Compress(uint64_t *r, const uint64_t *x, size_t blockSize)
         0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
     };
     
-    size_t i, j;
-    uint64_t a[5], b[5], r0, r1;
-    
-    for (i = 0; i < blockSize/sizeof(uint64_t); i++) r[i] ^= le64(x[i]);
+    uint64_t b[25], c[5], d[5];
     
-    for (i = 0; i < 24; i++) { // permute r
-        // theta(r)
-        for (j = 0; j < 5; j++) a[j] = r[j] ^ r[j + 5] ^ r[j + 10] ^ r[j + 15] ^ r[j + 20];
-        b[0] = rol64(a[1], 1) ^ a[4], b[1] = rol64(a[2], 1) ^ a[0], b[2] = rol64(a[3], 1) ^ a[1];
-        b[3] = rol64(a[4], 1) ^ a[2], b[4] = rol64(a[0], 1) ^ a[3];
-        for (j = 0; j < 5; j++) r[j] ^= b[j], r[j + 5] ^= b[j], r[j + 10] ^= b[j], r[j + 15] ^= b[j], r[j + 20] ^= b[j];
-        
-        // rho(r)
-        r[1] = rol64(r[1], 1), r[2] = rol64(r[2], 62), r[3] = rol64(r[3], 28), r[4] = rol64(r[4], 27);
-        r[5] = rol64(r[5], 36), r[6] = rol64(r[6], 44), r[7] = rol64(r[7], 6), r[8] = rol64(r[8], 55);
-        r[9] = rol64(r[9], 20), r[10] = rol64(r[10], 3), r[11] = rol64(r[11], 10), r[12] = rol64(r[12], 43);
-        r[13] = rol64(r[13], 25), r[14] = rol64(r[14], 39), r[15] = rol64(r[15], 41), r[16] = rol64(r[16], 45);
-        r[17] = rol64(r[17], 15), r[18] = rol64(r[18], 21), r[19] = rol64(r[19], 8), r[20] = rol64(r[20], 18);
-        r[21] = rol64(r[21], 2), r[22] = rol64(r[22], 61), r[23] = rol64(r[23], 56), r[24] = rol64(r[24], 14);
+    for (int i = 0; i < 24; i++) {
+        // theta(a)
+        c[0] = a[0] ^ a[5] ^ a[10] ^ a[15] ^ a[20], c[1] = a[1] ^ a[6] ^ a[11] ^ a[16] ^ a[21];
+        c[2] = a[2] ^ a[7] ^ a[12] ^ a[17] ^ a[22], c[3] = a[3] ^ a[8] ^ a[13] ^ a[18] ^ a[23];
+        c[4] = a[4] ^ a[9] ^ a[14] ^ a[19] ^ a[24];
+        d[0] = rol64(c[1], 1) ^ c[4], d[1] = rol64(c[2], 1) ^ c[0], d[2] = rol64(c[3], 1) ^ c[1];
+        d[3] = rol64(c[4], 1) ^ c[2], d[4] = rol64(c[0], 1) ^ c[3];
         
-        // pi(r)
-        r1 = r[1], r[1] = r[6], r[6] = r[9], r[9] = r[22], r[22] = r[14], r[14] = r[20], r[20] = r[2], r[2] = r[12],
-        r[12] = r[13], r[13] = r[19], r[19] = r[23], r[23] = r[15], r[15] = r[4], r[4] = r[24], r[24] = r[21];
-        r[21] = r[8], r[8] = r[16], r[16] = r[5], r[5] = r[3], r[3] = r[18], r[18] = r[17], r[17] = r[11], r[11] = r[7];
-        r[7] = r[10], r[10] = r1; // r[0] left as is
+        // rho(pi(a)), with theta's column parity applied to each lane as it's moved
+        b[0] = a[0] ^ d[0], b[1] = rol64(a[6] ^ d[1], 44), b[2] = rol64(a[12] ^ d[2], 43);
+        b[3] = rol64(a[18] ^ d[3], 21), b[4] = rol64(a[24] ^ d[4], 14);
+        b[5] = rol64(a[3] ^ d[3], 28), b[6] = rol64(a[9] ^ d[4], 20), b[7] = rol64(a[10] ^ d[0], 3);
+        b[8] = rol64(a[16] ^ d[1], 45), b[9] = rol64(a[22] ^ d[2], 61);
+        b[10] = rol64(a[1] ^ d[1], 1), b[11] = rol64(a[7] ^ d[2], 6), b[12] = rol64(a[13] ^ d[3], 25);
+        b[13] = rol64(a[19] ^ d[4], 8), b[14] = rol64(a[20] ^ d[0], 18);
+        b[15] = rol64(a[4] ^ d[4], 27), b[16] = rol64(a[5] ^ d[0], 36), b[17] = rol64(a[11] ^ d[1], 10);
+        b[18] = rol64(a[17] ^ d[2], 15), b[19] = rol64(a[23] ^ d[3], 56);
+        b[20] = rol64(a[2] ^ d[2], 62), b[21] = rol64(a[8] ^ d[3], 55), b[22] = rol64(a[14] ^ d[4], 39);
+        b[23] = rol64(a[15] ^ d[0], 41), b[24] = rol64(a[21] ^ d[1], 2);
         
-        for (j = 0; j < 25; j += 5) { // chi(r)
-            r0 = r[0 + j], r1 = r[1 + j], r[0 + j] ^= ~r1 & r[2 + j], r[1 + j] ^= ~r[2 + j] & r[3 + j];
-            r[2 + j] ^= ~r[3 + j] & r[4 + j], r[3 + j] ^= ~r[4 + j] & r0, r[4 + j] ^= ~r0 & r1;
-        }
-        
-        *r ^= k[i]; // iota(r, i)
+        chi(a, b, 0), chi(a, b, 5), chi(a, b, 10), chi(a, b, 15), chi(a, b, 20); // chi(b)
+        a[0] ^= k[i]; // iota(a, i)
     }
     
-    mem_clean(a, sizeof(a));
     mem_clean(b, sizeof(b));
-    var_clean(&r0, &r1);
+    mem_clean(c, sizeof(c));
+    mem_clean(d, sizeof(d));
+}
+
+// initializes a keccak sponge for incremental hashing
+// rate is the block size in bytes: 200 - 2*(hash length), e.g. 136 for 256bit hashes
+// pad is the domain separation byte: 0x06 for sha3, 0x01 for the original keccak, 0x1f for shake
+void BRKeccakInit(BRKeccakSponge *sponge, size_t rate, uint8_t pad)
+{
+    assert(sponge != NULL);
+    assert(rate > 0 && rate < sizeof(sponge->s) && (rate % sizeof(uint64_t)) == 0);
+    
+    memset(sponge, 0, sizeof(*sponge));
+    sponge->rate = rate;
+    sponge->pad = pad;
+}
+
+// xors len bytes of data into the sponge, permuting after each full block
+void BRKeccakAbsorb(BRKeccakSponge *sponge, const void *data, size_t len)
+{
+    const uint8_t *d = data;
+    size_t i, n;
+    uint64_t x;
+    
+    assert(sponge != NULL);
+    assert(data != NULL || len == 0);
+    assert(! sponge->squeezing);
+    
+    while (len > 0) {
+        if (sponge->off == 0 && len >= sponge->rate) { // absorb a whole block a word at a time
+            for (i = 0; i < sponge->rate/sizeof(uint64_t); i++) {
+                memcpy(&x, &d[i*sizeof(uint64_t)], sizeof(uint64_t));
+                sponge->s[i] ^= le64(x);
+            }
+            
+            _BRKeccakF(sponge->s);
+            d += sponge->rate, len -= sponge->rate;
+        }
+        else { // partial block
+            n = (sponge->rate - sponge->off < len) ? sponge->rate - sponge->off : len;
+            
+            for (i = sponge->off; i < sponge->off + n; i++) {
+                sponge->s[i/sizeof(uint64_t)] ^= (uint64_t)*d++ << (i % sizeof(uint64_t))*8;
+            }
+            
+            sponge->off += n, len -= n;
+            if (sponge->off == sponge->rate) _BRKeccakF(sponge->s), sponge->off = 0;
+        }
+    }
+    
+    var_clean(&x);
+}
+
+// pads the absorbed message on the first call, then writes the next len bytes of sponge output to out
+void BRKeccakSqueeze(BRKeccakSponge *sponge, void *out, size_t len)
+{
+    uint8_t *o = out;
+    size_t i;
+    
+    assert(sponge != NULL);
+    assert(out != NULL || len == 0);
+    
+    if (! sponge->squeezing) { // append padding
+        sponge->s[sponge->off/sizeof(uint64_t)] ^= (uint64_t)sponge->pad << (sponge->off % sizeof(uint64_t))*8;
+        sponge->s[(sponge->rate - 1)/sizeof(uint64_t)] ^= (uint64_t)0x80 << ((sponge->rate - 1) % sizeof(uint64_t))*8;
+        _BRKeccakF(sponge->s);
+        sponge->off = 0;
+        sponge->squeezing = 1;
+    }
+    
+    for (i = 0; i < len; i++) {
+        if (sponge->off == sponge->rate) _BRKeccakF(sponge->s), sponge->off = 0;
+        o[i] = (uint8_t)(sponge->s[sponge->off/sizeof(uint64_t)] >> (sponge->off % sizeof(uint64_t))*8);
+        sponge->off++;
+    }
 }
 
 // sha3-256: http://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.202.pdf
 void BRSHA3_256(void *md32, const void *data, size_t len)
 {
-    size_t i;
-    uint64_t x[17], buf[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    BRKeccakSponge sponge;
     
     assert(md32 != NULL);
     assert(data != NULL || len == 0);
     
-    for (i = 0; i <= len; i += 136) { // process data in 136 byte blocks
-        memcpy(x, (const uint8_t *)data + i, (i + 136 < len) ? 136 : len - i);
-        if (i + 136 > len) break;
-        _BRSHA3Compress(buf, x, 136);
-    }
-    
-    memset((uint8_t *)x + (len - i), 0, 136 - (len - i)); // clear remainder of x
-    ((uint8_t *)x)[len - i] |= 0x06; // append padding
-    ((uint8_t *)x)[135] |= 0x80;
-    _BRSHA3Compress(buf, x, 136); // finalize
-    for (i = 0; i < 4; i++) buf[i] = le64(buf[i]); // endian swap
-    memcpy(md32, buf, 32); // write to md
-    mem_clean(x, sizeof(x));
-    mem_clean(buf, sizeof(buf));
+    BRKeccakInit(&sponge, 136, 0x06);
+    BRKeccakAbsorb(&sponge, data, len);
+    BRKeccakSqueeze(&sponge, md32, 32);
+    mem_clean(&sponge, sizeof(sponge));
 }
 
 // keccak-256: https://keccak.team/files/Keccak-submission-3.pdf
 void BRKeccak256(void *md32, const void *data, size_t len)
 {
-    size_t i;
-    uint64_t x[17], buf[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    BRKeccakSponge sponge;
     
     assert(md32 != NULL);
     assert(data != NULL || len == 0);
     
-    for (i = 0; i <= len; i += 136) { // process data in 136 byte blocks
-        memcpy(x, (const uint8_t *)data + i, (i + 136 < len) ? 136 : len - i);
-        if (i + 136 > len) break;
-        _BRSHA3Compress(buf, x, 136);
-    }
-    
-    memset((uint8_t *)x + (len - i), 0, 136 - (len - i)); // clear remainder of x
-    ((uint8_t *)x)[len - i] |= 0x01; // append padding
-    ((uint8_t *)x)[135] |= 0x80;
-    _BRSHA3Compress(buf, x, 136); // finalize
-    for (i = 0; i < 4; i++) buf[i] = le64(buf[i]); // endian swap
-    memcpy(md32, buf, 32); // write to md
-    mem_clean(x, sizeof(x));
-    mem_clean(buf, sizeof(buf));
+    BRKeccakInit(&sponge, 136, 0x01);
+    BRKeccakAbsorb(&sponge, data, len);
+    BRKeccakSqueeze(&sponge, md32, 32);
+    mem_clean(&sponge, sizeof(sponge));
 }
 
 // basic md5 functions
@@ -48,18 +48,58 @@ void BRSHA384(void *md48, const void *data, size_t len);
 
 void BRSHA512(void *md64, const void *data, size_t len);
 
+typedef struct {
+    uint32_t h[8]; // intermediate hash value
+    uint32_t x[80]; // pending message block, sha-1 expands its message schedule in place
+    uint64_t len; // total bytes hashed so far
+    size_t mdLen; // 20 for sha-1, 28 for sha-224, 32 for sha-256
+} BRSHAContext;
+
+// initializes an incremental sha-1 (mdLen 20), sha-224 (mdLen 28) or sha-256 (mdLen 32) hash context
+void BRSHAInit(BRSHAContext *ctx, size_t mdLen);
+
+// hashes len bytes of data, may be called any number of times
+void BRSHAUpdate(BRSHAContext *ctx, const void *data, size_t len);
+
+// writes the ctx->mdLen byte digest to md and wipes ctx
+void BRSHAFinal(BRSHAContext *ctx, void *md);
+
 // ripemd-160: http://homes.esat.kuleuven.be/~bosselae/ripemd160.html
 void BRRMD160(void *md20, const void *data, size_t len);
 
 // bitcoin hash-160 = ripemd-160(sha-256(x))
 void BRHash160(void *md20, const void *data, size_t len);
 
+// hash-160 of count messages, each len bytes long and stored back to back in data (e.g. an array of 33 byte pubkeys)
+// writes count 20 byte digests to md20s, hashing several messages in parallel
+void BRHash160Batch(void *md20s, const void *data, size_t len, size_t count);
+
 // sha3-256: http://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.202.pdf
 void BRSHA3_256(void *md32, const void *data, size_t len);
 
 // keccak-256: https://keccak.team/files/Keccak-submission-3.pdf
 void BRKeccak256(void *md32, const void *data, size_t len);
 
+typedef struct {
+    uint64_t s[25]; // keccak-f[1600] state
+    size_t rate; // block size in bytes
+    size_t off; // bytes absorbed into, or squeezed out of, the current block
+    uint8_t pad; // domain separation byte
+    int squeezing;
+} BRKeccakSponge;
+
+// initializes a keccak sponge for incremental hashing
+// rate is the block size in bytes: 200 - 2*(hash length), e.g. 136 for 256bit hashes
+// pad is the domain separation byte: 0x06 for sha3, 0x01 for the original keccak, 0x1f for shake
+void BRKeccakInit(BRKeccakSponge *sponge, size_t rate, uint8_t pad);
+
+// xors len bytes of data into the sponge, permuting after each full block
+void BRKeccakAbsorb(BRKeccakSponge *sponge, const void *data, size_t len);
+
+// pads the absorbed message on the first call, then writes the next len bytes of sponge output to out
+// no more data may be absorbed once squeezing has started
+void BRKeccakSqueeze(BRKeccakSponge *sponge, void *out, size_t len);
+
 // md5 - for non-cryptographic use only
 void BRMD5(void *md16, const void *data, size_t len);
 
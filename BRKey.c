@@ -50,7 +50,14 @@
 #pragma clang diagnostic ignored "-Wconditional-uninitialized"
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #include "secp256k1/src/basic-config.h"
+#ifdef BITCOIN_ECMULT_WINDOW_SIZE // larger windows trade context memory (2^(n-2) points) for faster verification
+#undef ECMULT_WINDOW_SIZE
+#define ECMULT_WINDOW_SIZE BITCOIN_ECMULT_WINDOW_SIZE
+#endif
 #include "secp256k1/src/secp256k1.c"
+#if defined(BITCOIN_ECMULT_WINDOW_SIZE) && WINDOW_G != BITCOIN_ECMULT_WINDOW_SIZE
+#error "BITCOIN_ECMULT_WINDOW_SIZE needs a secp256k1 that sizes its WINDOW_G table from ECMULT_WINDOW_SIZE"
+#endif
 #pragma clang diagnostic pop
 #pragma GCC diagnostic pop
 
@@ -62,6 +69,17 @@ static void _ctx_init()
     _ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
 }
 
+// re-blinds the shared secp256k1 context using 32 bytes of host supplied entropy, to protect signing and key
+// generation against timing and power analysis side channels
+// must not be called while other threads are using BRKey or BRSecp256k1 functions
+// returns true on success
+int BRSecp256k1Randomize(const UInt256 *seed)
+{
+    assert(seed != NULL);
+    pthread_once(&_ctx_once, _ctx_init);
+    return secp256k1_context_randomize(_ctx, seed->u8);
+}
+
 // adds 256bit big endian ints a and b (mod secp256k1 order) and stores the result in a
 // returns true on success
 int BRSecp256k1ModAdd(UInt256 *a, const UInt256 *b)
@@ -344,6 +362,42 @@ int BRKeyVerify(BRKey *key, UInt256 md, const void *sig, size_t sigLen)
     return r;
 }
 
+// verifies count signatures, where sigs[i] of sigLens[i] bytes must have been made by keys[i] for mds[i]
+// each public key is parsed only once for a run of signatures by the same key
+// if results is not NULL, writes true or false to results[i] for each signature
+// returns the number of signatures that verified
+size_t BRKeyVerifyBatch(BRKey keys[], const UInt256 mds[], const void *sigs[], const size_t sigLens[], size_t count,
+                        int results[])
+{
+    secp256k1_pubkey pk;
+    secp256k1_ecdsa_signature s;
+    size_t i, len, lastLen = 0, n = 0;
+    int r, pkOk = 0;
+    
+    assert(keys != NULL || count == 0);
+    assert(mds != NULL || count == 0);
+    assert(sigs != NULL || count == 0);
+    assert(sigLens != NULL || count == 0);
+    
+    pthread_once(&_ctx_once, _ctx_init);
+    
+    for (i = 0; i < count; i++) {
+        len = BRKeyPubKey(&keys[i], NULL, 0);
+        
+        if (i == 0 || len != lastLen || memcmp(keys[i].pubKey, keys[i - 1].pubKey, len) != 0) {
+            pkOk = (len > 0 && secp256k1_ec_pubkey_parse(_ctx, &pk, keys[i].pubKey, len));
+            lastLen = len;
+        }
+        
+        r = (pkOk && sigs[i] && sigLens[i] > 0 && secp256k1_ecdsa_signature_parse_der(_ctx, &s, sigs[i], sigLens[i]) &&
+             secp256k1_ecdsa_verify(_ctx, &s, mds[i].u8, &pk) == 1); // success is 1, all other values are fail
+        if (results) results[i] = r;
+        if (r) n++;
+    }
+    
+    return n;
+}
+
 // wipes key material from key
 void BRKeyClean(BRKey *key)
 {
@@ -37,6 +37,12 @@ typedef struct {
     uint8_t p[33];
 } BRECPoint;
 
+// re-blinds the shared secp256k1 context using 32 bytes of host supplied entropy, to protect signing and key
+// generation against timing and power analysis side channels
+// must not be called while other threads are using BRKey or BRSecp256k1 functions
+// returns true on success
+int BRSecp256k1Randomize(const UInt256 *seed);
+
 // adds 256bit big endian ints a and b (mod secp256k1 order) and stores the result in a
 // returns true on success
 int BRSecp256k1ModAdd(UInt256 *a, const UInt256 *b);
@@ -99,6 +105,13 @@ size_t BRKeySign(const BRKey *key, void *sig, size_t sigLen, UInt256 md);
 // returns true if the signature for md is verified to have been made by key
 int BRKeyVerify(BRKey *key, UInt256 md, const void *sig, size_t sigLen);
 
+// verifies count signatures, where sigs[i] of sigLens[i] bytes must have been made by keys[i] for mds[i]
+// each public key is parsed only once for a run of signatures by the same key
+// if results is not NULL, writes true or false to results[i] for each signature
+// returns the number of signatures that verified
+size_t BRKeyVerifyBatch(BRKey keys[], const UInt256 mds[], const void *sigs[], const size_t sigLens[], size_t count,
+                        int results[]);
+
 // wipes key material from key
 void BRKeyClean(BRKey *key);
 
@@ -96,9 +96,7 @@ BRMerkleBlock *BRMerkleBlockCopy(const BRMerkleBlock *block)
     return cpy;
 }
 
-// buf must contain either a serialized merkleblock or header
-// returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
-BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
+static BRMerkleBlock *_BRMerkleBlockParse(const uint8_t *buf, size_t bufLen, const UInt256 *powHash)
 {
     BRMerkleBlock *block = (buf && 80 <= bufLen) ? BRMerkleBlockNew() : NULL;
     size_t off = 0, len = 0;
@@ -136,12 +134,27 @@ BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
         }
         
         BRSHA256_2(&block->blockHash, buf, 80);
-        BRScrypt(&block->powHash, sizeof(block->powHash), buf, 80, buf, 80, 1024, 1, 1);
+        if (powHash) block->powHash = *powHash;
+        else BRScrypt(&block->powHash, sizeof(block->powHash), buf, 80, buf, 80, 1024, 1, 1);
     }
     
     return block;
 }
 
+// buf must contain either a serialized merkleblock or header
+// returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
+BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
+{
+    return _BRMerkleBlockParse(buf, bufLen, NULL);
+}
+
+// same as BRMerkleBlockParse(), but uses the given proof-of-work hash instead of computing it, which is slow
+// powHash must be the scrypt hash of the 80 byte header at the start of buf, as found by a previous parse
+BRMerkleBlock *BRMerkleBlockParseWithPowHash(const uint8_t *buf, size_t bufLen, UInt256 powHash)
+{
+    return _BRMerkleBlockParse(buf, bufLen, &powHash);
+}
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL (block->height is not serialized)
 size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t bufLen)
 {
@@ -236,6 +249,71 @@ void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size
     if (block->flags) memcpy(block->flags, flags, flagsLen);
 }
 
+// returns the hash of the merkle tree node at the given height above the leaves and position in its row
+static UInt256 _BRMerkleBlockNodeHash(const UInt256 txHashes[], size_t txCount, int height, size_t pos)
+{
+    UInt256 hashes[2];
+    
+    if (height == 0) return txHashes[pos];
+    hashes[0] = _BRMerkleBlockNodeHash(txHashes, txCount, height - 1, pos*2);
+    // if the right branch is missing, dup the left branch
+    if (pos*2 + 1 < ((txCount + ((size_t)1 << (height - 1)) - 1) >> (height - 1))) {
+        hashes[1] = _BRMerkleBlockNodeHash(txHashes, txCount, height - 1, pos*2 + 1);
+    }
+    else hashes[1] = hashes[0];
+    
+    BRSHA256_2(&hashes[0], hashes, sizeof(hashes));
+    return hashes[0];
+}
+
+// walks the tree in depth-first order, writing a flag bit for each node and a hash for each node not descended into
+static void _BRMerkleBlockPartialTreeR(const UInt256 txHashes[], size_t txCount, const int matches[], int height,
+                                       size_t pos, UInt256 *hashes, size_t *hashIdx, uint8_t *flags, size_t *flagIdx)
+{
+    size_t start = pos << height, end = (pos + 1) << height, i;
+    int flag = 0;
+    
+    for (i = start; ! flag && i < end && i < txCount; i++) {
+        if (matches[i]) flag = 1;
+    }
+    
+    if (flag) flags[*flagIdx/8] |= (1 << (*flagIdx % 8));
+    (*flagIdx)++;
+    
+    if (height == 0 || ! flag) {
+        hashes[(*hashIdx)++] = _BRMerkleBlockNodeHash(txHashes, txCount, height, pos);
+    }
+    else {
+        _BRMerkleBlockPartialTreeR(txHashes, txCount, matches, height - 1, pos*2, hashes, hashIdx, flags, flagIdx);
+        
+        if (pos*2 + 1 < ((txCount + ((size_t)1 << (height - 1)) - 1) >> (height - 1))) {
+            _BRMerkleBlockPartialTreeR(txHashes, txCount, matches, height - 1, pos*2 + 1, hashes, hashIdx, flags,
+                                       flagIdx);
+        }
+    }
+}
+
+// sets the totalTx, hashes and flags fields from the complete list of txHashes in a block, encoding the partial merkle
+// tree for the tx where matches[i] is true, the same way a peer builds a merkleblock message from a full block
+void BRMerkleBlockSetMatchedTxHashes(BRMerkleBlock *block, const UInt256 txHashes[], size_t txCount,
+                                     const int matches[])
+{
+    int height = _ceil_log2((int)txCount);
+    size_t hashIdx = 0, flagIdx = 0, maxNodes = 2*txCount + height + 1; // upper bound on tree nodes visited
+    UInt256 *hashes = malloc(maxNodes*sizeof(*hashes));
+    uint8_t *flags = calloc((maxNodes + 7)/8, sizeof(*flags));
+    
+    assert(block != NULL);
+    assert(txHashes != NULL && txCount > 0);
+    assert(matches != NULL);
+    assert(hashes != NULL && flags != NULL);
+    _BRMerkleBlockPartialTreeR(txHashes, txCount, matches, height, 0, hashes, &hashIdx, flags, &flagIdx);
+    block->totalTx = (uint32_t)txCount;
+    BRMerkleBlockSetTxHashes(block, hashes, hashIdx, flags, (flagIdx + 7)/8);
+    free(flags);
+    free(hashes);
+}
+
 // recursively walks the merkle tree to calculate the merkle root
 // NOTE: this merkle tree design has a security vulnerability (CVE-2012-2459), which can be defended against by
 // considering the merkle root invalid if there are duplicate hashes in any rows with an even number of elements
@@ -264,6 +342,17 @@ static UInt256 _BRMerkleBlockRootR(const BRMerkleBlock *block, size_t *hashIdx,
     return md;
 }
 
+// true if the compact format proof-of-work target is in range
+static int _BRMerkleBlockTargetIsValid(uint32_t compactTarget)
+{
+    // target is in "compact" format, where the most significant byte is the size of resulting value in bytes, the next
+    // bit is the sign, and the remaining 23bits is the value after having been right shifted by (size - 3)*8 bits
+    static const uint32_t maxsize = MAX_PROOF_OF_WORK >> 24, maxtarget = MAX_PROOF_OF_WORK & 0x00ffffff;
+    const uint32_t size = compactTarget >> 24, target = compactTarget & 0x00ffffff;
+
+    return ! (target == 0 || target & 0x00800000 || size > maxsize || (size == maxsize && target > maxtarget));
+}
+
 // true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
 // NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
 // target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
@@ -271,9 +360,6 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
 {
     assert(block != NULL);
     
-    // target is in "compact" format, where the most significant byte is the size of resulting value in bytes, the next
-    // bit is the sign, and the remaining 23bits is the value after having been right shifted by (size - 3)*8 bits
-    static const uint32_t maxsize = MAX_PROOF_OF_WORK >> 24, maxtarget = MAX_PROOF_OF_WORK & 0x00ffffff;
     const uint32_t size = block->target >> 24, target = block->target & 0x00ffffff;
     size_t hashIdx = 0, flagIdx = 0;
     UInt256 merkleRoot = _BRMerkleBlockRootR(block, &hashIdx, &flagIdx, 0), t = UINT256_ZERO;
@@ -286,10 +372,10 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
     if (block->timestamp > currentTime + BLOCK_MAX_TIME_DRIFT) r = 0;
     
     // check if proof-of-work target is out of range
-    if (target == 0 || target & 0x00800000 || size > maxsize || (size == maxsize && target > maxtarget)) r = 0;
+    if (! _BRMerkleBlockTargetIsValid(block->target)) r = 0;
     
-    if (size > 3) UInt32SetLE(&t.u8[size - 3], target);
-    else UInt32SetLE(t.u8, target >> (3 - size)*8);
+    if (r && size > 3) UInt32SetLE(&t.u8[size - 3], target); // size is only known to fit in t if target is in range
+    else if (r) UInt32SetLE(t.u8, target >> (3 - size)*8);
     
     for (int i = sizeof(t) - 1; r && i >= 0; i--) { // check proof-of-work
         if (block->powHash.u8[i] < t.u8[i]) break;
@@ -299,6 +385,16 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
     return r;
 }
 
+// true if the 80 byte header at the start of buf has a timestamp that isn't too far in the future and a proof-of-work
+// target in range, the checks that don't need the slow scrypt hash, so junk headers can be rejected before computing it
+int BRMerkleBlockHeaderIsPlausible(const uint8_t *buf, size_t bufLen, uint32_t currentTime)
+{
+    assert(buf != NULL || bufLen == 0);
+    if (! buf || bufLen < 80) return 0;
+    if (UInt32GetLE(&buf[68]) > currentTime + BLOCK_MAX_TIME_DRIFT) return 0; // timestamp too far in future
+    return _BRMerkleBlockTargetIsValid(UInt32GetLE(&buf[72]));
+}
+
 // true if the given tx hash is known to be included in the block
 int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash)
 {
@@ -67,6 +67,10 @@ BRMerkleBlock *BRMerkleBlockCopy(const BRMerkleBlock *block);
 // returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
 BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen);
 
+// same as BRMerkleBlockParse(), but uses the given proof-of-work hash instead of computing it, which is slow
+// powHash must be the scrypt hash of the 80 byte header at the start of buf, as found by a previous parse
+BRMerkleBlock *BRMerkleBlockParseWithPowHash(const uint8_t *buf, size_t bufLen, UInt256 powHash);
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL (block->height is not serialized)
 size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t bufLen);
 
@@ -78,11 +82,20 @@ size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size
 void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size_t hashesCount,
                               const uint8_t *flags, size_t flagsLen);
 
+// sets the totalTx, hashes and flags fields from the complete list of txHashes in a block, encoding the partial merkle
+// tree for the tx where matches[i] is true, the same way a peer builds a merkleblock message from a full block
+void BRMerkleBlockSetMatchedTxHashes(BRMerkleBlock *block, const UInt256 txHashes[], size_t txCount,
+                                     const int matches[]);
+
 // true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
 // NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
 // target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
 int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime);
 
+// true if the 80 byte header at the start of buf has a timestamp that isn't too far in the future and a proof-of-work
+// target in range, the checks that don't need the slow scrypt hash, so junk headers can be rejected before computing it
+int BRMerkleBlockHeaderIsPlausible(const uint8_t *buf, size_t bufLen, uint32_t currentTime);
+
 // true if the given tx hash is known to be included in the block
 int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash);
 
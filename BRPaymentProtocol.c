@@ -40,6 +40,7 @@
 typedef struct {
     uint8_t *defaults;
     uint8_t *unknown;
+    size_t *certs; // offsets of each certificate field in pkiData, for messages that carry a certificate chain
 } ProtoBufContext;
 
 static uint64_t _ProtoBufVarInt(const uint8_t *buf, size_t bufLen, size_t *off)
@@ -165,6 +166,37 @@ static void _ProtoBufSetInt(uint8_t *buf, size_t bufLen, uint64_t i, uint64_t ke
     _ProtoBufSetVarInt(buf, bufLen, i, off);
 }
 
+// the following hash functions feed serialized fields directly into a hash context, without buffering the message
+static void _ProtoBufHashVarInt(BRSHAContext *sha, uint64_t i)
+{
+    uint8_t buf[10];
+    size_t off = 0;
+    
+    _ProtoBufSetVarInt(buf, sizeof(buf), i, &off);
+    BRSHAUpdate(sha, buf, off);
+}
+
+static void _ProtoBufHashBytes(BRSHAContext *sha, const uint8_t *bytes, size_t bytesLen, uint64_t key)
+{
+    _ProtoBufHashVarInt(sha, (key << 3) | PROTOBUF_LENDELIM);
+    
+    if (bytes || bytesLen == 0) {
+        _ProtoBufHashVarInt(sha, bytesLen);
+        BRSHAUpdate(sha, bytes, bytesLen);
+    }
+}
+
+static void _ProtoBufHashString(BRSHAContext *sha, const char *str, uint64_t key)
+{
+    _ProtoBufHashBytes(sha, (const uint8_t *)str, (str) ? strlen(str) : 0, key);
+}
+
+static void _ProtoBufHashInt(BRSHAContext *sha, uint64_t i, uint64_t key)
+{
+    _ProtoBufHashVarInt(sha, (key << 3) | PROTOBUF_VARINT);
+    _ProtoBufHashVarInt(sha, i);
+}
+
 static void _ProtoBufUnknown(uint8_t **unknown, uint64_t key, uint64_t i, const void *data, size_t dataLen)
 {
     size_t bufLen = 10 + ((key & 0x07) == PROTOBUF_LENDELIM ? dataLen : 0);
@@ -226,6 +258,43 @@ typedef enum {
     certificates_cert = 1
 } certificates_key;
 
+// records the offset of each certificate in a serialized X509Certificates message, so that any certificate in the
+// chain can be found without re-scanning pkiData
+static void _ProtoBufCertIndex(size_t **certs, const uint8_t *pkiData, size_t pkiDataLen)
+{
+    size_t off = 0, o;
+    
+    if (! *certs) array_new(*certs, 3);
+    array_clear(*certs);
+    
+    while (pkiData && off < pkiDataLen) {
+        const uint8_t *data = NULL;
+        size_t dataLen = pkiDataLen;
+        uint64_t key;
+        
+        o = off;
+        key = _ProtoBufField(NULL, &data, pkiData, &dataLen, &off);
+        if ((key >> 3) == certificates_cert && data) array_add(*certs, o);
+    }
+}
+
+static size_t _ProtoBufCert(const size_t *certs, const uint8_t *pkiData, size_t pkiDataLen, uint8_t *cert,
+                            size_t certLen, size_t idx)
+{
+    const uint8_t *data = NULL;
+    size_t off, len = 0;
+    
+    if (certs && idx < array_count(certs)) {
+        off = certs[idx];
+        len = pkiDataLen;
+        _ProtoBufField(NULL, &data, pkiData, &len, &off);
+        if (! data) len = 0;
+        else if (cert && len <= certLen) memcpy(cert, data, len);
+    }
+    
+    return (! cert || len <= certLen) ? len : 0;
+}
+
 typedef enum {
     payment_merch_data = 1,
     payment_transactions = 2,
@@ -271,7 +340,7 @@ typedef enum {
 static BRTxOutput _BRPaymentProtocolOutput(uint64_t amount, uint8_t *script, size_t scriptLen)
 {
     BRTxOutput out = BR_TX_OUTPUT_NONE;
-    ProtoBufContext ctx = { NULL, NULL };
+    ProtoBufContext ctx = { NULL, NULL, NULL };
     
     assert(script != NULL || scriptLen == 0);
     
@@ -287,7 +356,7 @@ static BRTxOutput _BRPaymentProtocolOutput(uint64_t amount, uint8_t *script, siz
 static BRTxOutput _BRPaymentProtocolOutputParse(const uint8_t *buf, size_t bufLen)
 {
     BRTxOutput out = BR_TX_OUTPUT_NONE;
-    ProtoBufContext ctx = { NULL, NULL };
+    ProtoBufContext ctx = { NULL, NULL, NULL };
     size_t off = 0;
 
     array_new(ctx.defaults, output_script + 1);
@@ -511,6 +580,7 @@ BRPaymentProtocolRequest *BRPaymentProtocolRequestNew(uint32_t version, const ch
     else _ProtoBufString(&req->pkiType, pkiType, strlen(pkiType));
     
     if (pkiData) req->pkiDataLen = _ProtoBufBytes(&req->pkiData, pkiData, pkiDataLen);
+    _ProtoBufCertIndex(&ctx->certs, req->pkiData, req->pkiDataLen);
     req->details = details;
     if (signature) req->sigLen = _ProtoBufBytes(&req->signature, signature, sigLen);
 
@@ -558,6 +628,8 @@ BRPaymentProtocolRequest *BRPaymentProtocolRequestParse(const uint8_t *buf, size
         ctx->defaults[request_pki_type] = 1;
     }
     
+    _ProtoBufCertIndex(&ctx->certs, req->pkiData, req->pkiDataLen);
+    
     if (! req->details) { // required
         BRPaymentProtocolRequestFree(req);
         req = NULL;
@@ -604,56 +676,49 @@ size_t BRPaymentProtocolRequestSerialize(const BRPaymentProtocolRequest *req, ui
 // returns 0 if index is out-of-bounds
 size_t BRPaymentProtocolRequestCert(const BRPaymentProtocolRequest *req, uint8_t *cert, size_t certLen, size_t idx)
 {
-    size_t off = 0, len = 0;
-    
+    const ProtoBufContext *ctx = (const ProtoBufContext *)&req[1];
+
     assert(req != NULL);
-    
-    while (req->pkiData && off < req->pkiDataLen) {
-        const uint8_t *data = NULL;
-        size_t dataLen = req->pkiDataLen;
-        uint64_t i = 0, key = _ProtoBufField(&i, &data, req->pkiData, &dataLen, &off);
-        
-        if ((key >> 3) == certificates_cert && data) {
-            if (idx == 0) {
-                len = dataLen;
-                if (cert && len <= certLen) memcpy(cert, data, len);
-                break;
-            }
-            else idx--;
-        }
-    }
-    
-    return (idx == 0 && (! cert || len <= certLen)) ? len : 0;
+    return _ProtoBufCert(ctx->certs, req->pkiData, req->pkiDataLen, cert, certLen, idx);
 }
 
 // writes the hash of the request to md needed to sign or verify the request
 // returns the number of bytes written, or the total mdLen needed if md is NULL
 size_t BRPaymentProtocolRequestDigest(BRPaymentProtocolRequest *req, uint8_t *md, size_t mdLen)
 {
-    uint8_t *buf;
-    size_t bufLen;
+    const ProtoBufContext *ctx = (const ProtoBufContext *)&req[1];
+    BRSHAContext sha;
+    size_t len = 0;
     
     assert(req != NULL);
-
-    req->sigLen = 0; // set signature to 0 bytes, a signature can't sign itself
-    bufLen = BRPaymentProtocolRequestSerialize(req, NULL, 0);
-    buf = malloc(bufLen);
-    assert(buf != NULL);
-    bufLen = BRPaymentProtocolRequestSerialize(req, buf, bufLen);
     
-    if (req->pkiType && strncmp(req->pkiType, "x509+sha256", strlen("x509+sha256") + 1) == 0) {
-        if (md && 256/8 <= mdLen) BRSHA256(md, buf, bufLen);
-        bufLen = 256/8;
-    }
-    else if (req->pkiType && strncmp(req->pkiType, "x509+sha1", strlen("x509+sha1") + 1) == 0) {
-        if (md && 160/8 <= mdLen) BRSHA1(md, buf, bufLen);
-        bufLen = 160/8;
+    if (req->pkiType && strncmp(req->pkiType, "x509+sha256", strlen("x509+sha256") + 1) == 0) len = 256/8;
+    else if (req->pkiType && strncmp(req->pkiType, "x509+sha1", strlen("x509+sha1") + 1) == 0) len = 160/8;
+    
+    if (md && len > 0 && len <= mdLen) { // stream the serialized request into the hash, field by field
+        BRSHAInit(&sha, len);
+        if (! ctx->defaults[request_version]) _ProtoBufHashInt(&sha, req->version, request_version);
+        if (! ctx->defaults[request_pki_type]) _ProtoBufHashString(&sha, req->pkiType, request_pki_type);
+        if (req->pkiData) _ProtoBufHashBytes(&sha, req->pkiData, req->pkiDataLen, request_pki_data);
+        
+        if (req->details) {
+            size_t detailsLen = BRPaymentProtocolDetailsSerialize(req->details, NULL, 0);
+            uint8_t _buf[(detailsLen <= 0x1000) ? detailsLen : 0],
+                    *detailsBuf = (detailsLen <= 0x1000) ? _buf : malloc(detailsLen);
+            
+            assert(detailsBuf != NULL);
+            detailsLen = BRPaymentProtocolDetailsSerialize(req->details, detailsBuf, detailsLen);
+            _ProtoBufHashBytes(&sha, detailsBuf, detailsLen, request_details);
+            if (detailsBuf != _buf) free(detailsBuf);
+        }
+        
+        // signature is hashed as 0 bytes, a signature can't sign itself
+        if (req->signature) _ProtoBufHashBytes(&sha, NULL, 0, request_signature);
+        if (ctx->unknown) BRSHAUpdate(&sha, ctx->unknown, array_count(ctx->unknown));
+        BRSHAFinal(&sha, md);
     }
-    else bufLen = 0;
     
-    free(buf);
-    if (req->signature) req->sigLen = array_count(req->signature);
-    return (! md || bufLen <= mdLen) ? bufLen : 0;
+    return (! md || len <= mdLen) ? len : 0;
 }
 
 // frees memory allocated for request struct
@@ -669,6 +734,7 @@ void BRPaymentProtocolRequestFree(BRPaymentProtocolRequest *req)
     if (req->signature) array_free(req->signature);
     if (ctx->defaults) array_free(ctx->defaults);
     if (ctx->unknown) array_free(ctx->unknown);
+    if (ctx->certs) array_free(ctx->certs);
     free(req);
 }
 
@@ -936,6 +1002,7 @@ BRPaymentProtocolInvoiceRequest *BRPaymentProtocolInvoiceRequestNew(BRKey *sende
     else _ProtoBufString(&req->pkiType, pkiType, strlen(pkiType));
     
     if (pkiData) req->pkiDataLen = _ProtoBufBytes(&req->pkiData, pkiData, pkiDataLen);
+    _ProtoBufCertIndex(&ctx->certs, req->pkiData, req->pkiDataLen);
     if (memo) _ProtoBufString(&req->memo, memo, strlen(memo));
     if (notifyUrl) _ProtoBufString(&req->notifyUrl, notifyUrl, strlen(notifyUrl));
     if (signature) req->sigLen = _ProtoBufBytes(&req->signature, signature, sigLen);
@@ -980,6 +1047,8 @@ BRPaymentProtocolInvoiceRequest *BRPaymentProtocolInvoiceRequestParse(const uint
         ctx->defaults[invoice_req_pki_type] = 1;
     }
 
+    _ProtoBufCertIndex(&ctx->certs, req->pkiData, req->pkiDataLen);
+
     if (! gotSenderPK) { // required
         BRPaymentProtocolInvoiceRequestFree(req);
         req = NULL;
@@ -1020,52 +1089,40 @@ size_t BRPaymentProtocolInvoiceRequestSerialize(BRPaymentProtocolInvoiceRequest
 size_t BRPaymentProtocolInvoiceRequestCert(const BRPaymentProtocolInvoiceRequest *req, uint8_t *cert, size_t certLen,
                                            size_t idx)
 {
-    size_t off = 0, len = 0;
-    
+    const ProtoBufContext *ctx = (const ProtoBufContext *)&req[1];
+
     assert(req != NULL);
-    
-    while (req->pkiData && off < req->pkiDataLen) {
-        const uint8_t *data = NULL;
-        size_t dataLen = req->pkiDataLen;
-        uint64_t i = 0, key = _ProtoBufField(&i, &data, req->pkiData, &dataLen, &off);
-        
-        if ((key >> 3) == certificates_cert && data) {
-            if (idx == 0) {
-                len = dataLen;
-                if (cert && len <= certLen) memcpy(cert, data, len);
-                break;
-            }
-            else idx--;
-        }
-    }
-    
-    return (idx == 0 && (! cert || len <= certLen)) ? len : 0;
+    return _ProtoBufCert(ctx->certs, req->pkiData, req->pkiDataLen, cert, certLen, idx);
 }
 
 // writes the hash of the request to md needed to sign or verify the request
 // returns the number of bytes written, or the total mdLen needed if md is NULL
 size_t BRPaymentProtocolInvoiceRequestDigest(BRPaymentProtocolInvoiceRequest *req, uint8_t *md, size_t mdLen)
 {
-    uint8_t *buf;
-    size_t bufLen;
+    const ProtoBufContext *ctx = (const ProtoBufContext *)&req[1];
+    BRSHAContext sha;
+    uint8_t pk[65];
+    size_t len = 0;
     
     assert(req != NULL);
     
-    req->sigLen = 0; // set signature to 0 bytes, a signature can't sign itself
-    bufLen = BRPaymentProtocolInvoiceRequestSerialize(req, NULL, 0);
-    buf = malloc(bufLen);
-    assert(buf != NULL);
-    bufLen = BRPaymentProtocolInvoiceRequestSerialize(req, buf, bufLen);
-    
-    if (req->pkiType && strncmp(req->pkiType, "x509+sha256", strlen("x509+sha256") + 1) == 0) {
-        if (md && 256/8 <= mdLen) BRSHA256(md, buf, bufLen);
-        bufLen = 256/8;
+    if (req->pkiType && strncmp(req->pkiType, "x509+sha256", strlen("x509+sha256") + 1) == 0) len = 256/8;
+    
+    if (md && len > 0 && len <= mdLen) { // stream the serialized request into the hash, field by field
+        BRSHAInit(&sha, len);
+        _ProtoBufHashBytes(&sha, pk, BRKeyPubKey(&req->senderPubKey, pk, sizeof(pk)), invoice_req_sender_pk);
+        if (! ctx->defaults[invoice_req_amount]) _ProtoBufHashInt(&sha, req->amount, invoice_req_amount);
+        if (! ctx->defaults[invoice_req_pki_type]) _ProtoBufHashString(&sha, req->pkiType, invoice_req_pki_type);
+        if (req->pkiData) _ProtoBufHashBytes(&sha, req->pkiData, req->pkiDataLen, invoice_req_pki_data);
+        if (req->memo) _ProtoBufHashString(&sha, req->memo, invoice_req_memo);
+        if (req->notifyUrl) _ProtoBufHashString(&sha, req->notifyUrl, invoice_req_notify_url);
+        // signature is hashed as 0 bytes, a signature can't sign itself
+        if (req->signature) _ProtoBufHashBytes(&sha, NULL, 0, invoice_req_signature);
+        if (ctx->unknown) BRSHAUpdate(&sha, ctx->unknown, array_count(ctx->unknown));
+        BRSHAFinal(&sha, md);
     }
-    else bufLen = 0;
     
-    free(buf);
-    if (req->signature) req->sigLen = array_count(req->signature);
-    return (! md || bufLen <= mdLen) ? bufLen : 0;
+    return (! md || len <= mdLen) ? len : 0;
 }
 
 // frees memory allocated for invoice request struct
@@ -1082,6 +1139,7 @@ void BRPaymentProtocolInvoiceRequestFree(BRPaymentProtocolInvoiceRequest *req)
     if (req->signature) array_free(req->signature);
     if (ctx->defaults) array_free(ctx->defaults);
     if (ctx->unknown) array_free(ctx->unknown);
+    if (ctx->certs) array_free(ctx->certs);
     free(req);
 }
 
@@ -1199,39 +1257,51 @@ static void _BRECDH(void *out32, BRKey *privKey, BRKey *pubKey)
     memcpy(out32, &p[1], 32); // unpack the x coordinate
 }
 
-static void _BRPaymentProtocolEncryptedMessageCEK(BRPaymentProtocolEncryptedMessage *msg, void *cek32, void *iv12,
-                                                  BRKey *privKey)
+// writes the sha512 hash of the ECDH shared secret to seed64, the seed all message content encryption keys between
+// privKey and pubKey are derived from
+static void _BRPaymentProtocolSeed(void *seed64, BRKey *privKey, BRKey *pubKey)
 {
-    uint8_t secret[32], seed[512/8], K[256/8], V[256/8], pk[65], rpk[65],
-            nonce[] = { msg->nonce >> 56, msg->nonce >> 48, msg->nonce >> 40, msg->nonce >> 32,
-                        msg->nonce >> 24, msg->nonce >> 16, msg->nonce >> 8, msg->nonce }; // convert to big endian
-    size_t pkLen = BRKeyPubKey(privKey, pk, sizeof(pk)),
-           rpkLen = BRKeyPubKey(&msg->receiverPubKey, rpk, sizeof(rpk));
-    BRKey *pubKey = (pkLen != rpkLen || memcmp(pk, rpk, pkLen) != 0) ? &msg->receiverPubKey : &msg->senderPubKey;
-
+    uint8_t secret[32];
+    
     _BRECDH(secret, privKey, pubKey);
-    BRSHA512(seed, secret, sizeof(secret));
+    BRSHA512(seed64, secret, sizeof(secret));
     mem_clean(secret, sizeof(secret));
-    BRHMACDRBG(cek32, 32, K, V, BRSHA256, 256/8, seed, sizeof(seed), nonce, sizeof(nonce), NULL, 0);
-    mem_clean(seed, sizeof(seed));
+}
+
+static void _BRPaymentProtocolCEK(const void *seed64, uint64_t nonce, void *cek32, void *iv12)
+{
+    uint8_t K[256/8], V[256/8],
+            n[] = { nonce >> 56, nonce >> 48, nonce >> 40, nonce >> 32,
+                    nonce >> 24, nonce >> 16, nonce >> 8, nonce }; // convert to big endian
+
+    BRHMACDRBG(cek32, 32, K, V, BRSHA256, 256/8, seed64, 512/8, n, sizeof(n), NULL, 0);
     BRHMACDRBG(iv12, 12, K, V, BRSHA256, 256/8, NULL, 0, NULL, 0, NULL, 0);
     mem_clean(K, sizeof(K));
     mem_clean(V, sizeof(V));
 }
 
-// returns a newly allocated encrypted message struct that must be freed by calling BRPaymentProtocolMessageFree()
-// message is the un-encrypted serialized payment protocol message
-// one of either receiverKey or senderKey must contain a private key, and the other must contain only a public key
-BRPaymentProtocolEncryptedMessage *BRPaymentProtocolEncryptedMessageNew(BRPaymentProtocolMessageType msgType,
-                                                                        const uint8_t *message, size_t msgLen,
-                                                                        BRKey *receiverKey, BRKey *senderKey,
-                                                                        uint64_t nonce,
-                                                                        const uint8_t *identifier, size_t identLen,
-                                                                        uint64_t statusCode, const char *statusMsg)
+static void _BRPaymentProtocolEncryptedMessageSeed(BRPaymentProtocolEncryptedMessage *msg, void *seed64,
+                                                   BRKey *privKey)
+{
+    uint8_t pk[65], rpk[65];
+    size_t pkLen = BRKeyPubKey(privKey, pk, sizeof(pk)),
+           rpkLen = BRKeyPubKey(&msg->receiverPubKey, rpk, sizeof(rpk));
+    BRKey *pubKey = (pkLen != rpkLen || memcmp(pk, rpk, pkLen) != 0) ? &msg->receiverPubKey : &msg->senderPubKey;
+
+    _BRPaymentProtocolSeed(seed64, privKey, pubKey);
+}
+
+static BRPaymentProtocolEncryptedMessage *_BRPaymentProtocolEncryptedMessageNew(BRPaymentProtocolMessageType msgType,
+                                                                                const uint8_t *message, size_t msgLen,
+                                                                                BRKey *receiverKey, BRKey *senderKey,
+                                                                                BRKey *privKey, const void *seed64,
+                                                                                uint64_t nonce,
+                                                                                const uint8_t *identifier,
+                                                                                size_t identLen, uint64_t statusCode,
+                                                                                const char *statusMsg)
 {
     BRPaymentProtocolEncryptedMessage *msg = calloc(1, sizeof(*msg) + sizeof(ProtoBufContext));
     ProtoBufContext *ctx = (ProtoBufContext *)&msg[1];
-    BRKey *privKey;
     size_t pkLen, sigLen, bufLen = msgLen + 16, adLen = (statusMsg) ? 20 + strlen(statusMsg) + 1 : 20 + 1;
     char *ad = calloc(adLen, sizeof(*ad));
     uint8_t cek[32], iv[12], pk[65], sig[73], md[256/8], *buf = malloc(bufLen);
@@ -1239,10 +1309,6 @@ BRPaymentProtocolEncryptedMessage *BRPaymentProtocolEncryptedMessageNew(BRPaymen
     assert(msg != NULL);
     assert(ad != NULL);
     assert(buf != NULL);
-    assert(message != NULL || msgLen == 0);
-    assert(receiverKey != NULL);
-    assert(senderKey != NULL);
-    assert(BRKeyPrivKey(receiverKey, NULL, 0) != 0 || BRKeyPrivKey(senderKey, NULL, 0) != 0);
     
     array_new(ctx->defaults, encrypted_msg_status_msg + 1);
     array_set_count(ctx->defaults, encrypted_msg_status_msg + 1);
@@ -1255,8 +1321,7 @@ BRPaymentProtocolEncryptedMessage *BRPaymentProtocolEncryptedMessageNew(BRPaymen
     if (identifier) msg->identLen = _ProtoBufBytes(&msg->identifier, identifier, identLen);
     msg->statusCode = statusCode;
     if (statusMsg) _ProtoBufString(&msg->statusMsg, statusMsg, strlen(statusMsg));
-    privKey = (BRKeyPrivKey(receiverKey, NULL, 0) != 0) ? receiverKey : senderKey;
-    _BRPaymentProtocolEncryptedMessageCEK(msg, cek, iv, privKey);
+    _BRPaymentProtocolCEK(seed64, nonce, cek, iv);
     snprintf(ad, adLen, "%"PRIu64"%s", statusCode, (statusMsg) ? statusMsg : "");
     bufLen = BRChacha20Poly1305AEADEncrypt(buf, bufLen, cek, iv, message, msgLen, ad, strlen(ad));
     mem_clean(cek, sizeof(cek));
@@ -1285,6 +1350,34 @@ BRPaymentProtocolEncryptedMessage *BRPaymentProtocolEncryptedMessageNew(BRPaymen
     return msg;
 }
 
+// returns a newly allocated encrypted message struct that must be freed by calling BRPaymentProtocolMessageFree()
+// message is the un-encrypted serialized payment protocol message
+// one of either receiverKey or senderKey must contain a private key, and the other must contain only a public key
+BRPaymentProtocolEncryptedMessage *BRPaymentProtocolEncryptedMessageNew(BRPaymentProtocolMessageType msgType,
+                                                                        const uint8_t *message, size_t msgLen,
+                                                                        BRKey *receiverKey, BRKey *senderKey,
+                                                                        uint64_t nonce,
+                                                                        const uint8_t *identifier, size_t identLen,
+                                                                        uint64_t statusCode, const char *statusMsg)
+{
+    BRPaymentProtocolEncryptedMessage *msg;
+    BRKey *privKey, *pubKey;
+    uint8_t seed[512/8];
+    
+    assert(message != NULL || msgLen == 0);
+    assert(receiverKey != NULL);
+    assert(senderKey != NULL);
+    assert(BRKeyPrivKey(receiverKey, NULL, 0) != 0 || BRKeyPrivKey(senderKey, NULL, 0) != 0);
+    
+    privKey = (BRKeyPrivKey(receiverKey, NULL, 0) != 0) ? receiverKey : senderKey;
+    pubKey = (privKey == receiverKey) ? senderKey : receiverKey;
+    _BRPaymentProtocolSeed(seed, privKey, pubKey);
+    msg = _BRPaymentProtocolEncryptedMessageNew(msgType, message, msgLen, receiverKey, senderKey, privKey, seed, nonce,
+                                                identifier, identLen, statusCode, statusMsg);
+    mem_clean(seed, sizeof(seed));
+    return msg;
+}
+
 // buf must contain a serialized encrytped message
 // returns an encrypted message struct that must be freed by calling BRPaymentProtocolEncryptedMessageFree()
 BRPaymentProtocolEncryptedMessage *BRPaymentProtocolEncryptedMessageParse(const uint8_t *buf, size_t bufLen)
@@ -1379,24 +1472,18 @@ int BRPaymentProtocolEncryptedMessageVerify(BRPaymentProtocolEncryptedMessage *m
     return BRKeyVerify(pubKey, UInt256Get(md), msg->signature, msg->sigLen);
 }
 
-size_t BRPaymentProtocolEncryptedMessageDecrypt(BRPaymentProtocolEncryptedMessage *msg, uint8_t *out, size_t outLen,
-                                                BRKey *privKey)
+static size_t _BRPaymentProtocolEncryptedMessageDecrypt(BRPaymentProtocolEncryptedMessage *msg, uint8_t *out,
+                                                        size_t outLen, const void *seed64)
 {
     const ProtoBufContext *ctx = (const ProtoBufContext *)&msg[1];
     uint8_t cek[32], iv[12];
     size_t adLen;
     char *ad;
 
-    assert(msg != NULL);
-    assert(msg->message != NULL);
-    
-    if (! out) return (msg->msgLen < 16) ? 0 : msg->msgLen - 16;
-
-    assert(privKey != NULL);
-
-    _BRPaymentProtocolEncryptedMessageCEK(msg, cek, iv, privKey);
+    _BRPaymentProtocolCEK(seed64, msg->nonce, cek, iv);
     adLen = (msg->statusMsg) ? 20 + strlen(msg->statusMsg) + 1 : 20 + 1;
     ad = calloc(adLen, sizeof(*ad));
+    assert(ad != NULL);
     
     if (! ctx->defaults[encrypted_msg_status_code]) {
         snprintf(ad, adLen, "%"PRIu64"%s", msg->statusCode, (msg->statusMsg) ? msg->statusMsg : "");
@@ -1410,6 +1497,24 @@ size_t BRPaymentProtocolEncryptedMessageDecrypt(BRPaymentProtocolEncryptedMessag
     return outLen;
 }
 
+size_t BRPaymentProtocolEncryptedMessageDecrypt(BRPaymentProtocolEncryptedMessage *msg, uint8_t *out, size_t outLen,
+                                                BRKey *privKey)
+{
+    uint8_t seed[512/8];
+
+    assert(msg != NULL);
+    assert(msg->message != NULL);
+    
+    if (! out) return (msg->msgLen < 16) ? 0 : msg->msgLen - 16;
+
+    assert(privKey != NULL);
+
+    _BRPaymentProtocolEncryptedMessageSeed(msg, seed, privKey);
+    outLen = _BRPaymentProtocolEncryptedMessageDecrypt(msg, out, outLen, seed);
+    mem_clean(seed, sizeof(seed));
+    return outLen;
+}
+
 // frees memory allocated for encrypted message struct
 void BRPaymentProtocolEncryptedMessageFree(BRPaymentProtocolEncryptedMessage *msg)
 {
@@ -1425,3 +1530,83 @@ void BRPaymentProtocolEncryptedMessageFree(BRPaymentProtocolEncryptedMessage *ms
     if (ctx->unknown) array_free(ctx->unknown);
     free(msg);
 }
+
+struct BRPaymentProtocolSessionStruct {
+    BRKey privKey;
+    BRKey receiverPubKey;
+    BRKey senderPubKey;
+    uint8_t seed[512/8]; // sha512 of the ECDH shared secret
+};
+
+// returns a newly allocated session that must be freed by calling BRPaymentProtocolSessionFree()
+// one of either receiverKey or senderKey must contain a private key, and the other must contain only a public key
+// the ECDH shared secret for the key pair is computed once, and reused for every message encrypted or decrypted with the
+// session, so a session should be kept for as long as messages are exchanged with the same party
+BRPaymentProtocolSession *BRPaymentProtocolSessionNew(BRKey *receiverKey, BRKey *senderKey)
+{
+    BRPaymentProtocolSession *session = calloc(1, sizeof(*session));
+    BRKey *privKey, *pubKey;
+    uint8_t pk[65];
+    size_t pkLen;
+
+    assert(session != NULL);
+    assert(receiverKey != NULL);
+    assert(senderKey != NULL);
+    assert(BRKeyPrivKey(receiverKey, NULL, 0) != 0 || BRKeyPrivKey(senderKey, NULL, 0) != 0);
+    
+    privKey = (BRKeyPrivKey(receiverKey, NULL, 0) != 0) ? receiverKey : senderKey;
+    pubKey = (privKey == receiverKey) ? senderKey : receiverKey;
+    session->privKey = *privKey;
+    pkLen = BRKeyPubKey(receiverKey, pk, sizeof(pk));
+    BRKeySetPubKey(&session->receiverPubKey, pk, pkLen);
+    pkLen = BRKeyPubKey(senderKey, pk, sizeof(pk));
+    BRKeySetPubKey(&session->senderPubKey, pk, pkLen);
+    _BRPaymentProtocolSeed(session->seed, privKey, pubKey);
+    return session;
+}
+
+// returns a newly allocated encrypted message struct from the session's receiver to sender, or sender to receiver,
+// that must be freed with BRPaymentProtocolEncryptedMessageFree()
+// message is the un-encrypted serialized payment protocol message
+BRPaymentProtocolEncryptedMessage *BRPaymentProtocolSessionEncrypt(BRPaymentProtocolSession *session,
+                                                                   BRPaymentProtocolMessageType msgType,
+                                                                   const uint8_t *message, size_t msgLen,
+                                                                   uint64_t nonce,
+                                                                   const uint8_t *identifier, size_t identLen,
+                                                                   uint64_t statusCode, const char *statusMsg)
+{
+    assert(session != NULL);
+    assert(message != NULL || msgLen == 0);
+    
+    return _BRPaymentProtocolEncryptedMessageNew(msgType, message, msgLen, &session->receiverPubKey,
+                                                 &session->senderPubKey, &session->privKey, session->seed, nonce,
+                                                 identifier, identLen, statusCode, statusMsg);
+}
+
+// decrypts msg and writes the un-encrypted message to out
+// returns the number of bytes written, or outLen needed if out is NULL
+// returns 0 if decryption fails, or if msg is not between the session's receiver and sender keys
+size_t BRPaymentProtocolSessionDecrypt(BRPaymentProtocolSession *session, BRPaymentProtocolEncryptedMessage *msg,
+                                       uint8_t *out, size_t outLen)
+{
+    assert(session != NULL);
+    assert(msg != NULL);
+    assert(msg->message != NULL);
+    
+    if (! out) return (msg->msgLen < 16) ? 0 : msg->msgLen - 16;
+    if (memcmp(msg->receiverPubKey.pubKey, session->receiverPubKey.pubKey, sizeof(msg->receiverPubKey.pubKey)) != 0 ||
+        memcmp(msg->senderPubKey.pubKey, session->senderPubKey.pubKey, sizeof(msg->senderPubKey.pubKey)) != 0 ||
+        msg->receiverPubKey.compressed != session->receiverPubKey.compressed ||
+        msg->senderPubKey.compressed != session->senderPubKey.compressed) return 0;
+    return _BRPaymentProtocolEncryptedMessageDecrypt(msg, out, outLen, session->seed);
+}
+
+// wipes key material and frees memory allocated for session
+void BRPaymentProtocolSessionFree(BRPaymentProtocolSession *session)
+{
+    assert(session != NULL);
+    
+    BRKeyClean(&session->privKey);
+    mem_clean(session->seed, sizeof(session->seed));
+    free(session);
+}
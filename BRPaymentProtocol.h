@@ -256,6 +256,33 @@ size_t BRPaymentProtocolEncryptedMessageDecrypt(BRPaymentProtocolEncryptedMessag
 // frees memory allocated for encrypted message struct
 void BRPaymentProtocolEncryptedMessageFree(BRPaymentProtocolEncryptedMessage *msg);
 
+typedef struct BRPaymentProtocolSessionStruct BRPaymentProtocolSession;
+
+// returns a newly allocated session that must be freed by calling BRPaymentProtocolSessionFree()
+// one of either receiverKey or senderKey must contain a private key, and the other must contain only a public key
+// the ECDH shared secret for the key pair is computed once, and reused for every message encrypted or decrypted with the
+// session, so a session should be kept for as long as messages are exchanged with the same party
+BRPaymentProtocolSession *BRPaymentProtocolSessionNew(BRKey *receiverKey, BRKey *senderKey);
+
+// returns a newly allocated encrypted message struct from the session's receiver to sender, or sender to receiver,
+// that must be freed with BRPaymentProtocolEncryptedMessageFree()
+// message is the un-encrypted serialized payment protocol message
+BRPaymentProtocolEncryptedMessage *BRPaymentProtocolSessionEncrypt(BRPaymentProtocolSession *session,
+                                                                   BRPaymentProtocolMessageType msgType,
+                                                                   const uint8_t *message, size_t msgLen,
+                                                                   uint64_t nonce,
+                                                                   const uint8_t *identifier, size_t identLen,
+                                                                   uint64_t statusCode, const char *statusMsg);
+
+// decrypts msg and writes the un-encrypted message to out
+// returns the number of bytes written, or outLen needed if out is NULL
+// returns 0 if decryption fails, or if msg is not between the session's receiver and sender keys
+size_t BRPaymentProtocolSessionDecrypt(BRPaymentProtocolSession *session, BRPaymentProtocolEncryptedMessage *msg,
+                                       uint8_t *out, size_t outLen);
+
+// wipes key material and frees memory allocated for session
+void BRPaymentProtocolSessionFree(BRPaymentProtocolSession *session);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,12 +28,14 @@
 #include "BRSet.h"
 #include "BRArray.h"
 #include "BRCrypto.h"
+#include "BRThreadPool.h"
 #include "BRInt.h"
 #include <stdlib.h>
 #include <float.h>
 #include <inttypes.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -52,6 +54,13 @@
 #define LOCAL_HOST         ((UInt128) { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0x7f, 0x00, 0x00, 0x01 })
 #define CONNECT_TIMEOUT    3.0
 #define MESSAGE_TIMEOUT    10.0
+#define MSG_QUEUE_LENGTH   8     // messages read ahead of processing before the socket thread waits
+#define BLOCK_PARSE_THREADS 4    // tx in a full block are parsed and hashed in up to this many parallel chunks
+
+#define POW_NONE           0 // proof-of-work hash of a read-ahead block message isn't being computed ahead
+#define POW_PENDING        1 // waiting for a thread pool worker to compute it
+#define POW_HASHING        2 // being computed
+#define POW_DONE           3 // computed, or found in the shared proof-of-work hash cache, and stored in the message
 
 // the standard blockchain download protocol works as follows (for SPV mode):
 // - local peer sends getblocks
@@ -103,6 +112,7 @@ typedef struct {
     int sentVerack, gotVerack, sentGetaddr, sentFilter, sentGetdata, sentMempool, sentGetblocks;
     UInt256 lastBlockHash;
     BRMerkleBlock *currentBlock;
+    BRPowHashCache *powHashCache;
     UInt256 *currentBlockTxHashes, *knownBlockHashes, *knownTxHashes;
     BRSet *knownTxHashSet;
     volatile int socket;
@@ -118,15 +128,66 @@ typedef struct {
                      size_t blockCount);
     void (*setFeePerKb)(void *info, uint64_t feePerKb);
     BRTransaction *(*requestedTx)(void *info, UInt256 txHash);
+    int (*txMatches)(void *info, const BRTransaction *tx);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
-    void **volatile pongInfo;
+    void (*msgThreadCleanup)(void *info);
+    void **volatile pongInfo; // deques, waiting pong callbacks are called in the order the pings were sent
     void (**volatile pongCallback)(void *info, int success);
     void *volatile mempoolInfo;
     void (*volatile mempoolCallback)(void *info, int success);
-    pthread_t thread;
+    BRQueue *msgQueue; // messages read from the socket, waiting to be processed
+    volatile int msgError;
+    const UInt256 *msgPowHash; // proof-of-work hash of the block message being processed, if it was computed ahead
+    pthread_t thread, msgThread;
 } BRPeerContext;
 
+typedef struct {
+    char type[12];
+    uint32_t len;
+    unsigned refCount; // held by the socket or message thread, and by a proof-of-work task until it's done
+    int powState;
+    UInt256 powHash;
+    uint8_t payload[];
+} BRPeerMessage;
+
+static void _BRPeerMessageRelease(BRPeerMessage *msg)
+{
+    if (__atomic_sub_fetch(&msg->refCount, 1, __ATOMIC_ACQ_REL) == 0) free(msg);
+}
+
+// computes the scrypt hash of a block message header on the thread pool while earlier messages are still processed,
+// unless the message thread already got to the message and claimed it first
+static void _BRPeerMessagePowTask(void *arg)
+{
+    BRPeerMessage *msg = arg;
+    int state = POW_PENDING;
+
+    if (__atomic_compare_exchange_n(&msg->powState, &state, POW_HASHING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        BRScrypt(&msg->powHash, sizeof(msg->powHash), msg->payload, 80, msg->payload, 80, 1024, 1, 1);
+        __atomic_store_n(&msg->powState, POW_DONE, __ATOMIC_RELEASE);
+    }
+
+    _BRPeerMessageRelease(msg);
+}
+
+// returns the proof-of-work hash computed ahead for msg, or NULL if it wasn't started, in which case it never will be
+static const UInt256 *_BRPeerMessagePowHash(BRPeerMessage *msg)
+{
+    int state = POW_PENDING;
+
+    if (__atomic_compare_exchange_n(&msg->powState, &state, POW_NONE, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    while (state == POW_HASHING) { // a worker is partway through a single scrypt, so this is never a long wait
+        sched_yield();
+        state = __atomic_load_n(&msg->powState, __ATOMIC_ACQUIRE);
+    }
+
+    return (state == POW_DONE) ? &msg->powHash : NULL;
+}
+
 void BRPeerSendVersionMessage(BRPeer *peer);
 void BRPeerSendVerackMessage(BRPeer *peer);
 void BRPeerSendAddr(BRPeer *peer);
@@ -332,7 +393,7 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             off += 36;
         }
 
-        if (txCount > 0 && ! ctx->sentFilter && ! ctx->sentMempool && ! ctx->sentGetblocks) {
+        if (txCount > 0 && ! ctx->sentFilter && ! ctx->sentMempool && ! ctx->sentGetblocks && ! ctx->txMatches) {
             peer_log(peer, "got inv message before loading a filter");
             r = 0;
         }
@@ -346,7 +407,7 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             r = 0;
         }
         else {
-            if (! ctx->sentFilter && ! ctx->sentGetblocks) blockCount = 0;
+            if (! ctx->sentFilter && ! ctx->sentGetblocks && ! ctx->txMatches) blockCount = 0;
             if (blockCount == 1 && UInt256Eq(ctx->lastBlockHash, UInt256Get(blocks[0]))) blockCount = 0;
             if (blockCount == 1) ctx->lastBlockHash = UInt256Get(blocks[0]);
 
@@ -415,7 +476,10 @@ static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLe
         txHash = tx->txHash;
         peer_log(peer, "got tx: %s", u256hex(txHash));
 
-        if (ctx->relayedTx) {
+        if (ctx->txMatches && ! ctx->txMatches(ctx->info, tx)) { // no filter is loaded, so drop non-matching tx here
+            BRTransactionFree(tx);
+        }
+        else if (ctx->relayedTx) {
             ctx->relayedTx(ctx->info, tx);
         }
         else BRTransactionFree(tx);
@@ -423,7 +487,7 @@ static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLe
         if (ctx->currentBlock) { // we're collecting tx messages for a merkleblock
             for (size_t i = array_count(ctx->currentBlockTxHashes); i > 0; i--) {
                 if (! UInt256Eq(txHash, ctx->currentBlockTxHashes[i - 1])) continue;
-                array_rm(ctx->currentBlockTxHashes, i - 1);
+                array_rm_swap(ctx->currentBlockTxHashes, i - 1);
                 break;
             }
         
@@ -439,10 +503,44 @@ static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLe
     return r;
 }
 
+typedef struct {
+    BRPowHashCache *cache;
+    const uint8_t *headers;
+    BRMerkleBlock **blocks;
+} BRPeerHeadersInfo;
+
+// parses header i of a headers message, computing its proof-of-work hash unless chain already has it
+static void _BRPeerParseHeader(void *info, size_t i)
+{
+    BRPeerHeadersInfo *headersInfo = info;
+    const uint8_t *buf = &headersInfo->headers[81*i];
+
+    headersInfo->blocks[i] = (headersInfo->cache) ? BRPowHashCacheParseBlock(headersInfo->cache, buf, 81) :
+                             BRMerkleBlockParse(buf, 81);
+}
+
+// checks that each header links to the one before it and passes the checks that don't need proof-of-work hashing
+// returns the index of the first header that doesn't, or count if they all do
+static size_t _BRPeerCheckHeaders(const uint8_t *headers, size_t count, uint32_t currentTime)
+{
+    UInt256 prevHash = UINT256_ZERO;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *buf = &headers[81*i];
+
+        if (i > 0 && ! UInt256Eq(UInt256Get(&buf[sizeof(uint32_t)]), prevHash)) break;
+        if (! BRMerkleBlockHeaderIsPlausible(buf, 81, currentTime)) break;
+        BRSHA256_2(&prevHash, buf, 80);
+    }
+
+    return i;
+}
+
 static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    size_t off = 0, count = (size_t)BRVarInt(msg, msgLen, &off);
+    size_t off = 0, count = (size_t)BRVarInt(msg, msgLen, &off), bad = 0;
     int r = 1;
 
     if (off == 0 || off + 81*count > msgLen) {
@@ -450,6 +548,11 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
                  BRVarIntSize(count) + 81*count, count);
         r = 0;
     }
+    else if ((bad = _BRPeerCheckHeaders(&msg[off], count, (uint32_t)time(NULL))) < count) {
+        // reject a junk batch before any of it is proof-of-work hashed, scrypt costs far more than these checks
+        peer_log(peer, "invalid block header %zu of %zu, rejected without proof-of-work hashing", bad + 1, count);
+        r = 0;
+    }
     else {
         peer_log(peer, "got %zu header(s)", count);
     
@@ -478,19 +581,29 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
             }
             else BRPeerSendGetheaders(peer, locators, 2, UINT256_ZERO);
 
-            for (size_t i = 0; r && i < count; i++) {
-                BRMerkleBlock *block = BRMerkleBlockParse(&msg[off + 81*i], 81);
-                
-                if (! BRMerkleBlockIsValid(block, (uint32_t)now)) {
-                    peer_log(peer, "invalid block header: %s", u256hex(block->blockHash));
-                    BRMerkleBlockFree(block);
+            BRMerkleBlock **blocks = calloc(count, sizeof(*blocks));
+            BRPeerHeadersInfo headersInfo = { ctx->powHashCache, &msg[off], blocks };
+            struct timeval tv;
+            double start;
+
+            assert(blocks != NULL);
+            gettimeofday(&tv, NULL);
+            start = tv.tv_sec + (double)tv.tv_usec/1000000;
+            BRThreadPoolApply(_BRPeerParseHeader, &headersInfo, count, BRTaskPriorityLow); // scrypt in parallel
+
+            for (size_t i = 0; i < count; i++) {
+                if (r && ! BRMerkleBlockIsValid(blocks[i], (uint32_t)now)) {
+                    gettimeofday(&tv, NULL);
+                    peer_log(peer, "invalid block header: %s, spent %fs hashing %zu header(s)",
+                             u256hex(blocks[i]->blockHash), tv.tv_sec + (double)tv.tv_usec/1000000 - start, count);
                     r = 0;
                 }
-                else if (ctx->relayedBlock) {
-                    ctx->relayedBlock(ctx->info, block);
-                }
-                else BRMerkleBlockFree(block);
+
+                if (r && ctx->relayedBlock) ctx->relayedBlock(ctx->info, blocks[i]);
+                else BRMerkleBlockFree(blocks[i]);
             }
+
+            free(blocks);
         }
         else {
             peer_log(peer, "non-standard headers message, %zu is fewer header(s) than expected", count);
@@ -547,9 +660,13 @@ static int _BRPeerAcceptGetdataMessage(BRPeer *peer, const uint8_t *msg, size_t
                         
                         peer_log(peer, "publishing tx: %s", txHex);
                         BRPeerSendMessage(peer, buf, bufLen, MSG_TX);
+                        BRTransactionFree(tx);
+                        tx = NULL;
                         break;
                     }
-                    
+
+                    if (tx) BRTransactionFree(tx); // too large to relay
+                    tx = NULL;
                     // fall through
                 default:
                     if (! notfound) array_new(notfound, 1);
@@ -655,7 +772,7 @@ static int _BRPeerAcceptPongMessage(BRPeer *peer, const uint8_t *msg, size_t msg
         peer_log(peer, "pong message has wrong nonce: %"PRIu64", expected: %"PRIu64, UInt64GetLE(msg), ctx->nonce);
         r = 0;
     }
-    else if (array_count(ctx->pongCallback) == 0) {
+    else if (deque_count(ctx->pongCallback) == 0) {
         peer_log(peer, "got unexpected pong");
         r = 0;
     }
@@ -671,12 +788,12 @@ static int _BRPeerAcceptPongMessage(BRPeer *peer, const uint8_t *msg, size_t msg
         }
         else peer_log(peer, "got pong");
 
-        if (array_count(ctx->pongCallback) > 0) {
-            void (*pongCallback)(void *, int) = ctx->pongCallback[0];
-            void *pongInfo = ctx->pongInfo[0];
+        if (deque_count(ctx->pongCallback) > 0) {
+            void (*pongCallback)(void *, int) = deque_item(ctx->pongCallback, 0);
+            void *pongInfo = deque_item(ctx->pongInfo, 0);
 
-            array_rm(ctx->pongCallback, 0);
-            array_rm(ctx->pongInfo, 0);
+            deque_rm_first(ctx->pongCallback);
+            deque_rm_first(ctx->pongInfo);
             if (pongCallback) pongCallback(pongInfo, 1);
         }
     }
@@ -690,7 +807,9 @@ static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, siz
     // a merkleblock message, the remote node is expected to send tx messages for the tx referenced in the block. When a
     // non-tx message is received we should have all the tx in the merkleblock.
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    BRMerkleBlock *block = BRMerkleBlockParse(msg, msgLen);
+    BRMerkleBlock *block = (ctx->msgPowHash) ? BRMerkleBlockParseWithPowHash(msg, msgLen, *ctx->msgPowHash) :
+                           (ctx->powHashCache) ? BRPowHashCacheParseBlock(ctx->powHashCache, msg, msgLen) :
+                           BRMerkleBlockParse(msg, msgLen);
     int r = 1;
   
     if (! block) {
@@ -738,6 +857,73 @@ static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, siz
     return r;
 }
 
+static int _BRPeerAcceptBlockMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    // A full block is requested instead of a merkleblock when no bloom filter is loaded. The tx are matched locally,
+    // and the block is passed on as a merkleblock containing just the matched tx, so it's handled the same from there.
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    BRMerkleBlock *block = (! msg || msgLen < 80) ? NULL : (ctx->msgPowHash) ?
+                           BRMerkleBlockParseWithPowHash(msg, 80, *ctx->msgPowHash) : (ctx->powHashCache) ?
+                           BRPowHashCacheParseBlock(ctx->powHashCache, msg, 80) : BRMerkleBlockParse(msg, 80);
+    size_t i, len = 0, off = 80, count = (block) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    BRTransaction **txs = NULL;
+    UInt256 *txHashes = NULL;
+    int *matches = NULL, r = 1;
+    
+    off += len;
+    
+    if (! block || off > msgLen || count == 0 || count > (msgLen - off)/60) { // a tx is at least 60 bytes
+        peer_log(peer, "malformed block message with length: %zu", msgLen);
+        r = 0;
+    }
+    else if (! ctx->txMatches || ! ctx->sentGetdata) {
+        peer_log(peer, "got block message without requesting full blocks");
+        r = 0;
+    }
+    else {
+        txs = calloc(count, sizeof(*txs));
+        txHashes = malloc(count*sizeof(*txHashes));
+        matches = calloc(count, sizeof(*matches));
+        assert(txs != NULL && txHashes != NULL && matches != NULL);
+        len = BRTransactionParseMany(txs, txHashes, count, &msg[off], msgLen - off, BLOCK_PARSE_THREADS);
+        // no matches yet, this just sets the merkle root to be verified
+        if (len > 0) BRMerkleBlockSetMatchedTxHashes(block, txHashes, count, matches);
+    
+        if (len == 0 || off + len != msgLen) {
+            peer_log(peer, "malformed block message with length: %zu", msgLen);
+            r = 0;
+        }
+        else if (! BRMerkleBlockIsValid(block, (uint32_t)time(NULL))) {
+            peer_log(peer, "invalid block: %s", u256hex(block->blockHash));
+            r = 0;
+        }
+    }
+    
+    for (i = 0; txs && i < count; i++) { // match tx in block order, so a wallet tx can be spent later in the same block
+        // some non-standard tx can't be parsed, but are still covered by the merkle root
+        if (r && txs[i]) matches[i] = ctx->txMatches(ctx->info, txs[i]);
+        
+        if (matches[i] && ! BRSetContains(ctx->knownTxHashSet, &txHashes[i])) {
+            _BRPeerAddKnownTxHashes(peer, &txHashes[i], 1);
+            if (ctx->relayedTx) ctx->relayedTx(ctx->info, txs[i]);
+            else BRTransactionFree(txs[i]);
+        }
+        else if (txs[i]) BRTransactionFree(txs[i]);
+    }
+    
+    if (r) {
+        BRMerkleBlockSetMatchedTxHashes(block, txHashes, count, matches);
+        if (ctx->relayedBlock) ctx->relayedBlock(ctx->info, block);
+        else BRMerkleBlockFree(block);
+    }
+    else if (block) BRMerkleBlockFree(block);
+    
+    if (matches) free(matches);
+    if (txHashes) free(txHashes);
+    if (txs) free(txs);
+    return r;
+}
+
 // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 static int _BRPeerAcceptRejectMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
@@ -831,6 +1017,7 @@ static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen,
     else if (strncmp(MSG_PING, type, 12) == 0) r = _BRPeerAcceptPingMessage(peer, msg, msgLen);
     else if (strncmp(MSG_PONG, type, 12) == 0) r = _BRPeerAcceptPongMessage(peer, msg, msgLen);
     else if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) r = _BRPeerAcceptMerkleblockMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_BLOCK, type, 12) == 0) r = _BRPeerAcceptBlockMessage(peer, msg, msgLen);
     else if (strncmp(MSG_REJECT, type, 12) == 0) r = _BRPeerAcceptRejectMessage(peer, msg, msgLen);
     else if (strncmp(MSG_FEEFILTER, type, 12) == 0) r = _BRPeerAcceptFeeFilterMessage(peer, msg, msgLen);
     else peer_log(peer, "dropping %s, length %zu, not implemented", type, msgLen);
@@ -914,6 +1101,47 @@ static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *erro
     return r;
 }
 
+// processes messages from the socket thread in the order they were read, so the next message can be read from the
+// network while the previous one is still being parsed, verified and handed to the peer manager
+static void *_peerMessageThreadRoutine(void *arg)
+{
+    BRPeer *peer = arg;
+    BRPeerContext *ctx = arg;
+    BRPeerMessage *msg;
+    struct timeval tv;
+
+    // not threadCleanup, which may free info while the socket thread still needs it for the disconnected callback
+    pthread_cleanup_push(ctx->msgThreadCleanup, ctx->info);
+
+    while (! BRQueueIsClosed(ctx->msgQueue)) {
+        msg = BRQueuePop(ctx->msgQueue, 1.0);
+        gettimeofday(&tv, NULL);
+        
+        if (tv.tv_sec + (double)tv.tv_usec/1000000 >= ctx->mempoolTime) {
+            peer_log(peer, "done waiting for mempool response");
+            BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
+            ctx->mempoolCallback = NULL;
+            ctx->mempoolTime = DBL_MAX;
+        }
+        
+        if (msg && ! ctx->msgError) {
+            ctx->msgPowHash = _BRPeerMessagePowHash(msg);
+
+            if (! _BRPeerAcceptMessage(peer, msg->payload, msg->len, msg->type)) {
+                ctx->msgError = EPROTO;
+                BRPeerDisconnect(peer); // stops the socket thread
+            }
+
+            ctx->msgPowHash = NULL;
+        }
+        
+        if (msg) _BRPeerMessageRelease(msg);
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
 static void *_peerThreadRoutine(void *arg)
 {
     BRPeer *peer = arg;
@@ -925,13 +1153,18 @@ static void *_peerThreadRoutine(void *arg)
     if (_BRPeerOpenSocket(peer, PF_INET6, CONNECT_TIMEOUT, &error)) {
         struct timeval tv;
         double time = 0, msgTimeout;
-        uint8_t header[HEADER_LENGTH], *payload = malloc(0x1000);
-        size_t len = 0, payloadLen = 0x1000;
+        uint8_t header[HEADER_LENGTH];
+        BRPeerMessage *msg;
+        size_t len = 0;
         ssize_t n = 0;
+        int pipelined;
 
-        assert(payload != NULL);
         gettimeofday(&tv, NULL);
         ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
+        ctx->msgError = 0;
+        if (BRQueueIsClosed(ctx->msgQueue)) BRQueueReopen(ctx->msgQueue);
+        // if a message thread can't be started, messages are processed on this thread instead
+        pipelined = (pthread_create(&ctx->msgThread, NULL, _peerMessageThreadRoutine, peer) == 0);
         BRPeerSendVersionMessage(peer);
         
         while (ctx->socket >= 0 && ! error) {
@@ -947,7 +1180,7 @@ static void *_peerThreadRoutine(void *arg)
                 time = tv.tv_sec + (double)tv.tv_usec/1000000;
                 if (! error && time >= ctx->disconnectTime) error = ETIMEDOUT;
 
-                if (! error && time >= ctx->mempoolTime) {
+                if (! error && ! pipelined && time >= ctx->mempoolTime) {
                     peer_log(peer, "done waiting for mempool response");
                     BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
                     ctx->mempoolCallback = NULL;
@@ -979,14 +1212,18 @@ static void *_peerThreadRoutine(void *arg)
                     error = EPROTO;
                 }
                 else {
-                    if (msgLen > payloadLen) payload = realloc(payload, (payloadLen = msgLen));
-                    assert(payload != NULL);
+                    msg = malloc(sizeof(*msg) + msgLen);
+                    assert(msg != NULL);
+                    memcpy(msg->type, type, sizeof(msg->type));
+                    msg->len = msgLen;
+                    msg->refCount = 1;
+                    msg->powState = POW_NONE;
                     len = 0;
                     socket = ctx->socket;
                     msgTimeout = time + MESSAGE_TIMEOUT;
                     
                     while (socket >= 0 && ! error && len < msgLen) {
-                        n = read(socket, &payload[len], msgLen - len);
+                        n = read(socket, &msg->payload[len], msgLen - len);
                         if (n > 0) len += n;
                         if (n == 0) error = ECONNRESET;
                         if (n < 0 && errno != EWOULDBLOCK) error = errno;
@@ -1001,20 +1238,52 @@ static void *_peerThreadRoutine(void *arg)
                         peer_log(peer, "%s", strerror(error));
                     }
                     else if (len == msgLen) {
-                        BRSHA256_2(&hash, payload, msgLen);
+                        BRSHA256_2(&hash, msg->payload, msgLen);
                         
                         if (UInt32GetLE(&hash) != checksum) { // verify checksum
                             peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
                                      ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen, u256hex(hash));
                             error = EPROTO;
                         }
-                        else if (! _BRPeerAcceptMessage(peer, payload, msgLen, type)) error = EPROTO;
+                        else if (pipelined) {
+                            // start hashing block headers now, so the message thread finds them already hashed,
+                            // unless another peer already verified the block and its hash is in the shared cache
+                            if (msgLen >= 80 && (strncmp(MSG_MERKLEBLOCK, type, 12) == 0 ||
+                                                 strncmp(MSG_BLOCK, type, 12) == 0)) {
+                                if (ctx->powHashCache) BRSHA256_2(&hash, msg->payload, 80);
+
+                                if (ctx->powHashCache && BRPowHashCacheGet(ctx->powHashCache, hash, &msg->powHash)) {
+                                    msg->powState = POW_DONE;
+                                }
+                                else {
+                                    msg->refCount = 2;
+                                    msg->powState = POW_PENDING;
+
+                                    if (! BRThreadPoolRun(_BRPeerMessagePowTask, msg, BRTaskPriorityHigh)) {
+                                        msg->refCount = 1;
+                                        msg->powState = POW_NONE;
+                                    }
+                                }
+                            }
+
+                            // waits here for the message thread if it's too far behind
+                            if (BRQueuePush(ctx->msgQueue, msg)) msg = NULL;
+                        }
+                        else if (! _BRPeerAcceptMessage(peer, msg->payload, msgLen, type)) error = EPROTO;
                     }
+                    
+                    if (msg) _BRPeerMessageRelease(msg);
                 }
             }
         }
         
-        free(payload);
+        if (pipelined) { // stop the message thread before any disconnect callbacks, and drop unprocessed messages
+            BRQueueClose(ctx->msgQueue);
+            pthread_join(ctx->msgThread, NULL);
+            while ((msg = BRQueueTryPop(ctx->msgQueue))) _BRPeerMessageRelease(msg);
+        }
+        
+        if (ctx->msgError) error = ctx->msgError;
     }
     
     socket = ctx->socket;
@@ -1023,12 +1292,12 @@ static void *_peerThreadRoutine(void *arg)
     if (socket >= 0) close(socket);
     peer_log(peer, "disconnected");
     
-    while (array_count(ctx->pongCallback) > 0) {
-        void (*pongCallback)(void *, int) = ctx->pongCallback[0];
-        void *pongInfo = ctx->pongInfo[0];
+    while (deque_count(ctx->pongCallback) > 0) {
+        void (*pongCallback)(void *, int) = deque_item(ctx->pongCallback, 0);
+        void *pongInfo = deque_item(ctx->pongInfo, 0);
         
-        array_rm(ctx->pongCallback, 0);
-        array_rm(ctx->pongInfo, 0);
+        deque_rm_first(ctx->pongCallback);
+        deque_rm_first(ctx->pongInfo);
         if (pongCallback) pongCallback(pongInfo, 0);
     }
 
@@ -1055,13 +1324,15 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
     array_new(ctx->currentBlockTxHashes, 10);
     array_new(ctx->knownTxHashes, 10);
     ctx->knownTxHashSet = BRSetNew(BRTransactionHash, BRTransactionEq, 10);
-    array_new(ctx->pongInfo, 10);
-    array_new(ctx->pongCallback, 10);
+    deque_new(ctx->pongInfo, 10);
+    deque_new(ctx->pongCallback, 10);
     ctx->pingTime = DBL_MAX;
     ctx->mempoolTime = DBL_MAX;
     ctx->disconnectTime = DBL_MAX;
     ctx->socket = -1;
     ctx->threadCleanup = _dummyThreadCleanup;
+    ctx->msgThreadCleanup = _dummyThreadCleanup;
+    ctx->msgQueue = BRQueueNew(MSG_QUEUE_LENGTH);
     return &ctx->peer;
 }
 
@@ -1075,6 +1346,7 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
 // void relayedBlock(void *, BRMerkleBlock *) - called when a "merkleblock" or "headers" message is received from peer
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
+//     the peer releases the returned tx with BRTransactionFree() once it has been sent
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
 // void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
 void BRPeerSetCallbacks(BRPeer *peer, void *info,
@@ -1121,6 +1393,31 @@ void BRPeerSetCurrentBlockHeight(BRPeer *peer, uint32_t currentBlockHeight)
     ((BRPeerContext *)peer)->currentBlockHeight = currentBlockHeight;
 }
 
+// requests full blocks instead of merkleblocks, and only relays the tx for which txMatches() returns true, so no bloom
+// filter is needed - this uses far more bandwidth, and is meant for a trusted node on a fast link, like a local node
+// must be set before calling BRPeerConnect()
+void BRPeerSetFullBlocks(BRPeer *peer, int (*txMatches)(void *info, const BRTransaction *tx))
+{
+    ((BRPeerContext *)peer)->txMatches = txMatches;
+}
+
+// parse blocks and headers using the given shared proof-of-work hash cache, so already verified headers skip scrypt
+// the peer retains cache until it's freed, and it must be set before calling BRPeerConnect()
+void BRPeerSetPowHashCache(BRPeer *peer, BRPowHashCache *cache)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    assert(ctx->powHashCache == NULL);
+    ctx->powHashCache = (cache) ? BRPowHashCacheRetain(cache) : NULL;
+}
+
+// msgThreadCleanup(info) is called before the thread that processes messages alongside the socket thread terminates
+// unlike threadCleanup(), it must not free info, since the socket thread keeps using info until its own cleanup
+void BRPeerSetMessageThreadCleanup(BRPeer *peer, void (*msgThreadCleanup)(void *info))
+{
+    ((BRPeerContext *)peer)->msgThreadCleanup = (msgThreadCleanup) ? msgThreadCleanup : _dummyThreadCleanup;
+}
+
 // current connection status
 BRPeerStatus BRPeerConnectStatus(BRPeer *peer)
 {
@@ -1234,6 +1531,13 @@ double BRPeerPingTime(BRPeer *peer)
     return ((BRPeerContext *)peer)->pingTime;
 }
 
+// writes the statistics of the queue between the socket thread and the message processing thread to stats
+// fullWaits counts how often reading from the network stalled on processing, emptyWaits how often processing sat idle
+void BRPeerGetQueueStats(BRPeer *peer, BRQueueStats *stats)
+{
+    BRQueueGetStats(((BRPeerContext *)peer)->msgQueue, stats);
+}
+
 // minimum tx fee rate peer will accept
 uint64_t BRPeerFeePerKb(BRPeer *peer)
 {
@@ -1471,7 +1775,7 @@ void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, c
         }
         
         for (i = 0; i < blockCount; i++) {
-            UInt32SetLE(&msg[off], inv_filtered_block);
+            UInt32SetLE(&msg[off], (((BRPeerContext *)peer)->txMatches) ? inv_block : inv_filtered_block);
             off += sizeof(uint32_t);
             UInt256Set(&msg[off], blockHashes[i]);
             off += sizeof(UInt256);
@@ -1496,12 +1800,33 @@ void BRPeerSendPing(BRPeer *peer, void *info, void (*pongCallback)(void *info, i
     
     gettimeofday(&tv, NULL);
     ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
-    array_add(ctx->pongInfo, info);
-    array_add(ctx->pongCallback, pongCallback);
+    deque_add(ctx->pongInfo, info);
+    deque_add(ctx->pongCallback, pongCallback);
     UInt64SetLE(msg, ctx->nonce);
     BRPeerSendMessage(peer, msg, sizeof(msg), MSG_PING);
 }
 
+// same as BRPeerSendMempool() and BRPeerSendPing(), but instead of calling a callback, post a BRCompletionMempool or
+// BRCompletionPing completion with info to queue, returns the handle of the completion
+uint64_t BRPeerSendMempoolAsync(BRPeer *peer, const UInt256 knownTxHashes[], size_t knownTxCount,
+                                BRCompletionQueue *queue, void *info)
+{
+    uint64_t handle;
+    void *pending = BRCompletionPendingNew(queue, BRCompletionMempool, info, &handle);
+
+    BRPeerSendMempool(peer, knownTxHashes, knownTxCount, pending, BRCompletionPendingPost);
+    return handle;
+}
+
+uint64_t BRPeerSendPingAsync(BRPeer *peer, BRCompletionQueue *queue, void *info)
+{
+    uint64_t handle;
+    void *pending = BRCompletionPendingNew(queue, BRCompletionPing, info, &handle);
+
+    BRPeerSendPing(peer, pending, BRCompletionPendingPost);
+    return handle;
+}
+
 // useful to get additional tx after a bloom filter update
 void BRPeerRerequestBlocks(BRPeer *peer, UInt256 fromBlock)
 {
@@ -1526,8 +1851,10 @@ void BRPeerFree(BRPeer *peer)
     if (ctx->knownBlockHashes) array_free(ctx->knownBlockHashes);
     if (ctx->knownTxHashes) array_free(ctx->knownTxHashes);
     if (ctx->knownTxHashSet) BRSetFree(ctx->knownTxHashSet);
-    if (ctx->pongInfo) array_free(ctx->pongInfo);
-    if (ctx->pongCallback) array_free(ctx->pongCallback);
+    if (ctx->pongInfo) deque_free(ctx->pongInfo);
+    if (ctx->pongCallback) deque_free(ctx->pongCallback);
+    if (ctx->powHashCache) BRPowHashCacheRelease(ctx->powHashCache);
+    if (ctx->msgQueue) BRQueueFree(ctx->msgQueue);
     free(ctx);
 }
 
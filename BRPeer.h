@@ -27,6 +27,9 @@
 
 #include "BRTransaction.h"
 #include "BRMerkleBlock.h"
+#include "BRPowHashCache.h"
+#include "BRQueue.h"
+#include "BRCompletionQueue.h"
 #include "BRAddress.h"
 #include "BRInt.h"
 #include <stddef.h>
@@ -120,6 +123,7 @@ BRPeer *BRPeerNew(uint32_t magicNumber);
 // void relayedBlock(void *, BRMerkleBlock *) - called when a "merkleblock" or "headers" message is received from peer
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
+//     the peer releases the returned tx with BRTransactionFree() once it has been sent
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
 // void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
 void BRPeerSetCallbacks(BRPeer *peer, void *info,
@@ -143,6 +147,19 @@ void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime);
 // call this when local best block height changes (helps detect tarpit nodes)
 void BRPeerSetCurrentBlockHeight(BRPeer *peer, uint32_t currentBlockHeight);
 
+// requests full blocks instead of merkleblocks, and only relays the tx for which txMatches() returns true, so no bloom
+// filter is needed - this uses far more bandwidth, and is meant for a trusted node on a fast link, like a local node
+// must be set before calling BRPeerConnect()
+void BRPeerSetFullBlocks(BRPeer *peer, int (*txMatches)(void *info, const BRTransaction *tx));
+
+// parse blocks and headers using the given shared proof-of-work hash cache, so already verified headers skip scrypt
+// the peer retains cache until it's freed, and it must be set before calling BRPeerConnect()
+void BRPeerSetPowHashCache(BRPeer *peer, BRPowHashCache *cache);
+
+// msgThreadCleanup(info) is called before the thread that processes messages alongside the socket thread terminates
+// unlike threadCleanup(), it must not free info, since the socket thread keeps using info until its own cleanup
+void BRPeerSetMessageThreadCleanup(BRPeer *peer, void (*msgThreadCleanup)(void *info));
+
 // current connection status
 BRPeerStatus BRPeerConnectStatus(BRPeer *peer);
 
@@ -176,6 +193,10 @@ uint64_t BRPeerFeePerKb(BRPeer *peer);
 // average ping time for connected peer
 double BRPeerPingTime(BRPeer *peer);
 
+// writes the statistics of the queue between the socket thread and the message processing thread to stats
+// fullWaits counts how often reading from the network stalled on processing, emptyWaits how often processing sat idle
+void BRPeerGetQueueStats(BRPeer *peer, BRQueueStats *stats);
+
 // sends a bitcoin protocol message to peer
 void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type);
 void BRPeerSendFilterload(BRPeer *peer, const uint8_t *filter, size_t filterLen);
@@ -189,6 +210,12 @@ void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, c
 void BRPeerSendGetaddr(BRPeer *peer);
 void BRPeerSendPing(BRPeer *peer, void *info, void (*pongCallback)(void *info, int success));
 
+// same as BRPeerSendMempool() and BRPeerSendPing(), but instead of calling a callback, post a BRCompletionMempool or
+// BRCompletionPing completion with info to queue, returns the handle of the completion
+uint64_t BRPeerSendMempoolAsync(BRPeer *peer, const UInt256 knownTxHashes[], size_t knownTxCount,
+                                BRCompletionQueue *queue, void *info);
+uint64_t BRPeerSendPingAsync(BRPeer *peer, BRCompletionQueue *queue, void *info);
+
 // useful to get additional tx after a bloom filter update
 void BRPeerRerequestBlocks(BRPeer *peer, UInt256 fromBlock);
 
@@ -43,6 +43,10 @@
 #define MAX_CONNECT_FAILURES  20 // notify user of network problems after this many connect failures in a row
 #define PEER_FLAG_SYNCED      0x01
 #define PEER_FLAG_NEEDSUPDATE 0x02
+#define SYNC_SAVE_INTERVAL    500 // blocks between saves of chain sync progress, the most a restart has to re-download
+#define FILTER_TIP_BLOCKS     144 // blocks a bloom filter is expected to serve after syncing, for choosing its fp rate
+#define FILTER_MIN_LOOKAHEAD  100 // minimum spare addresses per wallet chain to add to a bloom filter
+#define FILTER_MAX_LOOKAHEAD  2000 // maximum spare addresses per wallet chain, to keep the filter a reasonable size
 
 #define genesis_block_hash(params) UInt256Reverse((params)->checkpoints[0].hash)
 
@@ -59,6 +63,7 @@ typedef struct {
 } BRPeerCallbackInfo;
 
 typedef struct {
+    UInt256 txHash; // must be first, so entries can be indexed and looked up by txHash like transactions
     BRTransaction *tx;
     void *info;
     void (*callback)(void *info, int error);
@@ -123,7 +128,7 @@ static int _BRTxPeerListRemovePeer(BRTxPeerList *list, UInt256 txHash, const BRP
 
         for (size_t j = array_count(list[i - 1].peers); j > 0; j--) {
             if (! BRPeerEq(&list[i - 1].peers[j - 1], peer)) continue;
-            array_rm(list[i - 1].peers, j - 1);
+            array_rm_swap(list[i - 1].peers, j - 1);
             return 1;
         }
 
@@ -168,18 +173,26 @@ inline static int _BRBlockHeightEq(const void *block, const void *otherBlock)
 
 struct BRPeerManagerStruct {
     const BRChainParams *params;
-    BRWallet *wallet;
-    int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, maxConnectCount;
+    BRWallet *wallet, **wallets; // wallets[0] is wallet, followed by any wallets added with BRPeerManagerAddWallet()
+    int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, maxConnectCount, fullBlocks;
     BRPeer *peers, *downloadPeer, fixedPeer, **connectedPeers;
     char downloadPeerName[INET6_ADDRSTRLEN + 6];
     uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
     BRBloomFilter *bloomFilter;
-    double fpRate, averageTxPerBlock;
+    double fpRate, fpTarget, fpMinRate, fpMaxRate, averageTxPerBlock, averageTxSize;
+    double addrsPerBlock[2]; // recent rate wallet addresses are used on the external and internal chains
+    size_t filterUsedAddrs[2]; // used wallet addresses on each chain when the bloom filter was last loaded
+    // TODO: XXX share one header chain between managers, with reorgs fanned out to each of them, headers are still
+    // stored and linked per manager, only their proof-of-work hashes are shared through powHashCache
     BRSet *blocks, *orphans, *checkpoints;
     BRMerkleBlock *lastBlock, *lastOrphan;
+    uint32_t savedHeight; // height of the last main chain block passed to saveBlocks, or loaded from saved blocks
+    BRPowHashCache *powHashCache;
     BRTxPeerList *txRelays, *txRequests;
     BRPublishedTx *publishedTx;
     UInt256 *publishedTxHashes;
+    BRSet *publishedTxIndex; // publishedTx entries by txHash
+    size_t publishedCallbackCount; // publishedTx entries with a pending callback
     void *info;
     void (*syncStarted)(void *info);
     void (*syncStopped)(void *info, int error);
@@ -188,9 +201,28 @@ struct BRPeerManagerStruct {
     void (*savePeers)(void *info, int replace, const BRPeer peers[], size_t peersCount);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
+    BRCompletionQueue *completionQueue; // also receives sync and tx status events when set
     pthread_mutex_t lock;
 };
 
+// true if blocks are downloaded in full from the fixed peer and matched locally, instead of using a bloom filter
+inline static int _BRPeerManagerIsFullBlockSync(const BRPeerManager *manager)
+{
+    return (manager->fullBlocks && ! UInt128IsZero(manager->fixedPeer.address));
+}
+
+// calls the syncStarted, syncStopped or txStatusUpdate callback for type, and posts the event to completionQueue
+static void _BRPeerManagerNotify(BRPeerManager *manager, BRCompletionType type, int error)
+{
+    if (type == BRCompletionSyncStarted && manager->syncStarted) manager->syncStarted(manager->info);
+    if (type == BRCompletionSyncStopped && manager->syncStopped) manager->syncStopped(manager->info, error);
+    if (type == BRCompletionTxStatusUpdate && manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+
+    if (manager->completionQueue) {
+        BRCompletionQueuePost(manager->completionQueue, (BRCompletion) { 0, type, error, manager->info });
+    }
+}
+
 static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
 {
     for (size_t i = array_count(manager->peers); i > 0; i--) {
@@ -211,31 +243,83 @@ static void _BRPeerManagerSyncStopped(BRPeerManager *manager)
 
     if (manager->downloadPeer) {
         // don't cancel timeout if there's a pending tx publish callback
-        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-            if (manager->publishedTx[i - 1].callback != NULL) return;
-        }
-
+        if (manager->publishedCallbackCount > 0) return;
         BRPeerScheduleDisconnect(manager->downloadPeer, -1); // cancel sync timeout
     }
 }
 
+// returns the publish list entry for txHash, or NULL if txHash isn't being published
+static BRPublishedTx *_BRPeerManagerPublishedTx(BRPeerManager *manager, UInt256 txHash)
+{
+    return BRSetGet(manager->publishedTxIndex, &txHash);
+}
+
+// clears the pending callback for a publish list entry, returning it in info and callback
+static void _BRPeerManagerTakePublishCallback(BRPeerManager *manager, BRPublishedTx *ptx, void **info,
+                                              void (**callback)(void *, int))
+{
+    *info = ptx->info;
+    *callback = ptx->callback;
+    if (ptx->callback) manager->publishedCallbackCount--;
+    ptx->info = NULL;
+    ptx->callback = NULL;
+}
+
+// removes the publish list entry at index, releasing its tx reference, the last entry is moved into its place
+static void _BRPeerManagerRemovePublishedTx(BRPeerManager *manager, size_t index)
+{
+    BRPublishedTx *ptx = &manager->publishedTx[index];
+
+    BRSetRemove(manager->publishedTxIndex, ptx);
+    if (ptx->callback) manager->publishedCallbackCount--;
+    BRTransactionFree(ptx->tx);
+    array_rm_swap(manager->publishedTx, index);
+    array_rm_swap(manager->publishedTxHashes, index);
+    if (index < array_count(manager->publishedTx)) BRSetAdd(manager->publishedTxIndex, &manager->publishedTx[index]);
+}
+
 // adds transaction to list of tx to be published, along with any unconfirmed inputs
-static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransaction *tx, void *info,
-                                             void (*callback)(void *, int))
+// returns 0 if callback is left pending in the list, or the error it must be called with when it isn't: EINVAL if tx
+// is already confirmed, or EALREADY if tx is already in the list with a pending callback
+static int _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransaction *tx, void *info,
+                                            void (*callback)(void *, int))
 {
+    BRPublishedTx *ptx;
+
     if (tx && tx->blockHeight == TX_UNCONFIRMED) {
-        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-            if (BRTransactionEq(manager->publishedTx[i - 1].tx, tx)) return;
+        ptx = _BRPeerManagerPublishedTx(manager, tx->txHash);
+
+        if (ptx && callback && ptx->callback) return EALREADY;
+
+        if (ptx && callback) { // already added as an unconfirmed input of an earlier tx
+            ptx->info = info;
+            ptx->callback = callback;
+            manager->publishedCallbackCount++;
         }
 
-        array_add(manager->publishedTx, ((BRPublishedTx) { tx, info, callback }));
+        if (ptx) return 0;
+
+        ptx = manager->publishedTx;
+        array_add(manager->publishedTx, ((BRPublishedTx) { tx->txHash, BRTransactionRetain(tx), info, callback }));
         array_add(manager->publishedTxHashes, tx->txHash);
+        if (callback) manager->publishedCallbackCount++;
+
+        if (manager->publishedTx != ptx) { // entries moved when the list grew, so re-index them all
+            BRSetClear(manager->publishedTxIndex);
+
+            for (size_t i = 0; i < array_count(manager->publishedTx); i++) {
+                BRSetAdd(manager->publishedTxIndex, &manager->publishedTx[i]);
+            }
+        }
+        else BRSetAdd(manager->publishedTxIndex, &manager->publishedTx[array_count(manager->publishedTx) - 1]);
 
         for (size_t i = 0; i < tx->inCount; i++) {
             _BRPeerManagerAddTxToPublishList(manager, BRWalletTransactionForHash(manager->wallet, tx->inputs[i].txHash),
                                              NULL, NULL);
         }
     }
+
+    return (tx && tx->blockHeight != TX_UNCONFIRMED) ? EINVAL : 0;
 }
 
 static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locators[], size_t locatorsCount)
@@ -263,37 +347,22 @@ static void _setApplyFreeBlock(void *info, void *block)
     BRMerkleBlockFree(block);
 }
 
-static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
+// adds wallet addresses, utxos, and txos spent since blockHeight to filter
+static void _BRPeerManagerAddWalletToFilter(BRWallet *wallet, BRBloomFilter *filter, uint32_t blockHeight)
 {
-    // every time a new wallet address is added, the bloom filter has to be rebuilt, and each address is only used
-    // for one transaction, so here we generate some spare addresses to avoid rebuilding the filter each time a
-    // wallet transaction is encountered during the chain sync
-    BRWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL + 100, 0);
-    BRWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL + 100, 1);
-
-    BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
-    BRSetClear(manager->orphans); // clear out orphans that may have been received on an old filter
-    manager->lastOrphan = NULL;
-    manager->filterUpdateHeight = manager->lastBlock->height;
-    manager->fpRate = BLOOM_REDUCED_FALSEPOSITIVE_RATE;
-
-    size_t addrsCount = BRWalletAllAddrs(manager->wallet, NULL, 0);
+    size_t addrsCount = BRWalletAllAddrs(wallet, NULL, 0);
     BRAddress *addrs = malloc(addrsCount*sizeof(*addrs));
-    size_t utxosCount = BRWalletUTXOs(manager->wallet, NULL, 0);
+    size_t utxosCount = BRWalletUTXOs(wallet, NULL, 0);
     BRUTXO *utxos = malloc(utxosCount*sizeof(*utxos));
-    uint32_t blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0;
-    size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, blockHeight);
+    size_t txCount = BRWalletTxUnconfirmedBefore(wallet, NULL, 0, blockHeight);
     BRTransaction **transactions = malloc(txCount*sizeof(*transactions));
-    BRBloomFilter *filter;
 
     assert(addrs != NULL);
     assert(utxos != NULL);
     assert(transactions != NULL);
-    addrsCount = BRWalletAllAddrs(manager->wallet, addrs, addrsCount);
-    utxosCount = BRWalletUTXOs(manager->wallet, utxos, utxosCount);
-    txCount = BRWalletTxUnconfirmedBefore(manager->wallet, transactions, txCount, blockHeight);
-    filter = BRBloomFilterNew(manager->fpRate, addrsCount + utxosCount + txCount + 100, (uint32_t)BRPeerHash(peer),
-                              BLOOM_UPDATE_ALL); // BUG: XXX txCount not the same as number of spent wallet outputs
+    addrsCount = BRWalletAllAddrs(wallet, addrs, addrsCount);
+    utxosCount = BRWalletUTXOs(wallet, utxos, utxosCount);
+    txCount = BRWalletTxUnconfirmedBefore(wallet, transactions, txCount, blockHeight);
 
     for (size_t i = 0; i < addrsCount; i++) { // add addresses to watch for tx receiveing money to the wallet
         UInt160 hash = UINT160_ZERO;
@@ -320,11 +389,10 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
     for (size_t i = 0; i < txCount; i++) { // also add TXOs spent within the last 100 blocks
         for (size_t j = 0; j < transactions[i]->inCount; j++) {
             BRTxInput *input = &transactions[i]->inputs[j];
-            BRTransaction *tx = BRWalletTransactionForHash(manager->wallet, input->txHash);
+            BRTransaction *tx = BRWalletTransactionForHash(wallet, input->txHash);
             uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
 
-            if (tx && input->index < tx->outCount &&
-                BRWalletContainsAddress(manager->wallet, tx->outputs[input->index].address)) {
+            if (tx && input->index < tx->outCount && BRWalletContainsAddress(wallet, tx->outputs[input->index].address)) {
                 UInt256Set(o, input->txHash);
                 UInt32SetLE(&o[sizeof(UInt256)], input->index);
                 if (! BRBloomFilterContainsData(filter, o, sizeof(o))) BRBloomFilterInsertData(filter, o,sizeof(o));
@@ -333,6 +401,78 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
     }
 
     free(transactions);
+}
+
+// sets lookahead to the spare addresses each wallet chain needs to last blockCount more blocks, after averaging the
+// rate addresses were used between the last filter load and blockHeight with the previous estimate
+static void _BRPeerManagerLookahead(BRPeerManager *manager, uint32_t blockHeight, uint32_t blockCount,
+                                    size_t lookahead[2])
+{
+    size_t i, usedAddrs[2] = { 0, 0 };
+
+    for (i = 0; i < array_count(manager->wallets); i++) {
+        usedAddrs[0] += BRWalletUsedAddrCount(manager->wallets[i], 0);
+        usedAddrs[1] += BRWalletUsedAddrCount(manager->wallets[i], 1);
+    }
+
+    for (i = 0; i < 2; i++) {
+        // usedAddrs can go backwards if a wallet tx is removed, in which case there's no new rate to average in
+        if (blockHeight > manager->filterUpdateHeight && usedAddrs[i] >= manager->filterUsedAddrs[i]) {
+            manager->addrsPerBlock[i] = manager->addrsPerBlock[i]/2 + (double)(usedAddrs[i] -
+                manager->filterUsedAddrs[i])/(blockHeight - manager->filterUpdateHeight)/2;
+        }
+
+        // enough spare addresses to last the rest of the sync at that rate, so busy wallets don't rebuild constantly
+        lookahead[i] = manager->addrsPerBlock[i]*(blockCount + FILTER_TIP_BLOCKS);
+        if (lookahead[i] < FILTER_MIN_LOOKAHEAD) lookahead[i] = FILTER_MIN_LOOKAHEAD;
+        if (lookahead[i] > FILTER_MAX_LOOKAHEAD) lookahead[i] = FILTER_MAX_LOOKAHEAD;
+        manager->filterUsedAddrs[i] = usedAddrs[i];
+    }
+}
+
+static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
+{
+    uint32_t blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0, blockCount;
+    size_t i, elemCount = 100, lookahead[2];
+    BRBloomFilter *filter;
+
+    if (_BRPeerManagerIsFullBlockSync(manager)) return; // tx are matched locally, there's no filter to load
+
+    blockCount = (manager->estimatedHeight > manager->lastBlock->height) ?
+                 manager->estimatedHeight - manager->lastBlock->height : 0;
+    _BRPeerManagerLookahead(manager, manager->lastBlock->height, blockCount, lookahead);
+
+    for (i = 0; i < array_count(manager->wallets); i++) {
+        BRWallet *wallet = manager->wallets[i];
+
+        // every time a new wallet address is added, the bloom filter has to be rebuilt, and each address is only used
+        // for one transaction, so here we generate some spare addresses to avoid rebuilding the filter each time a
+        // wallet transaction is encountered during the chain sync
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL + (uint32_t)lookahead[0], 0);
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL + (uint32_t)lookahead[1], 1);
+
+        // BUG: XXX tx count not the same as number of spent wallet outputs
+        elemCount += BRWalletAllAddrs(wallet, NULL, 0) + BRWalletUTXOs(wallet, NULL, 0) +
+                     BRWalletTxUnconfirmedBefore(wallet, NULL, 0, blockHeight);
+    }
+
+    BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
+    BRSetClear(manager->orphans); // clear out orphans that may have been received on an old filter
+    manager->lastOrphan = NULL;
+    manager->filterUpdateHeight = manager->lastBlock->height;
+
+    // pick the rate that downloads the fewest bytes over the rest of the sync, counting both false positive tx and the
+    // larger filter sent to each peer for a lower rate, within the configured privacy bounds
+    manager->fpTarget = BRBloomFilterOptimalRate(elemCount, manager->maxConnectCount, (blockCount + FILTER_TIP_BLOCKS)*
+                                                 manager->averageTxPerBlock*manager->averageTxSize,
+                                                 manager->fpMinRate, manager->fpMaxRate);
+    manager->fpRate = manager->fpTarget;
+    filter = BRBloomFilterNew(manager->fpRate, elemCount, (uint32_t)BRPeerHash(peer), BLOOM_UPDATE_ALL);
+
+    for (i = 0; i < array_count(manager->wallets); i++) {
+        _BRPeerManagerAddWalletToFilter(manager->wallets[i], filter, blockHeight);
+    }
+
     if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
     manager->bloomFilter = filter;
     // TODO: XXX if already synced, recursively add inputs of unconfirmed receives
@@ -451,14 +591,9 @@ static void _BRPeerManagerUpdateTx(BRPeerManager *manager, const UInt256 txHashe
 {
     if (blockHeight != TX_UNCONFIRMED) { // remove confirmed tx from publish list and relay counts
         for (size_t i = 0; i < txCount; i++) {
-            for (size_t j = array_count(manager->publishedTx); j > 0; j--) {
-                BRTransaction *tx = manager->publishedTx[j - 1].tx;
+            BRPublishedTx *ptx = _BRPeerManagerPublishedTx(manager, txHashes[i]);
 
-                if (! UInt256Eq(txHashes[i], tx->txHash)) continue;
-                array_rm(manager->publishedTx, j - 1);
-                array_rm(manager->publishedTxHashes, j - 1);
-                if (! BRWalletTransactionForHash(manager->wallet, tx->txHash)) BRTransactionFree(tx);
-            }
+            if (ptx) _BRPeerManagerRemovePublishedTx(manager, ptx - manager->publishedTx);
 
             for (size_t j = array_count(manager->txRelays); j > 0; j--) {
                 if (! UInt256Eq(txHashes[i], manager->txRelays[j - 1].txHash)) continue;
@@ -468,7 +603,26 @@ static void _BRPeerManagerUpdateTx(BRPeerManager *manager, const UInt256 txHashe
         }
     }
 
-    BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, blockHeight, timestamp);
+    for (size_t i = 0; i < array_count(manager->wallets); i++) {
+        BRWalletUpdateTransactions(manager->wallets[i], txHashes, txCount, blockHeight, timestamp);
+    }
+}
+
+// true if the bloom filter still matches at least the next <gap limit> unused addresses of wallet
+static int _BRPeerManagerFilterCoversWallet(BRPeerManager *manager, BRWallet *wallet)
+{
+    BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
+    UInt160 hash;
+
+    BRWalletUnusedAddrs(wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL, 0);
+    BRWalletUnusedAddrs(wallet, addrs + SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_GAP_LIMIT_INTERNAL, 1);
+
+    for (size_t i = 0; i < SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL; i++) {
+        if (BRAddressHash160(&hash, addrs[i].s) &&
+            ! BRBloomFilterContainsData(manager->bloomFilter, hash.u8, sizeof(hash))) return 0;
+    }
+
+    return 1;
 }
 
 // unconfirmed transactions that aren't in the mempools of any of connected peers have likely dropped off the network
@@ -494,6 +648,7 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
     // don't remove transactions until we're connected to maxConnectCount peers, and all peers have finished
     // relaying their mempools
     if (count >= manager->maxConnectCount) {
+        BRPublishedTx *ptx;
         UInt256 hash;
         size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, TX_UNCONFIRMED);
         BRTransaction *tx[(txCount*sizeof(BRTransaction *) <= 0x1000) ? txCount : 0x1000/sizeof(BRTransaction *)];
@@ -502,13 +657,9 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
 
         for (size_t i = txCount; i > 0; i--) {
             hash = tx[i - 1]->txHash;
-            isPublishing = 0;
+            ptx = _BRPeerManagerPublishedTx(manager, hash);
+            isPublishing = (ptx && ptx->callback != NULL);
 
-            for (size_t j = array_count(manager->publishedTx); ! isPublishing && j > 0; j--) {
-                if (BRTransactionEq(manager->publishedTx[j - 1].tx, tx[i - 1]) &&
-                    manager->publishedTx[j - 1].callback != NULL) isPublishing = 1;
-            }
-            
             if (! isPublishing && _BRTxPeerListCount(manager->txRelays, hash) == 0 &&
                 _BRTxPeerListCount(manager->txRequests, hash) == 0) {
                 peer_log(peer, "removing tx unconfirmed at: %d, txHash: %s", manager->lastBlock->height, u256hex(hash));
@@ -558,12 +709,8 @@ static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *pee
 
 static void _BRPeerManagerPublishPendingTx(BRPeerManager *manager, BRPeer *peer)
 {
-    for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-        if (manager->publishedTx[i - 1].callback == NULL) continue;
-        BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule publish timeout
-        break;
-    }
-
+    // schedule publish timeout
+    if (manager->publishedCallbackCount > 0) BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT);
     BRPeerSendInv(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes));
 }
 
@@ -587,8 +734,8 @@ static void _mempoolDone(void *info, int success)
         _BRPeerManagerRequestUnrelayedTx(manager, peer);
         BRPeerSendGetaddr(peer); // request a list of other bitcoin peers
         pthread_mutex_unlock(&manager->lock);
-        if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
-        if (syncFinished && manager->syncStopped) manager->syncStopped(manager->info, 0);
+        _BRPeerManagerNotify(manager, BRCompletionTxStatusUpdate, 0);
+        if (syncFinished) _BRPeerManagerNotify(manager, BRCompletionSyncStopped, 0);
     }
     else peer_log(peer, "mempool request failed");
 }
@@ -612,7 +759,7 @@ static void _loadBloomFilterDone(void *info, int success)
             peer_log(peer, "sync succeeded");
             _BRPeerManagerSyncStopped(manager);
             pthread_mutex_unlock(&manager->lock);
-            if (manager->syncStopped) manager->syncStopped(manager->info, 0);
+            _BRPeerManagerNotify(manager, BRCompletionSyncStopped, 0);
         }
         else pthread_mutex_unlock(&manager->lock);
     }
@@ -631,7 +778,7 @@ static void _BRPeerManagerLoadMempools(BRPeerManager *manager)
         info->peer = peer;
         info->manager = manager;
 
-        if (peer != manager->downloadPeer || manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*5.0) {
+        if (peer != manager->downloadPeer || manager->fpRate > manager->fpTarget*5.0) {
             _BRPeerManagerLoadBloomFilter(manager, peer);
             _BRPeerManagerPublishPendingTx(manager, peer);
             BRPeerSendPing(peer, info, _loadBloomFilterDone); // load mempool after updating bloomfilter
@@ -670,6 +817,8 @@ static UInt128 *_addressLookup(const char *hostname)
     return addrList;
 }
 
+// each dns seed is looked up on its own thread rather than the thread pool, since a slow resolver can block for a
+// long time, and would hold up the pool's proof-of-work hashing
 static void *_findPeersThreadRoutine(void *arg)
 {
     BRPeerManager *manager = ((BRFindPeersInfo *)arg)->manager;
@@ -720,6 +869,7 @@ static void _BRPeerManagerFindPeers(BRPeerManager *manager)
             info->services = services;
             if (pthread_attr_init(&attr) == 0 && pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
                 pthread_create(&thread, &attr, _findPeersThreadRoutine, info) == 0) manager->dnsThreadCount++;
+            else free(info);
         }
 
         for (addr = addrList = _addressLookup(manager->params->dnsSeeds[0]); addr && ! UInt128IsZero(*addr); addr++) {
@@ -763,7 +913,8 @@ static void _peerConnected(void *info)
         peer_log(peer, "node isn't synced");
         BRPeerDisconnect(peer);
     }
-    else if (BRPeerVersion(peer) >= 70011 && (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
+    else if (BRPeerVersion(peer) >= 70011 && (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM &&
+             ! _BRPeerManagerIsFullBlockSync(manager)) {
         peer_log(peer, "node doesn't support SPV mode");
         BRPeerDisconnect(peer);
     }
@@ -860,7 +1011,7 @@ static void _peerDisconnected(void *info, int error)
         peerList = &manager->txRelays[i - 1];
 
         for (size_t j = array_count(peerList->peers); j > 0; j--) {
-            if (BRPeerEq(&peerList->peers[j - 1], peer)) array_rm(peerList->peers, j - 1);
+            if (BRPeerEq(&peerList->peers[j - 1], peer)) array_rm_swap(peerList->peers, j - 1);
         }
     }
 
@@ -888,9 +1039,7 @@ static void _peerDisconnected(void *info, int error)
             txInfo[txCount] = manager->publishedTx[i - 1].info;
             txCallback[txCount] = manager->publishedTx[i - 1].callback;
             txCount++;
-            BRTransactionFree(manager->publishedTx[i - 1].tx);
-            array_rm(manager->publishedTxHashes, i - 1);
-            array_rm(manager->publishedTx, i - 1);
+            _BRPeerManagerRemovePublishedTx(manager, i - 1);
         }
     }
 
@@ -908,9 +1057,9 @@ static void _peerDisconnected(void *info, int error)
     }
 
     if (willSave && manager->savePeers) manager->savePeers(manager->info, 1, NULL, 0);
-    if (willSave && manager->syncStopped) manager->syncStopped(manager->info, error);
+    if (willSave) _BRPeerManagerNotify(manager, BRCompletionSyncStopped, error);
     if (willReconnect) BRPeerManagerConnect(manager); // try connecting to another peer
-    if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    _BRPeerManagerNotify(manager, BRCompletionTxStatusUpdate, 0);
 }
 
 static void _peerRelayedPeers(void *info, const BRPeer peers[], size_t peersCount)
@@ -943,42 +1092,83 @@ static void _peerRelayedPeers(void *info, const BRPeer peers[], size_t peersCoun
         manager->savePeers) manager->savePeers(manager->info, 1, save, peersCount);
 }
 
+// registers tx with wallet, which retains its own reference, so the caller's reference is left as it was
+// returns true if wallet has a tx with the same hash, even if it was registered earlier
+static int _BRPeerManagerRegisterTx(BRWallet *wallet, BRTransaction *tx)
+{
+    if (BRWalletContainsTxHash(wallet, tx->txHash)) return 1; // already registered
+    if (BRWalletRegisterTransaction(wallet, BRTransactionRetain(tx))) return 1;
+    BRTransactionFree(tx);
+    return 0;
+}
+
+static int _peerTxMatches(void *info, const BRTransaction *tx)
+{
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    int r = 0;
+
+    pthread_mutex_lock(&manager->lock);
+
+    for (size_t i = 0; ! r && i < array_count(manager->wallets); i++) {
+        if (BRWalletContainsTxHash(manager->wallets[i], tx->txHash) ||
+            BRWalletContainsTransaction(manager->wallets[i], tx)) r = 1;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    return r;
+}
+
 static void _peerRelayedTx(void *info, BRTransaction *tx)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRTransaction *relayedTx = tx; // the peer's reference, released once the wallets have retained what they keep
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
+    BRPublishedTx *ptx;
     int isWalletTx = 0, hasPendingCallbacks = 0;
     size_t relayCount = 0;
 
     pthread_mutex_lock(&manager->lock);
     peer_log(peer, "relayed tx: %s", u256hex(tx->txHash));
-    
-    for (size_t i = array_count(manager->publishedTx); i > 0; i--) { // see if tx is in list of published tx
-        if (UInt256Eq(manager->publishedTxHashes[i - 1], tx->txHash)) {
-            txInfo = manager->publishedTx[i - 1].info;
-            txCallback = manager->publishedTx[i - 1].callback;
-            manager->publishedTx[i - 1].info = NULL;
-            manager->publishedTx[i - 1].callback = NULL;
-            relayCount = _BRTxPeerListAddPeer(&manager->txRelays, tx->txHash, peer);
-        }
-        else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
+    manager->averageTxSize = manager->averageTxSize*0.99 + BRTransactionSize(tx)*0.01; // moving average tx size
+
+    ptx = _BRPeerManagerPublishedTx(manager, tx->txHash); // see if tx is in list of published tx
+
+    if (ptx) {
+        _BRPeerManagerTakePublishCallback(manager, ptx, &txInfo, &txCallback);
+        relayCount = _BRTxPeerListAddPeer(&manager->txRelays, tx->txHash, peer);
     }
 
+    hasPendingCallbacks = (manager->publishedCallbackCount > 0);
+
     // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
     if (! hasPendingCallbacks && (manager->syncStartHeight == 0 || peer != manager->downloadPeer)) {
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
+    // each additional wallet gets its own copy, since wallets update the block height and timestamp of their tx, and
+    // skip a tx that already has the new values, so a shared instance would only be updated by the first wallet
+    for (size_t i = 1; i < array_count(manager->wallets); i++) {
+        BRWallet *wallet = manager->wallets[i];
+        BRTransaction *copy;
+
+        if (BRWalletContainsTxHash(wallet, tx->txHash) || ! BRWalletContainsTransaction(wallet, tx)) continue;
+        copy = BRTransactionCopy(tx);
+        if (! BRWalletRegisterTransaction(wallet, copy)) BRTransactionFree(copy);
+
+        if (manager->bloomFilter && ! _BRPeerManagerFilterCoversWallet(manager, wallet)) {
+            BRBloomFilterFree(manager->bloomFilter);
+            manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new wallet addresses
+            _BRPeerManagerUpdateFilter(manager);
+        }
+    }
+
     if (manager->syncStartHeight == 0 || BRWalletContainsTransaction(manager->wallet, tx)) {
-        isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
+        isWalletTx = _BRPeerManagerRegisterTx(manager->wallet, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
     }
-    else {
-        BRTransactionFree(tx);
-        tx = NULL;
-    }
+    else tx = NULL;
 
     if (tx && isWalletTx) {
         // reschedule sync timeout
@@ -996,23 +1186,12 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
 
         _BRTxPeerListRemovePeer(manager->txRequests, tx->txHash, peer);
 
-        if (manager->bloomFilter != NULL) { // check if bloom filter is already being updated
-            BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
-            UInt160 hash;
-
-            // the transaction likely consumed one or more wallet addresses, so check that at least the next <gap limit>
-            // unused addresses are still matched by the bloom filter
-            BRWalletUnusedAddrs(manager->wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL, 0);
-            BRWalletUnusedAddrs(manager->wallet, addrs + SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_GAP_LIMIT_INTERNAL, 1);
-
-            for (size_t i = 0; i < SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL; i++) {
-                if (! BRAddressHash160(&hash, addrs[i].s) ||
-                    BRBloomFilterContainsData(manager->bloomFilter, hash.u8, sizeof(hash))) continue;
-                if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
-                manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new wallet addresses
-                _BRPeerManagerUpdateFilter(manager);
-                break;
-            }
+        // the transaction likely consumed one or more wallet addresses, so check that at least the next <gap limit>
+        // unused addresses are still matched by the bloom filter (unless the filter is already being updated)
+        if (manager->bloomFilter != NULL && ! _BRPeerManagerFilterCoversWallet(manager, manager->wallet)) {
+            BRBloomFilterFree(manager->bloomFilter);
+            manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new wallet addresses
+            _BRPeerManagerUpdateFilter(manager);
         }
     }
 
@@ -1021,6 +1200,7 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
         _BRPeerManagerUpdateTx(manager, &tx->txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
     }
 
+    BRTransactionFree(relayedTx);
     pthread_mutex_unlock(&manager->lock);
     if (txCallback) txCallback(txInfo, 0);
 }
@@ -1032,6 +1212,7 @@ static void _peerHasTx(void *info, UInt256 txHash)
     BRTransaction *tx;
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
+    BRPublishedTx *ptx;
     int isWalletTx = 0, hasPendingCallbacks = 0;
     size_t relayCount = 0;
 
@@ -1039,25 +1220,23 @@ static void _peerHasTx(void *info, UInt256 txHash)
     tx = BRWalletTransactionForHash(manager->wallet, txHash);
     peer_log(peer, "has tx: %s", u256hex(txHash));
 
-    for (size_t i = array_count(manager->publishedTx); i > 0; i--) { // see if tx is in list of published tx
-        if (UInt256Eq(manager->publishedTxHashes[i - 1], txHash)) {
-            if (! tx) tx = manager->publishedTx[i - 1].tx;
-            txInfo = manager->publishedTx[i - 1].info;
-            txCallback = manager->publishedTx[i - 1].callback;
-            manager->publishedTx[i - 1].info = NULL;
-            manager->publishedTx[i - 1].callback = NULL;
-            relayCount = _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
-        }
-        else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
+    ptx = _BRPeerManagerPublishedTx(manager, txHash); // see if tx is in list of published tx
+
+    if (ptx) {
+        if (! tx) tx = ptx->tx;
+        _BRPeerManagerTakePublishCallback(manager, ptx, &txInfo, &txCallback);
+        relayCount = _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
     }
 
+    hasPendingCallbacks = (manager->publishedCallbackCount > 0);
+
     // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
     if (! hasPendingCallbacks && (manager->syncStartHeight == 0 || peer != manager->downloadPeer)) {
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
     if (tx) {
-        isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
+        isWalletTx = _BRPeerManagerRegisterTx(manager->wallet, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
 
         // reschedule sync timeout
@@ -1112,7 +1291,7 @@ static void _peerRejectedTx(void *info, UInt256 txHash, uint8_t code)
     }
 
     pthread_mutex_unlock(&manager->lock);
-    if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    _BRPeerManagerNotify(manager, BRCompletionTxStatusUpdate, 0);
 }
 
 static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *block, BRMerkleBlock *prev, BRPeer *peer)
@@ -1176,6 +1355,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     UInt256 _txHashes[(sizeof(UInt256)*txCount <= 0x1000) ? txCount : 0],
             *txHashes = (sizeof(UInt256)*txCount <= 0x1000) ? _txHashes : malloc(txCount*sizeof(*txHashes));
     size_t i, j, fpCount = 0, saveCount = 0;
+    int append = 0, replace;
     BRMerkleBlock orphan, *b, *b2, *prev, *next = NULL;
     uint32_t txTime = 0;
 
@@ -1192,7 +1372,11 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     // track the observed bloom filter false positive rate using a low pass filter to smooth out variance
     if (peer == manager->downloadPeer && block->totalTx > 0) {
         for (i = 0; i < txCount; i++) { // wallet tx are not false-positives
-            if (! BRWalletTransactionForHash(manager->wallet, txHashes[i])) fpCount++;
+            for (j = 0; j < array_count(manager->wallets); j++) {
+                if (BRWalletContainsTxHash(manager->wallets[j], txHashes[i])) break;
+            }
+
+            if (j == array_count(manager->wallets)) fpCount++;
         }
 
         // moving average number of tx-per-block
@@ -1203,15 +1387,18 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                           0.01*fpCount/manager->averageTxPerBlock;
 
         // false positive rate sanity check
-        if (BRPeerConnectStatus(peer) == BRPeerStatusConnected &&
-            manager->fpRate > BLOOM_DEFAULT_FALSEPOSITIVE_RATE*10.0) {
+        if (BRPeerConnectStatus(peer) == BRPeerStatusConnected && manager->fpRate > manager->fpMaxRate*10.0) {
             peer_log(peer, "bloom filter false positive rate %f too high after %"PRIu32" blocks, disconnecting...",
                      manager->fpRate, manager->lastBlock->height + 1 - manager->filterUpdateHeight);
             BRPeerDisconnect(peer);
         }
-        else if (manager->lastBlock->height + 500 < BRPeerLastBlock(peer) &&
-                 manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*10.0) {
-            _BRPeerManagerUpdateFilter(manager); // rebuild bloom filter when it starts to degrade
+        else if (manager->lastBlock->height + 500 < BRPeerLastBlock(peer) && manager->bloomFilter &&
+                 manager->fpRate > manager->fpTarget*2.0 &&
+                 (manager->fpRate - manager->fpTarget)*manager->averageTxPerBlock*manager->averageTxSize*
+                 (BRPeerLastBlock(peer) - manager->lastBlock->height) > manager->bloomFilter->length) {
+            // rebuild bloom filter once it degrades enough that the extra false positives for the rest of the sync
+            // would cost more than sending a new filter
+            _BRPeerManagerUpdateFilter(manager);
         }
     }
 
@@ -1220,7 +1407,8 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         BRMerkleBlockFree(block);
         block = NULL;
     }
-    else if (manager->bloomFilter == NULL) { // ingore potentially incomplete blocks when a filter update is pending
+    else if (manager->bloomFilter == NULL && ! _BRPeerManagerIsFullBlockSync(manager)) {
+        // ingore potentially incomplete blocks when a filter update is pending
         BRMerkleBlockFree(block);
         block = NULL;
 
@@ -1265,7 +1453,14 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             peer_log(peer, "adding block #%"PRIu32", false positive rate: %f", block->height, manager->fpRate);
         }
 
-        BRSetAdd(manager->blocks, block);
+        b = BRSetAdd(manager->blocks, block);
+
+        if (b && b != block && BRSetGet(manager->checkpoints, b) != b) { // block was retained from before a rescan
+            if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
+            if (manager->lastOrphan == b) manager->lastOrphan = NULL;
+            BRMerkleBlockFree(b);
+        }
+
         manager->lastBlock = block;
         if (txCount > 0) _BRPeerManagerUpdateTx(manager, txHashes, txCount, block->height, txTime);
         if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, block->height);
@@ -1277,6 +1472,18 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
 
         if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) saveCount = 1; // save transition block immediately
 
+        // while syncing, periodically append the blocks since the last save, back to the last transition at most, so
+        // a restart resumes from here, rebuilding block locators and the bloom filter from the saved chain
+        if ((block->height % SYNC_SAVE_INTERVAL) == 0 && (block->height % BLOCK_DIFFICULTY_INTERVAL) != 0 &&
+            block->height < manager->estimatedHeight && block->height > manager->savedHeight) {
+            saveCount = block->height - manager->savedHeight;
+            if (saveCount > (block->height % BLOCK_DIFFICULTY_INTERVAL) + 1) {
+                saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + 1;
+            }
+
+            append = 1;
+        }
+
         if (block->height == manager->estimatedHeight) { // chain download is complete
             saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
             _BRPeerManagerLoadMempools(manager);
@@ -1329,8 +1536,11 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             }
 
             peer_log(peer, "reorganizing chain from height %"PRIu32", new height is %"PRIu32, b->height, block->height);
+            if (manager->savedHeight > b->height) manager->savedHeight = b->height; // saved blocks after b are stale
 
-            BRWalletSetTxUnconfirmedAfter(manager->wallet, b->height); // mark tx after the join point as unconfirmed
+            for (i = 0; i < array_count(manager->wallets); i++) { // mark tx after the join point as unconfirmed
+                BRWalletSetTxUnconfirmedAfter(manager->wallets[i], b->height);
+            }
 
             b = block;
 
@@ -1348,7 +1558,9 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                 count = BRMerkleBlockTxHashes(b, txHashes, count);
                 b = BRSetGet(manager->blocks, &b->prevBlock);
                 if (b) timestamp = timestamp/2 + b->timestamp/2;
-                if (count > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, count, height, timestamp);
+                for (i = 0; count > 0 && i < array_count(manager->wallets); i++) {
+                    BRWalletUpdateTransactions(manager->wallets[i], txHashes, count, height, timestamp);
+                }
             }
 
             manager->lastBlock = block;
@@ -1364,6 +1576,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
 
     if (block && block->height != BLOCK_UNKNOWN_HEIGHT) {
         if (block->height > manager->estimatedHeight) manager->estimatedHeight = block->height;
+        if (manager->powHashCache) BRPowHashCacheAddBlock(manager->powHashCache, block); // share verified proof-of-work
 
         // check if the next block was received as an orphan
         orphan.prevBlock = block->blockHash;
@@ -1378,16 +1591,22 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         b = BRSetGet(manager->blocks, &b->prevBlock);
     }
 
-    // make sure the set of blocks to be saved starts at a difficulty interval
-    j = (i > 0) ? saveBlocks[i - 1]->height % BLOCK_DIFFICULTY_INTERVAL : 0;
+    // make sure the set of blocks to be saved starts at a difficulty interval, unless it's appended to saved blocks
+    j = (i > 0 && ! append) ? saveBlocks[i - 1]->height % BLOCK_DIFFICULTY_INTERVAL : 0;
     if (j > 0) i -= (i > BLOCK_DIFFICULTY_INTERVAL - j) ? BLOCK_DIFFICULTY_INTERVAL - j : i;
-    assert(i == 0 || (saveBlocks[i - 1]->height % BLOCK_DIFFICULTY_INTERVAL) == 0);
+    assert(i == 0 || append || (saveBlocks[i - 1]->height % BLOCK_DIFFICULTY_INTERVAL) == 0);
+    replace = (i > 1 && ! append) ? 1 : 0;
+
+    // a transition block saved again during a rescan doesn't mean the saved blocks after it are gone
+    if (i > 0 && (replace || saveBlocks[0]->height > manager->savedHeight)) {
+        manager->savedHeight = saveBlocks[0]->height;
+    }
+
     pthread_mutex_unlock(&manager->lock);
-    if (i > 0 && manager->saveBlocks) manager->saveBlocks(manager->info, (i > 1 ? 1 : 0), saveBlocks, i);
+    if (i > 0 && manager->saveBlocks) manager->saveBlocks(manager->info, replace, saveBlocks, i);
 
-    if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer) &&
-        manager->txStatusUpdate) {
-        manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
+    if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer)) {
+        _BRPeerManagerNotify(manager, BRCompletionTxStatusUpdate, 0); // transaction confirmations may have changed
     }
 
     if (next) _peerRelayedBlock(info, next);
@@ -1457,32 +1676,26 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
     BRTransaction *tx = NULL;
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
+    BRPublishedTx *ptx;
     int hasPendingCallbacks = 0, error = 0;
 
     pthread_mutex_lock(&manager->lock);
 
-    for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-        if (UInt256Eq(manager->publishedTxHashes[i - 1], txHash)) {
-            tx = manager->publishedTx[i - 1].tx;
-            txInfo = manager->publishedTx[i - 1].info;
-            txCallback = manager->publishedTx[i - 1].callback;
-            manager->publishedTx[i - 1].info = NULL;
-            manager->publishedTx[i - 1].callback = NULL;
-
-            if (tx && ! BRWalletTransactionIsValid(manager->wallet, tx)) {
-                error = EINVAL;
-                array_rm(manager->publishedTx, i - 1);
-                array_rm(manager->publishedTxHashes, i - 1);
-
-                if (! BRWalletTransactionForHash(manager->wallet, txHash)) {
-                    BRTransactionFree(tx);
-                    tx = NULL;
-                }
-            }
+    ptx = _BRPeerManagerPublishedTx(manager, txHash);
+
+    if (ptx) {
+        tx = ptx->tx;
+        _BRPeerManagerTakePublishCallback(manager, ptx, &txInfo, &txCallback);
+
+        if (tx && ! BRWalletTransactionIsValid(manager->wallet, tx)) {
+            error = EINVAL;
+            _BRPeerManagerRemovePublishedTx(manager, ptx - manager->publishedTx);
+            tx = BRWalletTransactionForHash(manager->wallet, txHash);
         }
-        else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
     }
 
+    hasPendingCallbacks = (manager->publishedCallbackCount > 0);
+
     // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
     if (! hasPendingCallbacks && (manager->syncStartHeight == 0 || peer != manager->downloadPeer)) {
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
@@ -1490,7 +1703,7 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
 
     if (tx && ! error) {
         _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
-        BRWalletRegisterTransaction(manager->wallet, tx);
+        _BRPeerManagerRegisterTx(manager->wallet, tx);
     }
 
 //    pingInfo = calloc(1, sizeof(*pingInfo));
@@ -1499,6 +1712,7 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
 //    pingInfo->manager = manager;
 //    pingInfo->hash = txHash;
 //    BRPeerSendPing(peer, pingInfo, _peerRequestedTxPingDone);
+    if (tx) BRTransactionRetain(tx); // the peer releases it once it's sent, so it can't be freed out from under it
     pthread_mutex_unlock(&manager->lock);
     if (txCallback) txCallback(txInfo, error);
     return tx;
@@ -1519,6 +1733,14 @@ static void _peerThreadCleanup(void *info)
     if (manager->threadCleanup) manager->threadCleanup(manager->info);
 }
 
+// the message thread exits before the socket thread, which frees info in _peerThreadCleanup()
+static void _peerMsgThreadCleanup(void *info)
+{
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+
+    if (manager->threadCleanup) manager->threadCleanup(manager->info);
+}
+
 static void _dummyThreadCleanup(void *info)
 {
 }
@@ -1528,7 +1750,7 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
                                 BRMerkleBlock *blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount)
 {
     BRPeerManager *manager = calloc(1, sizeof(*manager));
-    BRMerkleBlock orphan, *block = NULL;
+    BRMerkleBlock orphan, *block = NULL, *b;
 
     assert(manager != NULL);
     assert(params != NULL);
@@ -1538,8 +1760,13 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
     assert(peers != NULL || peersCount == 0);
     manager->params = params;
     manager->wallet = wallet;
+    array_new(manager->wallets, 1);
+    array_add(manager->wallets, wallet);
     manager->earliestKeyTime = earliestKeyTime;
     manager->averageTxPerBlock = 1400;
+    manager->averageTxSize = 400;
+    manager->fpTarget = manager->fpMinRate = BLOOM_REDUCED_FALSEPOSITIVE_RATE;
+    manager->fpMaxRate = BLOOM_DEFAULT_FALSEPOSITIVE_RATE;
     manager->maxConnectCount = PEER_MAX_CONNECTIONS;
     array_new(manager->peers, peersCount);
     if (peers) array_add_array(manager->peers, peers, peersCount);
@@ -1571,8 +1798,15 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
     }
 
     while (block) {
-        BRSetAdd(manager->blocks, block);
+        b = BRSetAdd(manager->blocks, block);
+
+        if (b && b != block) { // a saved copy of a checkpoint block replaces it
+            if (BRSetGet(manager->checkpoints, b) == b) BRSetAdd(manager->checkpoints, block);
+            BRMerkleBlockFree(b);
+        }
+
         manager->lastBlock = block;
+        manager->savedHeight = block->height;
         orphan.prevBlock = block->prevBlock;
         BRSetRemove(manager->orphans, &orphan);
         orphan.prevBlock = block->blockHash;
@@ -1583,6 +1817,7 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
     array_new(manager->txRequests, 10);
     array_new(manager->publishedTx, 10);
     array_new(manager->publishedTxHashes, 10);
+    manager->publishedTxIndex = BRSetNew(BRTransactionHash, BRTransactionEq, 10);
     pthread_mutex_init(&manager->lock, NULL);
     manager->threadCleanup = _dummyThreadCleanup;
     return manager;
@@ -1595,10 +1830,13 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 // void txStatusUpdate(void *) - called when transaction status may have changed such as when a new block arrives
 // void saveBlocks(void *, int, BRMerkleBlock *[], size_t) - called when blocks should be saved to the persistent store
 // - if replace is true, remove any previously saved blocks first
+// - also called every few hundred blocks while syncing, without replace, with only the blocks since the last save, so
+// BRPeerManagerNew() can resume an interrupted sync
 // void savePeers(void *, int, const BRPeer[], size_t) - called when peers should be saved to the persistent store
 // - if replace is true, remove any previously saved peers first
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
 // void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
+// - only called on the manager's own threads, never on BRThreadPool workers
 void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
                                void (*syncStarted)(void *info),
                                void (*syncStopped)(void *info, int error),
@@ -1619,6 +1857,16 @@ void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
     manager->threadCleanup = (threadCleanup) ? threadCleanup : _dummyThreadCleanup;
 }
 
+// not thread-safe, set once before calling BRPeerManagerConnect(), or set to NULL to stop posting events
+// posts BRCompletionSyncStarted, BRCompletionSyncStopped and BRCompletionTxStatusUpdate events to queue, with the
+// info set by BRPeerManagerSetCallbacks(), in addition to calling those callbacks, which may be NULL
+// queue is not freed with manager, and must stay valid until manager is freed or the queue is unset
+void BRPeerManagerSetCompletionQueue(BRPeerManager *manager, BRCompletionQueue *queue)
+{
+    assert(manager != NULL);
+    manager->completionQueue = queue;
+}
+
 // specifies a single fixed peer to use when connecting to the bitcoin network
 // set address to UINT128_ZERO to revert to default behavior
 void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t port)
@@ -1632,6 +1880,96 @@ void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t
     pthread_mutex_unlock(&manager->lock);
 }
 
+// when enabled, full blocks are downloaded from the fixed peer set with BRPeerManagerSetFixedPeer(), and transactions
+// are matched locally against the wallets instead of loading a bloom filter, which avoids bloom filter false positives
+// and privacy leaks, but uses far more bandwidth - only meant for a trusted node on a fast link, like a local full node
+// has no effect without a fixed peer, disconnects manager, so call this before BRPeerManagerConnect()
+void BRPeerManagerSetFullBlockSync(BRPeerManager *manager, int enabled)
+{
+    assert(manager != NULL);
+    BRPeerManagerDisconnect(manager);
+    pthread_mutex_lock(&manager->lock);
+    manager->fullBlocks = (enabled) ? 1 : 0;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// sets the range the bloom filter false positive rate is chosen from, based on the bandwidth cost of false positives
+// and of sending larger filters, a higher minRate trades bandwidth for privacy, and maxRate limits unrelated tx sent
+// defaults to BLOOM_REDUCED_FALSEPOSITIVE_RATE through BLOOM_DEFAULT_FALSEPOSITIVE_RATE, used on the next filter load
+void BRPeerManagerSetFalsePositiveRateRange(BRPeerManager *manager, double minRate, double maxRate)
+{
+    assert(manager != NULL);
+    assert(minRate > 0.0 && minRate <= maxRate && maxRate < 1.0);
+    pthread_mutex_lock(&manager->lock);
+    manager->fpMinRate = minRate;
+    manager->fpMaxRate = maxRate;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// shares the proof-of-work hashes of verified blocks with any other peer managers using the same cache, so headers
+// downloaded by more than one manager are only scrypt hashed once, cache is retained by manager and may be NULL to
+// stop sharing, manager must not be connected, so call this before BRPeerManagerConnect()
+void BRPeerManagerSetPowHashCache(BRPeerManager *manager, BRPowHashCache *cache)
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    assert(array_count(manager->connectedPeers) == 0); // peers already connected keep the cache they started with
+    if (manager->powHashCache) BRPowHashCacheRelease(manager->powHashCache);
+    manager->powHashCache = (cache) ? BRPowHashCacheRetain(cache) : NULL;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// adds wallet to the wallets served by manager, sharing its peer connections, header chain and bloom filter
+// transactions and confirmations that match wallet are routed to it, while transaction publishing, fee rate updates and
+// mempool relay tracking stay with the wallet manager was created with
+// wallet transactions in blocks already synced are not found until BRPeerManagerRescan() is called
+void BRPeerManagerAddWallet(BRPeerManager *manager, BRWallet *wallet)
+{
+    size_t i;
+
+    assert(manager != NULL);
+    assert(wallet != NULL);
+    pthread_mutex_lock(&manager->lock);
+    for (i = array_count(manager->wallets); i > 0 && manager->wallets[i - 1] != wallet; i--);
+
+    if (i == 0) {
+        array_add(manager->wallets, wallet);
+        // the new wallet's used addresses weren't used since the last filter load, so don't count them in addrsPerBlock
+        for (i = 0; i < 2; i++) manager->filterUsedAddrs[i] += BRWalletUsedAddrCount(wallet, (int)i);
+        if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
+        manager->bloomFilter = NULL; // reset bloom filter so it's recreated with the new wallet's addresses
+        _BRPeerManagerUpdateFilter(manager);
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// removes a wallet added with BRPeerManagerAddWallet(), the wallet manager was created with can't be removed
+void BRPeerManagerRemoveWallet(BRPeerManager *manager, BRWallet *wallet)
+{
+    assert(manager != NULL);
+    assert(wallet != NULL && wallet != manager->wallet);
+    pthread_mutex_lock(&manager->lock);
+
+    for (size_t i = array_count(manager->wallets); i > 1; i--) {
+        if (manager->wallets[i - 1] != wallet) continue;
+        array_rm(manager->wallets, i - 1);
+
+        for (int j = 0; j < 2; j++) {
+            size_t used = BRWalletUsedAddrCount(wallet, j);
+
+            manager->filterUsedAddrs[j] = (manager->filterUsedAddrs[j] > used) ? manager->filterUsedAddrs[j] - used : 0;
+        }
+
+        if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
+        manager->bloomFilter = NULL; // reset bloom filter so it's recreated without the removed wallet's addresses
+        _BRPeerManagerUpdateFilter(manager);
+        break;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
 uint16_t BRPeerManagerStandardPort(BRPeerManager *manager)
 {
     assert(manager != NULL);
@@ -1670,7 +2008,7 @@ void BRPeerManagerConnect(BRPeerManager *manager)
         manager->syncStartHeight == 0) {
         manager->syncStartHeight = manager->lastBlock->height + 1;
         pthread_mutex_unlock(&manager->lock);
-        if (manager->syncStarted) manager->syncStarted(manager->info);
+        _BRPeerManagerNotify(manager, BRCompletionSyncStarted, 0);
         pthread_mutex_lock(&manager->lock);
     }
 
@@ -1716,7 +2054,10 @@ void BRPeerManagerConnect(BRPeerManager *manager)
                 BRPeerSetCallbacks(info->peer, info, _peerConnected, _peerDisconnected, _peerRelayedPeers,
                                    _peerRelayedTx, _peerHasTx, _peerRejectedTx, _peerRelayedBlock, _peerDataNotfound,
                                    _peerSetFeePerKb, _peerRequestedTx, _peerNetworkIsReachable, _peerThreadCleanup);
+                BRPeerSetMessageThreadCleanup(info->peer, _peerMsgThreadCleanup);
                 BRPeerSetEarliestKeyTime(info->peer, manager->earliestKeyTime);
+                if (manager->powHashCache) BRPeerSetPowHashCache(info->peer, manager->powHashCache);
+                if (_BRPeerManagerIsFullBlockSync(manager)) BRPeerSetFullBlocks(info->peer, _peerTxMatches);
                 BRPeerConnect(info->peer);
             }
         }
@@ -1728,7 +2069,7 @@ void BRPeerManagerConnect(BRPeerManager *manager)
         peer_log(&BR_PEER_NONE, "sync failed");
         _BRPeerManagerSyncStopped(manager);
         pthread_mutex_unlock(&manager->lock);
-        if (manager->syncStopped) manager->syncStopped(manager->info, ENETUNREACH);
+        _BRPeerManagerNotify(manager, BRCompletionSyncStopped, ENETUNREACH);
     }
     else pthread_mutex_unlock(&manager->lock);
 }
@@ -1761,6 +2102,51 @@ void BRPeerManagerDisconnect(BRPeerManager *manager)
     }
 }
 
+// disconnects the download peer so syncing restarts from lastBlock with a new random one, must hold manager->lock
+static void _BRPeerManagerRestartSync(BRPeerManager *manager)
+{
+    if (manager->downloadPeer) { // disconnect the current download peer so a new random one will be selected
+        for (size_t i = array_count(manager->peers); i > 0; i--) {
+            if (BRPeerEq(&manager->peers[i - 1], manager->downloadPeer)) array_rm(manager->peers, i - 1);
+        }
+
+        BRPeerDisconnect(manager->downloadPeer);
+    }
+
+    manager->syncStartHeight = 0; // a syncStartHeight of 0 indicates that syncing hasn't started yet
+}
+
+// returns the main chain block to resume syncing from, so that blocks from blockHeight on are downloaded again
+static BRMerkleBlock *_BRPeerManagerRewindBlock(BRPeerManager *manager, uint32_t blockHeight)
+{
+    BRMerkleBlock *block = manager->lastBlock, *b;
+
+    // walk back the retained chain to the block before blockHeight
+    while (block && block->height >= blockHeight && block->height > 0) {
+        block = BRSetGet(manager->blocks, &block->prevBlock);
+    }
+
+    if (! block) { // blocks before the previous difficulty transition are pruned, use the closest retained transition
+        for (b = BRSetIterate(manager->blocks, NULL); b; b = BRSetIterate(manager->blocks, b)) {
+            if ((b->height < blockHeight || b->height == 0) && (b->height % BLOCK_DIFFICULTY_INTERVAL) == 0 &&
+                (! block || b->height > block->height)) block = b;
+        }
+
+        for (size_t i = manager->params->checkpointsCount; i > 0; i--) { // or a later checkpoint
+            if (i - 1 > 0 && manager->params->checkpoints[i - 1].height >= blockHeight) continue;
+            if (block && manager->params->checkpoints[i - 1].height <= block->height) break;
+
+            UInt256 hash = UInt256Reverse(manager->params->checkpoints[i - 1].hash);
+
+            b = BRSetGet(manager->blocks, &hash);
+            if (b) block = b;
+            break;
+        }
+    }
+
+    return (block) ? block : manager->lastBlock;
+}
+
 // rescans blocks and transactions after earliestKeyTime (a new random download peer is also selected due to the
 // possibility that a malicious node might lie by omitting transactions that match the bloom filter)
 void BRPeerManagerRescan(BRPeerManager *manager)
@@ -1779,15 +2165,42 @@ void BRPeerManagerRescan(BRPeerManager *manager)
             }
         }
 
-        if (manager->downloadPeer) { // disconnect the current download peer so a new random one will be selected
-            for (size_t i = array_count(manager->peers); i > 0; i--) {
-                if (BRPeerEq(&manager->peers[i - 1], manager->downloadPeer)) array_rm(manager->peers, i - 1);
-            }
+        _BRPeerManagerRestartSync(manager);
+        pthread_mutex_unlock(&manager->lock);
+        BRPeerManagerConnect(manager);
+    }
+    else pthread_mutex_unlock(&manager->lock);
+}
 
-            BRPeerDisconnect(manager->downloadPeer);
+// rescans blocks and transactions from blockHeight on, such as after importing a key or finding a missed transaction,
+// rewinding only as far as needed while keeping wallet transactions and retained block headers
+// if blockHeight is older than the retained headers, syncing resumes from the closest difficulty transition or
+// checkpoint before it, and earliestKeyTime is lowered so the rescanned blocks are downloaded with their transactions
+// when not connected, the rescan starts with the next call to BRPeerManagerConnect()
+void BRPeerManagerRescanFromBlockHeight(BRPeerManager *manager, uint32_t blockHeight)
+{
+    BRMerkleBlock *block;
+
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+
+    if (blockHeight <= manager->lastBlock->height) {
+        block = _BRPeerManagerRewindBlock(manager, blockHeight);
+        peer_log(&BR_PEER_NONE, "rescanning from block #%"PRIu32", rewinding %"PRIu32" blocks", blockHeight,
+                 manager->lastBlock->height - block->height);
+        manager->lastBlock = block;
+
+        if (block->timestamp + 7*24*60*60 < manager->earliestKeyTime) {
+            manager->earliestKeyTime = block->timestamp;
+
+            for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+                BRPeerSetEarliestKeyTime(manager->connectedPeers[i - 1], manager->earliestKeyTime);
+            }
         }
+    }
 
-        manager->syncStartHeight = 0; // a syncStartHeight of 0 indicates that syncing hasn't started yet
+    if (manager->isConnected) {
+        _BRPeerManagerRestartSync(manager);
         pthread_mutex_unlock(&manager->lock);
         BRPeerManagerConnect(manager);
     }
@@ -1898,45 +2311,69 @@ static void _publishTxInvDone(void *info, int success)
     pthread_mutex_unlock(&manager->lock);
 }
 
-// publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward)
+// publishes tx to bitcoin network, the publish list keeps its own reference to tx, so the caller's reference is left
+// as it was, to be taken over by BRWalletRegisterTransaction() before or after publishing, or released by the caller
+// callback is called exactly once: when tx is accepted by peers, with ETIMEDOUT or another error if it isn't, with
+// EINVAL if tx is unsigned or already confirmed, EALREADY if it's already being published with a callback, or
+// ECANCELED if manager is freed first
 void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *info,
                             void (*callback)(void *info, int error))
 {
-    assert(manager != NULL);
     assert(tx != NULL && BRTransactionIsSigned(tx));
-    if (tx) pthread_mutex_lock(&manager->lock);
+    tx = (tx) ? BRTransactionRetain(tx) : NULL; // the reference BRPeerManagerPublishTxs() takes over
+    BRPeerManagerPublishTxs(manager, &tx, 1, &info, callback);
+}
 
-    if (tx && ! BRTransactionIsSigned(tx)) {
-        pthread_mutex_unlock(&manager->lock);
-        BRTransactionFree(tx);
-        tx = NULL;
-        if (callback) callback(info, EINVAL); // transaction not signed
-    }
-    else if (tx && ! manager->isConnected) {
+// same as BRPeerManagerPublishTx(), but posts a BRCompletionPublishTx completion with info to queue instead of calling
+// a callback, returns the handle of the completion
+uint64_t BRPeerManagerPublishTxAsync(BRPeerManager *manager, BRTransaction *tx, BRCompletionQueue *queue, void *info)
+{
+    uint64_t handle;
+    void *pending = BRCompletionPendingNew(queue, BRCompletionPublishTx, info, &handle);
+
+    BRPeerManagerPublishTx(manager, tx, pending, BRCompletionPendingPost);
+    return handle;
+}
+
+// publishes count transactions to bitcoin network, announcing them to each peer with a single inv message
+// callback is called once for each of txs[i] with info[i], or with NULL if info is NULL
+// unlike BRPeerManagerPublishTx(), this takes over the caller's reference to each of txs, so call
+// BRTransactionRetain() first for any tx that's also registered with BRWalletRegisterTransaction() or used afterward
+void BRPeerManagerPublishTxs(BRPeerManager *manager, BRTransaction *txs[], size_t count, void *info[],
+                             void (*callback)(void *info, int error))
+{
+    size_t i, peerCount = 0, publishCount = 0;
+    int error = 0, txError[count];
+
+    assert(manager != NULL);
+    assert(txs != NULL || count == 0);
+    pthread_mutex_lock(&manager->lock);
+
+    if (! manager->isConnected) {
         int connectFailureCount = manager->connectFailureCount;
 
         pthread_mutex_unlock(&manager->lock);
 
         if (connectFailureCount >= MAX_CONNECT_FAILURES ||
             (manager->networkIsReachable && ! manager->networkIsReachable(manager->info))) {
-            BRTransactionFree(tx);
-            tx = NULL;
-            if (callback) callback(info, ENOTCONN); // not connected to bitcoin network
+            error = ENOTCONN; // not connected to bitcoin network
         }
         else pthread_mutex_lock(&manager->lock);
     }
 
-    if (tx) {
-        size_t i, count = 0;
-
-        tx->timestamp = (uint32_t)time(NULL); // set timestamp to publish time
-        _BRPeerManagerAddTxToPublishList(manager, tx, info, callback);
+    if (! error) {
+        for (i = 0; i < count; i++) {
+            if (! txs[i] || ! BRTransactionIsSigned(txs[i])) continue;
+            txs[i]->timestamp = (uint32_t)time(NULL); // set timestamp to publish time
+            txError[i] = _BRPeerManagerAddTxToPublishList(manager, txs[i], (info) ? info[i] : NULL, callback);
+            if (! txError[i]) publishCount++;
+        }
 
-        for (i = array_count(manager->connectedPeers); i > 0; i--) {
-            if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) == BRPeerStatusConnected) count++;
+        for (i = array_count(manager->connectedPeers); publishCount > 0 && i > 0; i--) {
+            if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) == BRPeerStatusConnected) peerCount++;
         }
 
-        for (i = array_count(manager->connectedPeers); i > 0; i--) {
+        for (i = array_count(manager->connectedPeers); publishCount > 0 && i > 0; i--) {
             BRPeer *peer = manager->connectedPeers[i - 1];
             BRPeerCallbackInfo *peerInfo;
 
@@ -1944,8 +2381,8 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
 
             // instead of publishing to all peers, leave out downloadPeer to see if tx propogates/gets relayed back
             // TODO: XXX connect to a random peer with an empty or fake bloom filter just for publishing
-            if (peer != manager->downloadPeer || count == 1) {
-                _BRPeerManagerPublishPendingTx(manager, peer);
+            if (peer != manager->downloadPeer || peerCount == 1) {
+                _BRPeerManagerPublishPendingTx(manager, peer); // a single inv for every tx in the publish list
                 peerInfo = calloc(1, sizeof(*peerInfo));
                 assert(peerInfo != NULL);
                 peerInfo->peer = peer;
@@ -1956,6 +2393,17 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
 
         pthread_mutex_unlock(&manager->lock);
     }
+
+    for (i = 0; i < count; i++) {
+        if (! txs[i]) continue;
+
+        if (callback && (error || ! BRTransactionIsSigned(txs[i]))) { // not connected, or transaction not signed
+            callback((info) ? info[i] : NULL, (error) ? error : EINVAL);
+        }
+        else if (callback && txError[i]) callback((info) ? info[i] : NULL, txError[i]); // callback wasn't kept
+
+        BRTransactionFree(txs[i]); // the publish list holds its own reference
+    }
 }
 
 // number of connected peers that have relayed the given unconfirmed transaction
@@ -1977,11 +2425,23 @@ size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash)
     return count;
 }
 
-// frees memory allocated for manager
+// frees memory allocated for manager, any publish callbacks still pending are called with ECANCELED
 void BRPeerManagerFree(BRPeerManager *manager)
 {
+    size_t txCount = 0;
+
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
+
+    void *txInfo[array_count(manager->publishedTx)];
+    void (*txCallback[array_count(manager->publishedTx)])(void *, int);
+
+    for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
+        _BRPeerManagerTakePublishCallback(manager, &manager->publishedTx[i - 1], &txInfo[txCount],
+                                          &txCallback[txCount]);
+        if (txCallback[txCount]) txCount++;
+    }
+
     array_free(manager->peers);
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) BRPeerFree(manager->connectedPeers[i - 1]);
     array_free(manager->connectedPeers);
@@ -1990,13 +2450,48 @@ void BRPeerManagerFree(BRPeerManager *manager)
     BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
     BRSetFree(manager->orphans);
     BRSetFree(manager->checkpoints);
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) free(manager->txRelays[i - 1].peers);
+    for (size_t i = array_count(manager->txRelays); i > 0; i--) array_free(manager->txRelays[i - 1].peers);
     array_free(manager->txRelays);
-    for (size_t i = array_count(manager->txRequests); i > 0; i--) free(manager->txRequests[i - 1].peers);
+    for (size_t i = array_count(manager->txRequests); i > 0; i--) array_free(manager->txRequests[i - 1].peers);
     array_free(manager->txRequests);
+    for (size_t i = array_count(manager->publishedTx); i > 0; i--) BRTransactionFree(manager->publishedTx[i - 1].tx);
     array_free(manager->publishedTx);
     array_free(manager->publishedTxHashes);
+    BRSetFree(manager->publishedTxIndex);
+    array_free(manager->wallets);
+    if (manager->powHashCache) BRPowHashCacheRelease(manager->powHashCache);
     pthread_mutex_unlock(&manager->lock);
     pthread_mutex_destroy(&manager->lock);
     free(manager);
+
+    // callbacks are called last, so none can reach the manager being freed
+    for (size_t i = 0; i < txCount; i++) txCallback[i](txInfo[i], ECANCELED);
+}
+
+void BRPeerManagerRelayTxTest(BRPeerManager *manager, BRPeer *peer, BRTransaction *tx)
+{
+    BRPeerCallbackInfo info = { peer, manager, UINT256_ZERO };
+
+    _peerRelayedTx(&info, tx);
+}
+
+void BRPeerManagerLookaheadTest(BRPeerManager *manager, uint32_t blockHeight, uint32_t blockCount, size_t lookahead[2],
+                                double addrsPerBlock[2])
+{
+    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLookahead(manager, blockHeight, blockCount, lookahead);
+    manager->filterUpdateHeight = blockHeight;
+    addrsPerBlock[0] = manager->addrsPerBlock[0];
+    addrsPerBlock[1] = manager->addrsPerBlock[1];
+    pthread_mutex_unlock(&manager->lock);
+}
+
+void BRPeerManagerRelayBlockTest(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block, uint32_t peerLastBlock)
+{
+    BRPeerCallbackInfo info = { peer, manager, UINT256_ZERO };
+
+    pthread_mutex_lock(&manager->lock);
+    if (peerLastBlock > manager->estimatedHeight) manager->estimatedHeight = peerLastBlock;
+    pthread_mutex_unlock(&manager->lock);
+    _peerRelayedBlock(&info, block);
 }
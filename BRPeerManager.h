@@ -27,6 +27,7 @@
 
 #include "BRPeer.h"
 #include "BRMerkleBlock.h"
+#include "BRPowHashCache.h"
 #include "BRTransaction.h"
 #include "BRWallet.h"
 #include "BRChainParams.h"
@@ -52,10 +53,13 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 // void txStatusUpdate(void *) - called when transaction status may have changed such as when a new block arrives
 // void saveBlocks(void *, int, BRMerkleBlock *[], size_t) - called when blocks should be saved to the persistent store
 // - if replace is true, remove any previously saved blocks first
+// - also called every few hundred blocks while syncing, without replace, with only the blocks since the last save, so
+// BRPeerManagerNew() can resume an interrupted sync
 // void savePeers(void *, int, const BRPeer[], size_t) - called when peers should be saved to the persistent store
 // - if replace is true, remove any previously saved peers first
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
 // void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
+// - only called on the manager's own threads, never on BRThreadPool workers
 void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
                                void (*syncStarted)(void *info),
                                void (*syncStopped)(void *info, int error),
@@ -65,10 +69,41 @@ void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
                                int (*networkIsReachable)(void *info),
                                void (*threadCleanup)(void *info));
 
+// not thread-safe, set once before calling BRPeerManagerConnect(), or set to NULL to stop posting events
+// posts BRCompletionSyncStarted, BRCompletionSyncStopped and BRCompletionTxStatusUpdate events to queue, with the
+// info set by BRPeerManagerSetCallbacks(), in addition to calling those callbacks, which may be NULL
+// queue is not freed with manager, and must stay valid until manager is freed or the queue is unset
+void BRPeerManagerSetCompletionQueue(BRPeerManager *manager, BRCompletionQueue *queue);
+
 // specifies a single fixed peer to use when connecting to the bitcoin network
 // set address to UINT128_ZERO to revert to default behavior
 void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t port);
 
+// when enabled, full blocks are downloaded from the fixed peer set with BRPeerManagerSetFixedPeer(), and transactions
+// are matched locally against the wallets instead of loading a bloom filter, which avoids bloom filter false positives
+// and privacy leaks, but uses far more bandwidth - only meant for a trusted node on a fast link, like a local full node
+// has no effect without a fixed peer, disconnects manager, so call this before BRPeerManagerConnect()
+void BRPeerManagerSetFullBlockSync(BRPeerManager *manager, int enabled);
+
+// sets the range the bloom filter false positive rate is chosen from, based on the bandwidth cost of false positives
+// and of sending larger filters, a higher minRate trades bandwidth for privacy, and maxRate limits unrelated tx sent
+// defaults to BLOOM_REDUCED_FALSEPOSITIVE_RATE through BLOOM_DEFAULT_FALSEPOSITIVE_RATE, used on the next filter load
+void BRPeerManagerSetFalsePositiveRateRange(BRPeerManager *manager, double minRate, double maxRate);
+
+// shares the proof-of-work hashes of verified blocks with any other peer managers using the same cache, so headers
+// downloaded by more than one manager are only scrypt hashed once, cache is retained by manager and may be NULL to
+// stop sharing, manager must not be connected, so call this before BRPeerManagerConnect()
+void BRPeerManagerSetPowHashCache(BRPeerManager *manager, BRPowHashCache *cache);
+
+// adds wallet to the wallets served by manager, sharing its peer connections, header chain and bloom filter
+// transactions and confirmations that match wallet are routed to it, while transaction publishing, fee rate updates and
+// mempool relay tracking stay with the wallet manager was created with
+// wallet transactions in blocks already synced are not found until BRPeerManagerRescan() is called
+void BRPeerManagerAddWallet(BRPeerManager *manager, BRWallet *wallet);
+
+// removes a wallet added with BRPeerManagerAddWallet(), the wallet manager was created with can't be removed
+void BRPeerManagerRemoveWallet(BRPeerManager *manager, BRWallet *wallet);
+
 // current connect status
 BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager);
 
@@ -85,6 +120,13 @@ void BRPeerManagerDisconnect(BRPeerManager *manager);
 // possibility that a malicious node might lie by omitting transactions that match the bloom filter)
 void BRPeerManagerRescan(BRPeerManager *manager);
 
+// rescans blocks and transactions from blockHeight on, such as after importing a key or finding a missed transaction,
+// rewinding only as far as needed while keeping wallet transactions and retained block headers
+// if blockHeight is older than the retained headers, syncing resumes from the closest difficulty transition or
+// checkpoint before it, and earliestKeyTime is lowered so the rescanned blocks are downloaded with their transactions
+// when not connected, the rescan starts with the next call to BRPeerManagerConnect()
+void BRPeerManagerRescanFromBlockHeight(BRPeerManager *manager, uint32_t blockHeight);
+
 // the (unverified) best block height reported by connected peers
 uint32_t BRPeerManagerEstimatedBlockHeight(BRPeerManager *manager);
 
@@ -104,14 +146,30 @@ size_t BRPeerManagerPeerCount(BRPeerManager *manager);
 // description of the peer most recently used to sync blockchain data
 const char *BRPeerManagerDownloadPeerName(BRPeerManager *manager);
 
-// publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward)
+// publishes tx to bitcoin network, the publish list keeps its own reference to tx, so the caller's reference is left
+// as it was, to be taken over by BRWalletRegisterTransaction() before or after publishing, or released by the caller
+// callback is called exactly once: when tx is accepted by peers, with ETIMEDOUT or another error if it isn't, with
+// EINVAL if tx is unsigned or already confirmed, EALREADY if it's already being published with a callback, or
+// ECANCELED if manager is freed first
 void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *info,
                             void (*callback)(void *info, int error));
 
+// same as BRPeerManagerPublishTx(), but posts a BRCompletionPublishTx completion with info to queue instead of calling
+// a callback, returns the handle of the completion
+uint64_t BRPeerManagerPublishTxAsync(BRPeerManager *manager, BRTransaction *tx, BRCompletionQueue *queue, void *info);
+
+// publishes count transactions to bitcoin network, announcing them to each peer with a single inv message
+// callback is called once for each of txs[i] with info[i], or with NULL if info is NULL
+// unlike BRPeerManagerPublishTx(), this takes over the caller's reference to each of txs, so call
+// BRTransactionRetain() first for any tx that's also registered with BRWalletRegisterTransaction() or used afterward
+void BRPeerManagerPublishTxs(BRPeerManager *manager, BRTransaction *txs[], size_t count, void *info[],
+                             void (*callback)(void *info, int error));
+
 // number of connected peers that have relayed the given unconfirmed transaction
 size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash);
 
-// frees memory allocated for manager (call BRPeerManagerDisconnect() first if connected)
+// frees memory allocated for manager (call BRPeerManagerDisconnect() first if connected), any publish callbacks still
+// pending are called with ECANCELED
 void BRPeerManagerFree(BRPeerManager *manager);
 
 #ifdef __cplusplus
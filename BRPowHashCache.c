@@ -0,0 +1,156 @@
+//
+//  BRPowHashCache.c
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRPowHashCache.h"
+#include "BRSet.h"
+#include "BRCrypto.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define POW_HASH_CACHE_CAPACITY (4*BLOCK_DIFFICULTY_INTERVAL) // number of most recently verified blocks to remember
+
+typedef struct {
+    UInt256 blockHash;
+    UInt256 powHash;
+} BRPowHashCacheEntry;
+
+struct BRPowHashCacheStruct {
+    BRPowHashCacheEntry *entries; // ring buffer of verified blocks and their proof-of-work hashes
+    size_t next, count;
+    BRSet *index; // entries indexed by blockHash
+    unsigned refCount;
+    pthread_mutex_t lock;
+};
+
+inline static size_t _BRPowHashCacheEntryHash(const void *entry)
+{
+    return (size_t)((const BRPowHashCacheEntry *)entry)->blockHash.u32[0];
+}
+
+inline static int _BRPowHashCacheEntryEq(const void *entry, const void *otherEntry)
+{
+    return (entry == otherEntry || UInt256Eq(((const BRPowHashCacheEntry *)entry)->blockHash,
+                                             ((const BRPowHashCacheEntry *)otherEntry)->blockHash));
+}
+
+// returns a newly allocated proof-of-work hash cache with a reference count of one, release it by calling
+// BRPowHashCacheRelease()
+BRPowHashCache *BRPowHashCacheNew(void)
+{
+    BRPowHashCache *cache = calloc(1, sizeof(*cache));
+
+    assert(cache != NULL);
+    cache->entries = calloc(POW_HASH_CACHE_CAPACITY, sizeof(*cache->entries));
+    assert(cache->entries != NULL);
+    cache->index = BRSetNew(_BRPowHashCacheEntryHash, _BRPowHashCacheEntryEq, POW_HASH_CACHE_CAPACITY);
+    cache->refCount = 1;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+// increments the reference count of cache and returns it
+BRPowHashCache *BRPowHashCacheRetain(BRPowHashCache *cache)
+{
+    assert(cache != NULL);
+    pthread_mutex_lock(&cache->lock);
+    assert(cache->refCount > 0);
+    cache->refCount++;
+    pthread_mutex_unlock(&cache->lock);
+    return cache;
+}
+
+// decrements the reference count of cache, and frees it when the count reaches zero
+void BRPowHashCacheRelease(BRPowHashCache *cache)
+{
+    unsigned refCount;
+
+    assert(cache != NULL);
+    pthread_mutex_lock(&cache->lock);
+    assert(cache->refCount > 0);
+    refCount = --cache->refCount;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (refCount == 0) {
+        BRSetFree(cache->index);
+        free(cache->entries);
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+    }
+}
+
+// sets powHash to the proof-of-work hash of the verified block with the given blockHash, returns false if not cached
+int BRPowHashCacheGet(BRPowHashCache *cache, UInt256 blockHash, UInt256 *powHash)
+{
+    BRPowHashCacheEntry *entry, key;
+
+    assert(cache != NULL);
+    assert(powHash != NULL);
+    key.blockHash = blockHash;
+    pthread_mutex_lock(&cache->lock);
+    entry = BRSetGet(cache->index, &key);
+    if (entry) *powHash = entry->powHash;
+    pthread_mutex_unlock(&cache->lock);
+    return (entry != NULL);
+}
+
+// buf must contain either a serialized merkleblock or header
+// the proof-of-work hash is taken from cache if the header was already verified, otherwise it's computed with scrypt
+// returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
+BRMerkleBlock *BRPowHashCacheParseBlock(BRPowHashCache *cache, const uint8_t *buf, size_t bufLen)
+{
+    UInt256 blockHash, powHash;
+
+    assert(cache != NULL);
+    assert(buf != NULL || bufLen == 0);
+    if (! buf || bufLen < 80) return NULL;
+
+    // the blockHash commits to the whole header, so a matching entry is guaranteed to have the same proof-of-work hash
+    BRSHA256_2(&blockHash, buf, 80);
+    return (BRPowHashCacheGet(cache, blockHash, &powHash)) ? BRMerkleBlockParseWithPowHash(buf, bufLen, powHash) :
+           BRMerkleBlockParse(buf, bufLen);
+}
+
+// records the proof-of-work hash of a block that passed full verification
+void BRPowHashCacheAddBlock(BRPowHashCache *cache, const BRMerkleBlock *block)
+{
+    BRPowHashCacheEntry *entry, key;
+
+    assert(cache != NULL);
+    assert(block != NULL);
+    key.blockHash = block->blockHash;
+    pthread_mutex_lock(&cache->lock);
+
+    if (! BRSetContains(cache->index, &key)) {
+        entry = &cache->entries[cache->next];
+        if (cache->count == POW_HASH_CACHE_CAPACITY) BRSetRemove(cache->index, entry); // overwrite the oldest entry
+        else cache->count++;
+        entry->blockHash = block->blockHash;
+        entry->powHash = block->powHash;
+        BRSetAdd(cache->index, entry);
+        cache->next = (cache->next + 1) % POW_HASH_CACHE_CAPACITY;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
@@ -0,0 +1,66 @@
+//
+//  BRPowHashCache.h
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRPowHashCache_h
+#define BRPowHashCache_h
+
+#include "BRMerkleBlock.h"
+#include "BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a reference counted cache of the proof-of-work hashes of recently verified blocks, keyed by block hash, that can be
+// shared by any number of peers and peer managers, so a header downloaded by more than one of them is only scrypt
+// hashed once, it isn't a shared header chain, each peer manager still stores, links and reorganizes its own headers
+typedef struct BRPowHashCacheStruct BRPowHashCache;
+
+// returns a newly allocated proof-of-work hash cache with a reference count of one, release it by calling
+// BRPowHashCacheRelease()
+BRPowHashCache *BRPowHashCacheNew(void);
+
+// increments the reference count of cache and returns it
+BRPowHashCache *BRPowHashCacheRetain(BRPowHashCache *cache);
+
+// decrements the reference count of cache, and frees it when the count reaches zero
+void BRPowHashCacheRelease(BRPowHashCache *cache);
+
+// sets powHash to the proof-of-work hash of the verified block with the given blockHash, returns false if not cached
+int BRPowHashCacheGet(BRPowHashCache *cache, UInt256 blockHash, UInt256 *powHash);
+
+// buf must contain either a serialized merkleblock or header
+// the proof-of-work hash is taken from cache if the header was already verified, otherwise it's computed with scrypt
+// returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
+BRMerkleBlock *BRPowHashCacheParseBlock(BRPowHashCache *cache, const uint8_t *buf, size_t bufLen);
+
+// records the proof-of-work hash of a block that passed full verification
+void BRPowHashCacheAddBlock(BRPowHashCache *cache, const BRMerkleBlock *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRPowHashCache_h
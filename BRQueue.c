@@ -0,0 +1,221 @@
+//
+//  BRQueue.c
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRQueue.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <assert.h>
+
+struct BRQueueStruct {
+    void **items; // ring buffer, item i is at items[i % capacity]
+    size_t capacity;
+    atomic_size_t head, tail; // total items popped and pushed, only the consumer writes head and the producer tail
+    atomic_int closed, producerWaiting, consumerWaiting;
+    atomic_size_t maxCount;
+    atomic_uint_fast64_t pushCount, occupancySum, fullWaits, emptyWaits;
+    pthread_mutex_t lock; // only used to sleep and wake when the queue is full or empty
+    pthread_cond_t cond;
+};
+
+// wakes the other end of the queue if it's sleeping, the waiting flag is checked after the head or tail is updated,
+// and set before it's checked by the sleeping thread while holding the lock, so the wakeup can't be missed
+static void _BRQueueWake(BRQueue *queue, atomic_int *waiting)
+{
+    if (atomic_load(waiting)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+// returns a newly allocated queue that holds up to capacity items, free it by calling BRQueueFree()
+BRQueue *BRQueueNew(size_t capacity)
+{
+    BRQueue *queue = calloc(1, sizeof(*queue));
+
+    assert(queue != NULL);
+    assert(capacity > 0);
+    queue->items = calloc(capacity, sizeof(*queue->items));
+    assert(queue->items != NULL);
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->closed, 0);
+    atomic_init(&queue->producerWaiting, 0);
+    atomic_init(&queue->consumerWaiting, 0);
+    atomic_init(&queue->maxCount, 0);
+    atomic_init(&queue->pushCount, 0);
+    atomic_init(&queue->occupancySum, 0);
+    atomic_init(&queue->fullWaits, 0);
+    atomic_init(&queue->emptyWaits, 0);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return queue;
+}
+
+// adds item to the end of the queue, waiting for room if the queue is full
+// returns true on success, or false if the queue was closed, in which case the caller still owns item
+int BRQueuePush(BRQueue *queue, void *item)
+{
+    size_t count, tail;
+
+    assert(queue != NULL);
+    assert(item != NULL);
+    tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail - atomic_load(&queue->head) >= queue->capacity && ! atomic_load(&queue->closed)) {
+        atomic_fetch_add_explicit(&queue->fullWaits, 1, memory_order_relaxed);
+        pthread_mutex_lock(&queue->lock);
+        atomic_store(&queue->producerWaiting, 1);
+
+        while (tail - atomic_load(&queue->head) >= queue->capacity && ! atomic_load(&queue->closed)) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+
+        atomic_store(&queue->producerWaiting, 0);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    if (atomic_load(&queue->closed)) return 0;
+    queue->items[tail % queue->capacity] = item;
+    atomic_store(&queue->tail, tail + 1);
+    _BRQueueWake(queue, &queue->consumerWaiting);
+
+    count = tail + 1 - atomic_load(&queue->head);
+    atomic_fetch_add_explicit(&queue->pushCount, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->occupancySum, count, memory_order_relaxed);
+    if (count > atomic_load_explicit(&queue->maxCount, memory_order_relaxed)) {
+        atomic_store_explicit(&queue->maxCount, count, memory_order_relaxed);
+    }
+
+    return 1;
+}
+
+// removes and returns the item at the front of the queue, waiting up to timeout seconds if the queue is empty
+// returns NULL if the wait timed out, or once the queue is closed
+void *BRQueuePop(BRQueue *queue, double timeout)
+{
+    size_t head;
+    struct timeval tv;
+    struct timespec ts;
+    int error = 0;
+
+    assert(queue != NULL);
+    head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if (head == atomic_load(&queue->tail) && ! atomic_load(&queue->closed)) {
+        atomic_fetch_add_explicit(&queue->emptyWaits, 1, memory_order_relaxed);
+        gettimeofday(&tv, NULL);
+        timeout += tv.tv_sec + (double)tv.tv_usec/1000000;
+        ts.tv_sec = (time_t)timeout;
+        ts.tv_nsec = (long)((timeout - ts.tv_sec)*1000000000);
+        pthread_mutex_lock(&queue->lock);
+        atomic_store(&queue->consumerWaiting, 1);
+
+        while (head == atomic_load(&queue->tail) && ! atomic_load(&queue->closed) && error != ETIMEDOUT) {
+            error = pthread_cond_timedwait(&queue->cond, &queue->lock, &ts);
+        }
+
+        atomic_store(&queue->consumerWaiting, 0);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    return (atomic_load(&queue->closed)) ? NULL : BRQueueTryPop(queue);
+}
+
+// removes and returns the item at the front of the queue without waiting, or NULL if the queue is empty
+// this still works after the queue is closed, so any items left over can be drained before calling BRQueueFree()
+void *BRQueueTryPop(BRQueue *queue)
+{
+    size_t head;
+    void *item = NULL;
+
+    assert(queue != NULL);
+    head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if (head != atomic_load(&queue->tail)) {
+        item = queue->items[head % queue->capacity];
+        atomic_store(&queue->head, head + 1);
+        _BRQueueWake(queue, &queue->producerWaiting);
+    }
+
+    return item;
+}
+
+// closes the queue, waking the producer and consumer, after which pushes fail and pops return NULL
+void BRQueueClose(BRQueue *queue)
+{
+    assert(queue != NULL);
+    pthread_mutex_lock(&queue->lock);
+    atomic_store(&queue->closed, 1);
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// true if BRQueueClose() has been called
+int BRQueueIsClosed(BRQueue *queue)
+{
+    assert(queue != NULL);
+    return atomic_load(&queue->closed);
+}
+
+// reopens a closed queue so it can be used again, once it's been drained and the previous producer and consumer are
+// done with it, statistics are kept across reopens
+void BRQueueReopen(BRQueue *queue)
+{
+    assert(queue != NULL);
+    assert(atomic_load(&queue->head) == atomic_load(&queue->tail));
+    atomic_store(&queue->closed, 0);
+}
+
+// writes a snapshot of the queue statistics to stats, which can be used to see which end of the queue is the bottleneck
+void BRQueueGetStats(BRQueue *queue, BRQueueStats *stats)
+{
+    size_t head, tail;
+
+    assert(queue != NULL);
+    assert(stats != NULL);
+    head = atomic_load(&queue->head);
+    tail = atomic_load(&queue->tail);
+    stats->capacity = queue->capacity;
+    stats->count = (tail > head) ? tail - head : 0;
+    stats->maxCount = atomic_load_explicit(&queue->maxCount, memory_order_relaxed);
+    stats->pushCount = atomic_load_explicit(&queue->pushCount, memory_order_relaxed);
+    stats->occupancySum = atomic_load_explicit(&queue->occupancySum, memory_order_relaxed);
+    stats->fullWaits = atomic_load_explicit(&queue->fullWaits, memory_order_relaxed);
+    stats->emptyWaits = atomic_load_explicit(&queue->emptyWaits, memory_order_relaxed);
+}
+
+// frees memory allocated for queue, but not any items still in it, which should be drained with BRQueueTryPop()
+// the producer and consumer must both be done with the queue
+void BRQueueFree(BRQueue *queue)
+{
+    assert(queue != NULL);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
@@ -0,0 +1,84 @@
+//
+//  BRQueue.h
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRQueue_h
+#define BRQueue_h
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a bounded single producer, single consumer queue of pointers, used to hand work from one thread to the next
+// pushing and popping don't take a lock unless the queue is full or empty, in which case the waiting thread sleeps
+typedef struct BRQueueStruct BRQueue;
+
+typedef struct {
+    size_t capacity;
+    size_t count; // items currently queued
+    size_t maxCount; // most items ever queued at once
+    uint64_t pushCount; // items pushed so far
+    uint64_t occupancySum; // sum of count after each push, divide by pushCount for the mean occupancy
+    uint64_t fullWaits; // number of times the producer had to wait for the consumer to make room
+    uint64_t emptyWaits; // number of times the consumer had to wait for the producer to push an item
+} BRQueueStats;
+
+// returns a newly allocated queue that holds up to capacity items, free it by calling BRQueueFree()
+BRQueue *BRQueueNew(size_t capacity);
+
+// adds item to the end of the queue, waiting for room if the queue is full
+// returns true on success, or false if the queue was closed, in which case the caller still owns item
+int BRQueuePush(BRQueue *queue, void *item);
+
+// removes and returns the item at the front of the queue, waiting up to timeout seconds if the queue is empty
+// returns NULL if the wait timed out, or once the queue is closed
+void *BRQueuePop(BRQueue *queue, double timeout);
+
+// removes and returns the item at the front of the queue without waiting, or NULL if the queue is empty
+// this still works after the queue is closed, so any items left over can be drained before calling BRQueueFree()
+void *BRQueueTryPop(BRQueue *queue);
+
+// closes the queue, waking the producer and consumer, after which pushes fail and pops return NULL
+void BRQueueClose(BRQueue *queue);
+
+// true if BRQueueClose() has been called
+int BRQueueIsClosed(BRQueue *queue);
+
+// reopens a closed queue so it can be used again, once it's been drained and the previous producer and consumer are
+// done with it, statistics are kept across reopens
+void BRQueueReopen(BRQueue *queue);
+
+// writes a snapshot of the queue statistics to stats, which can be used to see which end of the queue is the bottleneck
+void BRQueueGetStats(BRQueue *queue, BRQueueStats *stats);
+
+// frees memory allocated for queue, but not any items still in it, which should be drained with BRQueueTryPop()
+// the producer and consumer must both be done with the queue
+void BRQueueFree(BRQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRQueue_h
@@ -0,0 +1,375 @@
+//
+//  BRScriptMatcher.c
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRScriptMatcher.h"
+#include "BRCrypto.h"
+#include "BRArray.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define BUCKET_SLOTS    4    // fingerprints per cuckoo filter bucket
+#define MAX_KICKS       500  // fingerprint relocations to try before stashing the fingerprint left over
+#define STASH_MAX       64   // stashed fingerprints allowed before growing the cuckoo filter
+#define MIN_LOAD        4    // the filter never grows past this many slots per item, the stash takes any overflow
+#define PENDING_MAX     1024 // items added since the index was last sorted, that are searched linearly
+#define SCRIPT_INDEX    UINT32_MAX // index used for script entries, which never matches a real outpoint
+
+// scripts are keyed by their sha256 hash, and outpoints by their tx hash and output index
+typedef struct {
+    UInt256 hash;
+    uint32_t n;
+} BRMatcherEntry;
+
+// a fingerprint that found no free slot in either of its buckets, bucket is one of them
+typedef struct {
+    size_t bucket;
+    uint16_t fp;
+} BRMatcherStashItem;
+
+struct BRScriptMatcherStruct {
+    uint16_t *buckets; // cuckoo filter, BUCKET_SLOTS fingerprints per bucket, zero is an empty slot
+    size_t bucketMask; // bucket count - 1, bucket count is a power of 2
+    BRMatcherStashItem *stash; // fingerprints that didn't fit in the filter, searched linearly
+    uint32_t seed[2]; // random per matcher, so colliding items can't be chosen ahead of time
+    BRMatcherEntry *entries; // exact index, sorted up to sortedCount, followed by pending items in the order added
+    size_t sortedCount;
+    size_t kick;
+};
+
+// hashes the whole entry, since outpoint tx hashes are chosen by whoever creates the transaction, and items that share
+// a hash prefix would otherwise all land in the same two buckets with the same fingerprint
+inline static uint64_t _BRMatcherEntryHash(const BRScriptMatcher *matcher, const BRMatcherEntry *entry)
+{
+    uint8_t buf[sizeof(UInt256) + sizeof(uint32_t)];
+
+    UInt256Set(buf, entry->hash);
+    UInt32SetLE(&buf[sizeof(UInt256)], entry->n);
+    return ((uint64_t)BRMurmur3_32(buf, sizeof(buf), matcher->seed[0]) << 32) |
+           BRMurmur3_32(buf, sizeof(buf), matcher->seed[1]);
+}
+
+inline static uint16_t _BRMatcherFingerprint(uint64_t h)
+{
+    uint16_t fp = (uint16_t)(h >> 48);
+
+    return (fp != 0) ? fp : 1;
+}
+
+inline static size_t _BRMatcherAltBucket(const BRScriptMatcher *matcher, size_t i, uint16_t fp)
+{
+    return (i ^ (fp*0x5bd1e995UL)) & matcher->bucketMask;
+}
+
+static int _BRMatcherEntryCompare(const void *a, const void *b)
+{
+    const BRMatcherEntry *e1 = a, *e2 = b;
+    int r = memcmp(&e1->hash, &e2->hash, sizeof(e1->hash));
+
+    return (r != 0) ? r : (e1->n < e2->n) ? -1 : (e1->n > e2->n) ? 1 : 0;
+}
+
+// returns true if fp was stored in bucket i
+static int _BRMatcherBucketAdd(BRScriptMatcher *matcher, size_t i, uint16_t fp)
+{
+    uint16_t *bucket = &matcher->buckets[i*BUCKET_SLOTS];
+
+    for (size_t j = 0; j < BUCKET_SLOTS; j++) {
+        if (bucket[j] == 0) return (bucket[j] = fp, 1);
+    }
+
+    return 0;
+}
+
+static int _BRMatcherBucketContains(const BRScriptMatcher *matcher, size_t i, uint16_t fp)
+{
+    const uint16_t *bucket = &matcher->buckets[i*BUCKET_SLOTS];
+
+    return (bucket[0] == fp || bucket[1] == fp || bucket[2] == fp || bucket[3] == fp);
+}
+
+// returns true on success, otherwise the stash is full and the filter must be rebuilt larger
+static int _BRMatcherFilterAdd(BRScriptMatcher *matcher, const BRMatcherEntry *entry)
+{
+    uint64_t h = _BRMatcherEntryHash(matcher, entry);
+    uint16_t fp = _BRMatcherFingerprint(h), t;
+    size_t i = (size_t)h & matcher->bucketMask, slot;
+
+    if (_BRMatcherBucketAdd(matcher, i, fp)) return 1;
+    i = _BRMatcherAltBucket(matcher, i, fp);
+    if (_BRMatcherBucketAdd(matcher, i, fp)) return 1;
+
+    for (size_t k = 0; k < MAX_KICKS; k++) { // evict a fingerprint to its alternate bucket to make room
+        slot = i*BUCKET_SLOTS + (matcher->kick++ % BUCKET_SLOTS);
+        t = matcher->buckets[slot], matcher->buckets[slot] = fp, fp = t;
+        i = _BRMatcherAltBucket(matcher, i, fp);
+        if (_BRMatcherBucketAdd(matcher, i, fp)) return 1;
+    }
+
+    array_add(matcher->stash, ((BRMatcherStashItem) { i, fp }));
+
+    // once the filter is large enough that a full stash can't be from normal load, keep stashing instead of growing
+    return (array_count(matcher->stash) <= STASH_MAX ||
+            (matcher->bucketMask + 1)*BUCKET_SLOTS >= array_count(matcher->entries)*MIN_LOAD);
+}
+
+static int _BRMatcherFilterContains(const BRScriptMatcher *matcher, const BRMatcherEntry *entry)
+{
+    uint64_t h = _BRMatcherEntryHash(matcher, entry);
+    uint16_t fp = _BRMatcherFingerprint(h);
+    size_t i = (size_t)h & matcher->bucketMask, j = _BRMatcherAltBucket(matcher, i, fp);
+
+    if (_BRMatcherBucketContains(matcher, i, fp) || _BRMatcherBucketContains(matcher, j, fp)) return 1;
+
+    for (size_t k = array_count(matcher->stash); k > 0; k--) {
+        if (matcher->stash[k - 1].fp == fp && (matcher->stash[k - 1].bucket == i || matcher->stash[k - 1].bucket == j))
+            return 1;
+    }
+
+    return 0;
+}
+
+// refills the cuckoo filter from the exact index, with at least bucketCount buckets, doubling until everything fits,
+// which ends once the filter reaches MIN_LOAD slots per item, since from then on any overflow is stashed
+static void _BRMatcherFilterRebuild(BRScriptMatcher *matcher, size_t bucketCount)
+{
+    size_t i = 0, count = array_count(matcher->entries);
+
+    do {
+        if (matcher->buckets) free(matcher->buckets);
+        matcher->buckets = calloc(bucketCount*BUCKET_SLOTS, sizeof(*matcher->buckets));
+        assert(matcher->buckets != NULL);
+        matcher->bucketMask = bucketCount - 1;
+        array_clear(matcher->stash);
+        for (i = 0; i < count && _BRMatcherFilterAdd(matcher, &matcher->entries[i]); i++);
+        bucketCount *= 2;
+    } while (i < count);
+}
+
+// sorts pending items into the index, dropping duplicates
+static void _BRMatcherMergePending(BRScriptMatcher *matcher)
+{
+    BRMatcherEntry *entries = matcher->entries, *pending;
+    size_t count = array_count(entries), sorted = matcher->sortedCount, pendingCount = count - sorted, i, j, k;
+
+    if (pendingCount == 0) return;
+    pending = malloc(pendingCount*sizeof(*pending));
+    assert(pending != NULL);
+    memcpy(pending, &entries[sorted], pendingCount*sizeof(*pending));
+    qsort(pending, pendingCount, sizeof(*pending), _BRMatcherEntryCompare);
+
+    for (i = 0, j = 0; j < pendingCount; j++) { // drop duplicates within the pending items
+        if (i == 0 || _BRMatcherEntryCompare(&pending[i - 1], &pending[j]) != 0) pending[i++] = pending[j];
+    }
+
+    pendingCount = i;
+    i = sorted, j = pendingCount, k = sorted + pendingCount;
+
+    while (j > 0) { // merge from the back so nothing in the sorted part is overwritten before it's moved
+        if (i > 0 && _BRMatcherEntryCompare(&entries[i - 1], &pending[j - 1]) > 0) entries[--k] = entries[--i];
+        else entries[--k] = pending[--j];
+    }
+
+    free(pending);
+    count = sorted + pendingCount;
+
+    for (i = 1, j = 1; j < count; j++) { // drop items that were already in the index
+        if (_BRMatcherEntryCompare(&entries[i - 1], &entries[j]) != 0) entries[i++] = entries[j];
+    }
+
+    if (count > 0) count = i;
+    if (count < array_count(entries)) array_set_count(entries, count);
+    matcher->sortedCount = count;
+}
+
+static int _BRMatcherContains(BRScriptMatcher *matcher, const BRMatcherEntry *entry)
+{
+    const BRMatcherEntry *entries;
+    size_t lo = 0, hi, count;
+    int r = 0;
+
+    if (! _BRMatcherFilterContains(matcher, entry)) return 0;
+    if (array_count(matcher->entries) - matcher->sortedCount > PENDING_MAX) _BRMatcherMergePending(matcher);
+    entries = matcher->entries, hi = matcher->sortedCount, count = array_count(entries);
+
+    while (! r && lo < hi) { // binary search the sorted part of the index
+        size_t mid = lo + (hi - lo)/2;
+        int c = _BRMatcherEntryCompare(&entries[mid], entry);
+
+        if (c == 0) r = 1;
+        else if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (size_t i = matcher->sortedCount; ! r && i < count; i++) { // linear search the pending items
+        if (_BRMatcherEntryCompare(&entries[i], entry) == 0) r = 1;
+    }
+
+    return r;
+}
+
+static void _BRMatcherAdd(BRScriptMatcher *matcher, const BRMatcherEntry *entry)
+{
+    size_t bucketCount = matcher->bucketMask + 1;
+
+    if (_BRMatcherContains(matcher, entry)) return; // repeated items would take up more fingerprint slots
+    array_add(matcher->entries, *entry);
+
+    if (! _BRMatcherFilterAdd(matcher, entry)) { // drop duplicates before rebuilding, and grow if the filter is full
+        _BRMatcherMergePending(matcher);
+        if (matcher->sortedCount*10 > bucketCount*BUCKET_SLOTS*9) bucketCount *= 2;
+        _BRMatcherFilterRebuild(matcher, bucketCount);
+    }
+}
+
+// returns a newly allocated matcher sized for about capacity watched items, that must be freed by BRScriptMatcherFree()
+// the matcher grows as needed when more items are added
+BRScriptMatcher *BRScriptMatcherNew(size_t capacity)
+{
+    BRScriptMatcher *matcher = calloc(1, sizeof(*matcher));
+    size_t bucketCount = 1;
+
+    assert(matcher != NULL);
+    while (bucketCount*BUCKET_SLOTS*9 < capacity*10) bucketCount *= 2; // keep the filter below 90% load at capacity
+    array_new(matcher->entries, (capacity > 0) ? capacity : 1);
+    array_new(matcher->stash, STASH_MAX + 1);
+    matcher->seed[0] = BRRand(0);
+    matcher->seed[1] = BRRand(0);
+    matcher->buckets = calloc(bucketCount*BUCKET_SLOTS, sizeof(*matcher->buckets));
+    assert(matcher->buckets != NULL);
+    matcher->bucketMask = bucketCount - 1;
+    return matcher;
+}
+
+// watches an output script, so transactions with an output paying to it match
+void BRScriptMatcherAddScript(BRScriptMatcher *matcher, const uint8_t *script, size_t scriptLen)
+{
+    BRMatcherEntry entry = { UINT256_ZERO, SCRIPT_INDEX };
+
+    assert(matcher != NULL);
+    assert(script != NULL || scriptLen == 0);
+    BRSHA256(&entry.hash, script, scriptLen);
+    _BRMatcherAdd(matcher, &entry);
+}
+
+// watches an outpoint, so transactions with an input spending it match
+void BRScriptMatcherAddOutpoint(BRScriptMatcher *matcher, UInt256 txHash, uint32_t index)
+{
+    BRMatcherEntry entry = { txHash, index };
+
+    assert(matcher != NULL);
+    assert(index != SCRIPT_INDEX);
+    _BRMatcherAdd(matcher, &entry);
+}
+
+// returns the number of distinct watched scripts and outpoints
+size_t BRScriptMatcherCount(BRScriptMatcher *matcher)
+{
+    assert(matcher != NULL);
+    _BRMatcherMergePending(matcher);
+    return matcher->sortedCount;
+}
+
+// true if script is watched
+int BRScriptMatcherContainsScript(BRScriptMatcher *matcher, const uint8_t *script, size_t scriptLen)
+{
+    BRMatcherEntry entry = { UINT256_ZERO, SCRIPT_INDEX };
+
+    assert(matcher != NULL);
+    assert(script != NULL || scriptLen == 0);
+    BRSHA256(&entry.hash, script, scriptLen);
+    return _BRMatcherContains(matcher, &entry);
+}
+
+// true if the outpoint is watched
+int BRScriptMatcherContainsOutpoint(BRScriptMatcher *matcher, UInt256 txHash, uint32_t index)
+{
+    BRMatcherEntry entry = { txHash, index };
+
+    assert(matcher != NULL);
+    return (index != SCRIPT_INDEX && _BRMatcherContains(matcher, &entry));
+}
+
+// true if tx has an output paying to a watched script, or an input spending a watched outpoint
+int BRScriptMatcherMatchesTx(BRScriptMatcher *matcher, const BRTransaction *tx)
+{
+    int r = 0;
+
+    assert(matcher != NULL);
+    assert(tx != NULL);
+
+    for (size_t i = 0; ! r && i < tx->inCount; i++) { // check inputs first, they need no hashing
+        r = BRScriptMatcherContainsOutpoint(matcher, tx->inputs[i].txHash, tx->inputs[i].index);
+    }
+
+    for (size_t i = 0; ! r && i < tx->outCount; i++) {
+        if (tx->outputs[i].script) r = BRScriptMatcherContainsScript(matcher, tx->outputs[i].script,
+                                                                     tx->outputs[i].scriptLen);
+    }
+
+    return r;
+}
+
+// matches txCount transactions in order, such as all the transactions of a block, writing true or false to matches[i]
+// outputs paying to watched scripts have their outpoints watched as well, so later spends of them match, including
+// spends further along in the same batch
+// returns the number of matching transactions
+size_t BRScriptMatcherMatchTxs(BRScriptMatcher *matcher, BRTransaction *txs[], size_t txCount, int matches[])
+{
+    size_t count = 0;
+
+    assert(matcher != NULL);
+    assert(txs != NULL || txCount == 0);
+    assert(matches != NULL || txCount == 0);
+
+    for (size_t i = 0; i < txCount; i++) {
+        BRTransaction *tx = txs[i];
+        int r = 0;
+
+        for (size_t j = 0; ! r && j < tx->inCount; j++) {
+            r = BRScriptMatcherContainsOutpoint(matcher, tx->inputs[j].txHash, tx->inputs[j].index);
+        }
+
+        for (size_t j = 0; j < tx->outCount; j++) { // check every output, so all payments to watched scripts are added
+            if (! tx->outputs[j].script ||
+                ! BRScriptMatcherContainsScript(matcher, tx->outputs[j].script, tx->outputs[j].scriptLen)) continue;
+            BRScriptMatcherAddOutpoint(matcher, tx->txHash, (uint32_t)j);
+            r = 1;
+        }
+
+        matches[i] = r;
+        if (r) count++;
+    }
+
+    return count;
+}
+
+// frees memory allocated for matcher
+void BRScriptMatcherFree(BRScriptMatcher *matcher)
+{
+    assert(matcher != NULL);
+    free(matcher->buckets);
+    array_free(matcher->stash);
+    array_free(matcher->entries);
+    free(matcher);
+}
@@ -0,0 +1,79 @@
+//
+//  BRScriptMatcher.h
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRScriptMatcher_h
+#define BRScriptMatcher_h
+
+#include "BRTransaction.h"
+#include "BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// matches transactions against a large set of watched output scripts and outpoints, such as for a watch-only service
+// tracking millions of addresses, where wallet sized address and transaction sets don't scale
+// a cuckoo filter with 16bit fingerprints rejects almost all non-matching lookups with at most two memory accesses,
+// and a sorted index behind it makes every match exact, items are hashed with a random per-matcher seed, and any that
+// still collide past what the filter can hold go to a small overflow stash rather than growing it without limit
+// not thread-safe, the caller must serialize access
+typedef struct BRScriptMatcherStruct BRScriptMatcher;
+
+// returns a newly allocated matcher sized for about capacity watched items, that must be freed by BRScriptMatcherFree()
+// the matcher grows as needed when more items are added
+BRScriptMatcher *BRScriptMatcherNew(size_t capacity);
+
+// watches an output script, so transactions with an output paying to it match
+void BRScriptMatcherAddScript(BRScriptMatcher *matcher, const uint8_t *script, size_t scriptLen);
+
+// watches an outpoint, so transactions with an input spending it match
+void BRScriptMatcherAddOutpoint(BRScriptMatcher *matcher, UInt256 txHash, uint32_t index);
+
+// returns the number of distinct watched scripts and outpoints
+size_t BRScriptMatcherCount(BRScriptMatcher *matcher);
+
+// true if script is watched
+int BRScriptMatcherContainsScript(BRScriptMatcher *matcher, const uint8_t *script, size_t scriptLen);
+
+// true if the outpoint is watched
+int BRScriptMatcherContainsOutpoint(BRScriptMatcher *matcher, UInt256 txHash, uint32_t index);
+
+// true if tx has an output paying to a watched script, or an input spending a watched outpoint
+int BRScriptMatcherMatchesTx(BRScriptMatcher *matcher, const BRTransaction *tx);
+
+// matches txCount transactions in order, such as all the transactions of a block, writing true or false to matches[i]
+// outputs paying to watched scripts have their outpoints watched as well, so later spends of them match, including
+// spends further along in the same batch
+// returns the number of matching transactions
+size_t BRScriptMatcherMatchTxs(BRScriptMatcher *matcher, BRTransaction *txs[], size_t txCount, int matches[]);
+
+// frees memory allocated for matcher
+void BRScriptMatcherFree(BRScriptMatcher *matcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRScriptMatcher_h
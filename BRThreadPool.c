@@ -0,0 +1,268 @@
+//
+//  BRThreadPool.c
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRThreadPool.h"
+#include "BRArray.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <assert.h>
+
+#define THREAD_POOL_MIN_SIZE 2 // so one slow task can't hold up every other task
+#define PRIORITY_COUNT       2
+
+typedef struct {
+    void (*task)(void *arg);
+    void *arg;
+    double queueTime;
+} BRThreadPoolTask;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    BRThreadPoolTask *tasks[PRIORITY_COUNT]; // fifo queue for each priority, tasks before head have been started
+    size_t head[PRIORITY_COUNT];
+    size_t size, threadCount, idleCount;
+    void *executorInfo;
+    void (*execute)(void *info, void (*task)(void *arg), void *arg, BRTaskPriority priority);
+    uint64_t taskCount[PRIORITY_COUNT];
+    double latencySum[PRIORITY_COUNT], maxLatency[PRIORITY_COUNT];
+} _pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL, NULL }, { 0, 0 }, 0, 0, 0, NULL, NULL,
+             { 0, 0 }, { 0, 0 }, { 0, 0 } };
+
+typedef struct {
+    void (*task)(void *arg, size_t i);
+    void *arg;
+    size_t count, next, done;
+    unsigned refCount;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} BRThreadPoolApplyInfo;
+
+inline static double _BRThreadPoolTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec/1000000;
+}
+
+// must be called with _pool.lock held
+static size_t _BRThreadPoolSize(void)
+{
+    long cpuCount;
+
+    if (_pool.size == 0) {
+        cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        _pool.size = (cpuCount > THREAD_POOL_MIN_SIZE) ? (size_t)cpuCount : THREAD_POOL_MIN_SIZE;
+    }
+
+    return _pool.size;
+}
+
+static void *_BRThreadPoolWorker(void *arg)
+{
+    BRThreadPoolTask task;
+    double latency;
+    size_t p;
+
+    pthread_mutex_lock(&_pool.lock);
+
+    for (;;) {
+        for (p = 0; p < PRIORITY_COUNT && (! _pool.tasks[p] || _pool.head[p] >= array_count(_pool.tasks[p])); p++);
+
+        if (p == PRIORITY_COUNT) { // nothing to do
+            _pool.idleCount++;
+            pthread_cond_wait(&_pool.cond, &_pool.lock);
+            _pool.idleCount--;
+            continue;
+        }
+
+        task = _pool.tasks[p][_pool.head[p]++];
+
+        if (_pool.head[p] == array_count(_pool.tasks[p])) { // queue is empty, reuse it from the start
+            array_clear(_pool.tasks[p]);
+            _pool.head[p] = 0;
+        }
+
+        latency = _BRThreadPoolTime() - task.queueTime;
+        _pool.taskCount[p]++;
+        _pool.latencySum[p] += latency;
+        if (latency > _pool.maxLatency[p]) _pool.maxLatency[p] = latency;
+        pthread_mutex_unlock(&_pool.lock);
+        task.task(task.arg);
+        pthread_mutex_lock(&_pool.lock);
+    }
+
+    return NULL; // detached threads don't need to return a value
+}
+
+// sets the maximum number of worker threads, the default is the number of cpu cores, with a minimum of two
+// workers are started as needed, lowering the size doesn't stop workers that are already running
+void BRThreadPoolSetSize(size_t threadCount)
+{
+    assert(threadCount > 0);
+    pthread_mutex_lock(&_pool.lock);
+    _pool.size = threadCount;
+    pthread_mutex_unlock(&_pool.lock);
+}
+
+// hands all tasks to a host supplied executor, for instance to run them on the host's own threads with whatever
+// priority and cpu affinity it needs, execute() must eventually call task(arg) exactly once, and must not call it
+// from within execute() itself, set execute to NULL to go back to using the library's own worker threads
+void BRThreadPoolSetExecutor(void *info, void (*execute)(void *info, void (*task)(void *arg), void *arg,
+                                                         BRTaskPriority priority))
+{
+    pthread_mutex_lock(&_pool.lock);
+    _pool.executorInfo = info;
+    _pool.execute = execute;
+    pthread_mutex_unlock(&_pool.lock);
+}
+
+// queues task(arg) to run on a worker thread, tasks of the same priority are started in the order they're queued
+// returns true on success, or false if the task couldn't be queued, in which case the caller should run it itself
+int BRThreadPoolRun(void (*task)(void *arg), void *arg, BRTaskPriority priority)
+{
+    void (*execute)(void *, void (*)(void *), void *, BRTaskPriority);
+    void *executorInfo;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int r = 1;
+
+    assert(task != NULL);
+    assert(priority == BRTaskPriorityHigh || priority == BRTaskPriorityLow);
+    pthread_mutex_lock(&_pool.lock);
+    execute = _pool.execute;
+    executorInfo = _pool.executorInfo;
+
+    if (! execute) {
+        if (! _pool.tasks[priority]) array_new(_pool.tasks[priority], 10);
+        array_add(_pool.tasks[priority], ((BRThreadPoolTask) { task, arg, _BRThreadPoolTime() }));
+
+        if (_pool.idleCount == 0 && _pool.threadCount < _BRThreadPoolSize()) { // start another worker
+            if (pthread_attr_init(&attr) == 0 && pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
+                pthread_create(&thread, &attr, _BRThreadPoolWorker, NULL) == 0) _pool.threadCount++;
+        }
+
+        if (_pool.threadCount == 0) { // no workers to run it
+            array_rm_last(_pool.tasks[priority]);
+            r = 0;
+        }
+        else pthread_cond_signal(&_pool.cond);
+    }
+
+    pthread_mutex_unlock(&_pool.lock);
+    if (execute) execute(executorInfo, task, arg, priority);
+    return r;
+}
+
+static void _BRThreadPoolApplyRelease(BRThreadPoolApplyInfo *info)
+{
+    unsigned refCount;
+
+    pthread_mutex_lock(&info->lock);
+    refCount = --info->refCount;
+    pthread_mutex_unlock(&info->lock);
+
+    if (refCount == 0) {
+        pthread_cond_destroy(&info->cond);
+        pthread_mutex_destroy(&info->lock);
+        free(info);
+    }
+}
+
+// claims and runs indexes until there are none left
+static void _BRThreadPoolApplyRun(BRThreadPoolApplyInfo *info)
+{
+    size_t i;
+
+    pthread_mutex_lock(&info->lock);
+
+    while (info->next < info->count) {
+        i = info->next++;
+        pthread_mutex_unlock(&info->lock);
+        info->task(info->arg, i);
+        pthread_mutex_lock(&info->lock);
+        if (++info->done == info->count) pthread_cond_broadcast(&info->cond);
+    }
+
+    pthread_mutex_unlock(&info->lock);
+}
+
+static void _BRThreadPoolApplyTask(void *arg)
+{
+    _BRThreadPoolApplyRun(arg);
+    _BRThreadPoolApplyRelease(arg);
+}
+
+// calls task(arg, i) for each i from 0 to count - 1 in parallel, using the pool's workers along with the calling
+// thread, and returns once they have all finished, it's safe to call from a task running on the pool
+void BRThreadPoolApply(void (*task)(void *arg, size_t i), void *arg, size_t count, BRTaskPriority priority)
+{
+    BRThreadPoolApplyInfo *info;
+    size_t i, helperCount;
+
+    assert(task != NULL);
+    if (count == 0) return;
+    if (count == 1) { task(arg, 0); return; }
+    info = calloc(1, sizeof(*info));
+    assert(info != NULL);
+    info->task = task;
+    info->arg = arg;
+    info->count = count;
+    info->refCount = 1;
+    pthread_mutex_init(&info->lock, NULL);
+    pthread_cond_init(&info->cond, NULL);
+    pthread_mutex_lock(&_pool.lock);
+    helperCount = _BRThreadPoolSize();
+    pthread_mutex_unlock(&_pool.lock);
+    if (helperCount > count - 1) helperCount = count - 1;
+
+    // helpers that start after all the work has been claimed just release info, the calling thread doesn't wait on
+    // them, so a busy pool can only slow things down to what the calling thread could do by itself
+    for (i = 0; i < helperCount; i++) {
+        pthread_mutex_lock(&info->lock);
+        info->refCount++;
+        pthread_mutex_unlock(&info->lock);
+        if (! BRThreadPoolRun(_BRThreadPoolApplyTask, info, priority)) { _BRThreadPoolApplyRelease(info); break; }
+    }
+
+    _BRThreadPoolApplyRun(info);
+    pthread_mutex_lock(&info->lock);
+    while (info->done < info->count) pthread_cond_wait(&info->cond, &info->lock);
+    pthread_mutex_unlock(&info->lock);
+    _BRThreadPoolApplyRelease(info);
+}
+
+// writes queue latency statistics for tasks of the given priority run on the library's own worker threads to stats
+void BRThreadPoolGetStats(BRTaskPriority priority, BRThreadPoolStats *stats)
+{
+    assert(priority == BRTaskPriorityHigh || priority == BRTaskPriorityLow);
+    assert(stats != NULL);
+    pthread_mutex_lock(&_pool.lock);
+    stats->taskCount = _pool.taskCount[priority];
+    stats->meanLatency = (_pool.taskCount[priority] > 0) ? _pool.latencySum[priority]/_pool.taskCount[priority] : 0;
+    stats->maxLatency = _pool.maxLatency[priority];
+    pthread_mutex_unlock(&_pool.lock);
+}
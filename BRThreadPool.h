@@ -0,0 +1,75 @@
+//
+//  BRThreadPool.h
+//
+//  Copyright (c) 2026 Litecoin Foundation
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRThreadPool_h
+#define BRThreadPool_h
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a library wide pool of worker threads for short tasks, like parsing and verification
+// long running loops, like a peer's socket thread, and calls that can block, like dns lookups, should still get their
+// own thread so they don't tie up a worker
+// workers never call the threadCleanup() callbacks of peers and peer managers, which only run on their own threads
+
+typedef enum {
+    BRTaskPriorityHigh = 0, // latency sensitive tasks, like network I/O, run before any queued low priority tasks
+    BRTaskPriorityLow = 1 // background tasks, like parsing and verification
+} BRTaskPriority;
+
+typedef struct {
+    uint64_t taskCount; // tasks started so far
+    double meanLatency; // average seconds a task waited in the queue before starting
+    double maxLatency;
+} BRThreadPoolStats;
+
+// sets the maximum number of worker threads, the default is the number of cpu cores, with a minimum of two
+// workers are started as needed, lowering the size doesn't stop workers that are already running
+void BRThreadPoolSetSize(size_t threadCount);
+
+// hands all tasks to a host supplied executor, for instance to run them on the host's own threads with whatever
+// priority and cpu affinity it needs, execute() must eventually call task(arg) exactly once, and must not call it
+// from within execute() itself, set execute to NULL to go back to using the library's own worker threads
+void BRThreadPoolSetExecutor(void *info, void (*execute)(void *info, void (*task)(void *arg), void *arg,
+                                                         BRTaskPriority priority));
+
+// queues task(arg) to run on a worker thread, tasks of the same priority are started in the order they're queued
+// returns true on success, or false if the task couldn't be queued, in which case the caller should run it itself
+int BRThreadPoolRun(void (*task)(void *arg), void *arg, BRTaskPriority priority);
+
+// calls task(arg, i) for each i from 0 to count - 1 in parallel, using the pool's workers along with the calling
+// thread, and returns once they have all finished, it's safe to call from a task running on the pool
+void BRThreadPoolApply(void (*task)(void *arg, size_t i), void *arg, size_t count, BRTaskPriority priority);
+
+// writes queue latency statistics for tasks of the given priority run on the library's own worker threads to stats
+void BRThreadPoolGetStats(BRTaskPriority priority, BRThreadPoolStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRThreadPool_h
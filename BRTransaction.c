@@ -26,6 +26,7 @@
 #include "BRKey.h"
 #include "BRAddress.h"
 #include "BRArray.h"
+#include "BRThreadPool.h"
 #include <stdlib.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -40,6 +41,9 @@
 #define SIGHASH_ANYONECANPAY 0x80 // let other people add inputs, I don't care where the rest of the bitcoins come from
 #define SIGHASH_FORKID       0x40 // use BIP143 digest method (for b-cash/b-gold signatures)
 
+#define PARSE_CHUNK_MIN      256 // don't split off a chunk of fewer tx than this, it would cost more than it saves
+#define SCRIPT_STORED        SIZE_MAX // array capacity marking a script kept in tx->scriptData, not its own allocation
+
 // returns a random number less than upperBound, for non-cryptographic use only
 uint32_t BRRand(uint32_t upperBound)
 {
@@ -58,11 +62,35 @@ uint32_t BRRand(uint32_t upperBound)
     return r % upperBound;
 }
 
+// frees a script or signature unless it's stored in the scriptData of the tx it belongs to
+static void _BRScriptFree(uint8_t *script)
+{
+    if (array_capacity(script) != SCRIPT_STORED) array_free(script);
+}
+
+// bytes used to store a script of scriptLen bytes in tx->scriptData, with its array header and alignment padding
+static size_t _BRScriptSlotSize(size_t scriptLen)
+{
+    return sizeof(size_t)*2 + (scriptLen + sizeof(size_t) - 1)/sizeof(size_t)*sizeof(size_t);
+}
+
+// copies script to a slot at data[*off] that has an array header, so array_count() still works on the stored script
+static uint8_t *_BRScriptStore(uint8_t *data, size_t *off, const uint8_t *script, size_t scriptLen)
+{
+    size_t *slot = (size_t *)&data[*off];
+
+    slot[0] = SCRIPT_STORED;
+    slot[1] = scriptLen;
+    if (scriptLen > 0) memcpy(&slot[2], script, scriptLen);
+    *off += _BRScriptSlotSize(scriptLen);
+    return (uint8_t *)&slot[2];
+}
+
 void BRTxInputSetAddress(BRTxInput *input, const char *address)
 {
     assert(input != NULL);
     assert(address == NULL || BRAddressIsValid(address));
-    if (input->script) array_free(input->script);
+    if (input->script) _BRScriptFree(input->script);
     input->script = NULL;
     input->scriptLen = 0;
     memset(input->address, 0, sizeof(input->address));
@@ -80,7 +108,7 @@ void BRTxInputSetScript(BRTxInput *input, const uint8_t *script, size_t scriptLe
 {
     assert(input != NULL);
     assert(script != NULL || scriptLen == 0);
-    if (input->script) array_free(input->script);
+    if (input->script) _BRScriptFree(input->script);
     input->script = NULL;
     input->scriptLen = 0;
     memset(input->address, 0, sizeof(input->address));
@@ -97,7 +125,7 @@ void BRTxInputSetSignature(BRTxInput *input, const uint8_t *signature, size_t si
 {
     assert(input != NULL);
     assert(signature != NULL || sigLen == 0);
-    if (input->signature) array_free(input->signature);
+    if (input->signature) _BRScriptFree(input->signature);
     input->signature = NULL;
     input->sigLen = 0;
     
@@ -135,7 +163,7 @@ void BRTxOutputSetAddress(BRTxOutput *output, const char *address)
 {
     assert(output != NULL);
     assert(address == NULL || BRAddressIsValid(address));
-    if (output->script) array_free(output->script);
+    if (output->script) _BRScriptFree(output->script);
     output->script = NULL;
     output->scriptLen = 0;
     memset(output->address, 0, sizeof(output->address));
@@ -152,7 +180,7 @@ void BRTxOutputSetAddress(BRTxOutput *output, const char *address)
 void BRTxOutputSetScript(BRTxOutput *output, const uint8_t *script, size_t scriptLen)
 {
     assert(output != NULL);
-    if (output->script) array_free(output->script);
+    if (output->script) _BRScriptFree(output->script);
     output->script = NULL;
     output->scriptLen = 0;
     memset(output->address, 0, sizeof(output->address));
@@ -321,6 +349,44 @@ static size_t _BRTransactionData(const BRTransaction *tx, uint8_t *data, size_t
     return (! data || off <= dataLen) ? off : 0;
 }
 
+// copies the scripts and signatures tx points to into tx->scriptData, a single allocation for the whole tx instead of
+// one per script, the buffers they were copied from are left to the caller
+static void _BRTransactionStoreScripts(BRTransaction *tx)
+{
+    size_t i, off = 0, len = 0;
+    uint8_t *data;
+
+    assert(tx->scriptData == NULL);
+
+    for (i = 0; i < tx->inCount; i++) {
+        if (tx->inputs[i].script) len += _BRScriptSlotSize(tx->inputs[i].scriptLen);
+        if (tx->inputs[i].signature) len += _BRScriptSlotSize(tx->inputs[i].sigLen);
+    }
+
+    for (i = 0; i < tx->outCount; i++) {
+        if (tx->outputs[i].script) len += _BRScriptSlotSize(tx->outputs[i].scriptLen);
+    }
+
+    if (len == 0) return;
+    array_new(data, len);
+    array_set_count(data, len);
+
+    for (i = 0; i < tx->inCount; i++) {
+        BRTxInput *input = &tx->inputs[i];
+
+        if (input->script) input->script = _BRScriptStore(data, &off, input->script, input->scriptLen);
+        if (input->signature) input->signature = _BRScriptStore(data, &off, input->signature, input->sigLen);
+    }
+
+    for (i = 0; i < tx->outCount; i++) {
+        BRTxOutput *output = &tx->outputs[i];
+
+        if (output->script) output->script = _BRScriptStore(data, &off, output->script, output->scriptLen);
+    }
+
+    tx->scriptData = data;
+}
+
 // returns a newly allocated empty transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionNew(void)
 {
@@ -332,6 +398,7 @@ BRTransaction *BRTransactionNew(void)
     array_new(tx->outputs, 2);
     tx->lockTime = TX_LOCKTIME;
     tx->blockHeight = TX_UNCONFIRMED;
+    tx->refCount = 1;
     return tx;
 }
 
@@ -346,21 +413,26 @@ BRTransaction *BRTransactionCopy(const BRTransaction *tx)
     *cpy = *tx;
     cpy->inputs = inputs;
     cpy->outputs = outputs;
-    cpy->inCount = cpy->outCount = 0;
-
-    for (size_t i = 0; i < tx->inCount; i++) {
-        BRTransactionAddInput(cpy, tx->inputs[i].txHash, tx->inputs[i].index, tx->inputs[i].amount,
-                              tx->inputs[i].script, tx->inputs[i].scriptLen,
-                              tx->inputs[i].signature, tx->inputs[i].sigLen, tx->inputs[i].sequence);
-    }
-    
-    for (size_t i = 0; i < tx->outCount; i++) {
-        BRTransactionAddOutput(cpy, tx->outputs[i].amount, tx->outputs[i].script, tx->outputs[i].scriptLen);
-    }
-
+    cpy->scriptData = NULL;
+    cpy->refCount = 1;
+    array_set_capacity(cpy->inputs, tx->inCount);
+    array_add_array(cpy->inputs, tx->inputs, tx->inCount);
+    array_set_capacity(cpy->outputs, tx->outCount);
+    array_add_array(cpy->outputs, tx->outputs, tx->outCount);
+    _BRTransactionStoreScripts(cpy); // the copied inputs and outputs still point to the scripts of tx until now
     return cpy;
 }
 
+// adds a reference to tx and returns it, so it can be shared instead of copied, each reference must be released by
+// calling BRTransactionFree(), and tx shouldn't be modified while it's shared, other than its block height/timestamp
+BRTransaction *BRTransactionRetain(BRTransaction *tx)
+{
+    assert(tx != NULL);
+    assert(tx->refCount > 0);
+    __atomic_add_fetch(&tx->refCount, 1, __ATOMIC_RELAXED);
+    return tx;
+}
+
 // buf must contain a serialized tx
 // retruns a transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
@@ -389,13 +461,20 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
         sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
         off += len;
         
+        // scripts point into buf until they're all stored together below
         if (off + sLen <= bufLen && BRAddressFromScriptPubKey(NULL, 0, &buf[off], sLen) > 0) {
-            BRTxInputSetScript(input, &buf[off], sLen);
+            input->script = (uint8_t *)&buf[off];
+            input->scriptLen = sLen;
+            BRAddressFromScriptPubKey(input->address, sizeof(input->address), &buf[off], sLen);
             input->amount = (off + sLen + sizeof(uint64_t) <= bufLen) ? UInt64GetLE(&buf[off + sLen]) : 0;
             off += sizeof(uint64_t);
             isSigned = 0;
         }
-        else if (off + sLen <= bufLen) BRTxInputSetSignature(input, &buf[off], sLen);
+        else if (off + sLen <= bufLen) {
+            input->signature = (uint8_t *)&buf[off];
+            input->sigLen = sLen;
+            BRAddressFromScriptSig(input->address, sizeof(input->address), &buf[off], sLen);
+        }
         
         off += sLen;
         input->sequence = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
@@ -412,13 +491,20 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
         off += sizeof(uint64_t);
         sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
         off += len;
-        if (off + sLen <= bufLen) BRTxOutputSetScript(output, &buf[off], sLen);
+
+        if (off + sLen <= bufLen) {
+            output->script = (uint8_t *)&buf[off];
+            output->scriptLen = sLen;
+            BRAddressFromScriptPubKey(output->address, sizeof(output->address), &buf[off], sLen);
+        }
+
         off += sLen;
     }
     
     tx->lockTime = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
     off += sizeof(uint32_t);
-    
+    _BRTransactionStoreScripts(tx);
+
     if (tx->inCount == 0 || off > bufLen) {
         BRTransactionFree(tx);
         tx = NULL;
@@ -428,6 +514,107 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
     return tx;
 }
 
+// returns the number of bytes in the serialized tx at the start of buf without parsing it, or 0 if buf doesn't contain
+// a complete tx, useful for finding where each tx starts in a serialized block
+size_t BRTransactionParseLength(const uint8_t *buf, size_t bufLen)
+{
+    size_t i, count, sLen, off = sizeof(uint32_t), len = 0;
+    
+    assert(buf != NULL || bufLen == 0);
+    if (! buf || off > bufLen) return 0;
+    count = (size_t)BRVarInt(&buf[off], bufLen - off, &len);
+    off += len;
+    if (count == 0) return 0; // no inputs, or a segwit marker, neither of which is valid here
+    
+    for (i = 0; off <= bufLen && i < count; i++) { // prevout hash and index, script, sequence
+        off += sizeof(UInt256) + sizeof(uint32_t);
+        sLen = (size_t)BRVarInt(&buf[(off <= bufLen) ? off : bufLen], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        off = (off <= bufLen && sLen <= bufLen - off) ? off + sLen + sizeof(uint32_t) : bufLen + 1;
+    }
+    
+    count = (off <= bufLen) ? (size_t)BRVarInt(&buf[off], bufLen - off, &len) : 0;
+    off += len;
+    
+    for (i = 0; off <= bufLen && i < count; i++) { // amount, script
+        off += sizeof(uint64_t);
+        sLen = (size_t)BRVarInt(&buf[(off <= bufLen) ? off : bufLen], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        off = (off <= bufLen && sLen <= bufLen - off) ? off + sLen : bufLen + 1;
+    }
+    
+    off += sizeof(uint32_t); // lockTime
+    return (off <= bufLen) ? off : 0;
+}
+
+typedef struct {
+    BRTransaction **txs;
+    UInt256 *txHashes;
+    const uint8_t *buf;
+    const size_t *offsets;
+    size_t count;
+} BRTxParseChunk;
+
+static void _BRTransactionParseChunk(void *info, size_t i)
+{
+    BRTxParseChunk *chunk = &((BRTxParseChunk *)info)[i];
+    
+    for (size_t i = 0; i < chunk->count; i++) {
+        const uint8_t *buf = &chunk->buf[chunk->offsets[i]];
+        size_t len = chunk->offsets[i + 1] - chunk->offsets[i];
+        BRTransaction *tx = BRTransactionParse(buf, len);
+        
+        if (tx && UInt256IsZero(tx->txHash)) BRSHA256_2(&tx->txHash, buf, len);
+        if (chunk->txHashes && tx) chunk->txHashes[i] = tx->txHash;
+        else if (chunk->txHashes) BRSHA256_2(&chunk->txHashes[i], buf, len);
+        chunk->txs[i] = tx;
+    }
+}
+
+// parses count serialized tx stored back to back in buf, like in a block message, and writes them to txs[] in order
+// the tx boundaries are found with BRTransactionParseLength(), then the tx are parsed and hashed in up to threadCount
+// parallel chunks on the library thread pool, and if txHashes isn't NULL, each tx hash is written to txHashes[]
+// txs[i] is NULL for a tx that couldn't be parsed, but txHashes[i] is still set so the merkle root can be checked
+// returns the number of bytes parsed, or 0 if buf doesn't contain count complete tx, in which case nothing is parsed
+// each tx in txs[] must be freed by calling BRTransactionFree()
+size_t BRTransactionParseMany(BRTransaction *txs[], UInt256 txHashes[], size_t count, const uint8_t *buf,
+                              size_t bufLen, size_t threadCount)
+{
+    size_t i, j, n, len, off = 0, *offsets;
+    
+    assert(txs != NULL || count == 0);
+    assert(buf != NULL || bufLen == 0);
+    if (count == 0 || ! buf || count > bufLen/60) return 0; // a tx is at least 60 bytes
+    offsets = malloc((count + 1)*sizeof(*offsets));
+    assert(offsets != NULL);
+    
+    for (i = 0; off <= bufLen && i < count; i++) { // quick scan for where each tx starts
+        offsets[i] = off;
+        len = BRTransactionParseLength(&buf[off], bufLen - off);
+        off = (len > 0) ? off + len : bufLen + 1;
+    }
+    
+    offsets[count] = off;
+    
+    if (off <= bufLen) {
+        if (threadCount > count/PARSE_CHUNK_MIN) threadCount = count/PARSE_CHUNK_MIN;
+        if (threadCount < 1) threadCount = 1;
+
+        BRTxParseChunk chunks[threadCount];
+        
+        for (i = 0, j = 0; i < threadCount; i++, j += n) { // chunk i covers tx j to j + n - 1
+            n = count/threadCount + ((i < count % threadCount) ? 1 : 0);
+            chunks[i] = (BRTxParseChunk) { &txs[j], (txHashes) ? &txHashes[j] : NULL, buf, &offsets[j], n };
+        }
+        
+        BRThreadPoolApply(_BRTransactionParseChunk, chunks, threadCount, BRTaskPriorityLow);
+    }
+    else off = 0;
+    
+    free(offsets);
+    return off;
+}
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
 // (tx->blockHeight and tx->timestamp are not serialized)
 size_t BRTransactionSerialize(const BRTransaction *tx, uint8_t *buf, size_t bufLen)
@@ -513,6 +700,30 @@ size_t BRTransactionSize(const BRTransaction *tx)
     return size;
 }
 
+// heap bytes used by a script or signature that has its own allocation, stored ones are counted with tx->scriptData
+static size_t _BRScriptMemorySize(const uint8_t *script)
+{
+    return (script && array_capacity(script) != SCRIPT_STORED) ? sizeof(size_t)*2 + array_capacity(script) : 0;
+}
+
+// bytes of heap memory held by tx, including its inputs, outputs, scripts and signatures, but not allocator overhead
+size_t BRTransactionMemorySize(const BRTransaction *tx)
+{
+    size_t size;
+
+    assert(tx != NULL);
+    size = sizeof(*tx) + sizeof(size_t)*2 + array_capacity(tx->inputs)*sizeof(*tx->inputs) + sizeof(size_t)*2 +
+           array_capacity(tx->outputs)*sizeof(*tx->outputs);
+    if (tx->scriptData) size += sizeof(size_t)*2 + array_capacity(tx->scriptData);
+
+    for (size_t i = 0; i < tx->inCount; i++) {
+        size += _BRScriptMemorySize(tx->inputs[i].script) + _BRScriptMemorySize(tx->inputs[i].signature);
+    }
+
+    for (size_t i = 0; i < tx->outCount; i++) size += _BRScriptMemorySize(tx->outputs[i].script);
+    return size;
+}
+
 // minimum transaction fee needed for tx to relay across the bitcoin network
 uint64_t BRTransactionStandardFee(const BRTransaction *tx)
 {
@@ -606,12 +817,14 @@ int BRTransactionIsStandard(const BRTransaction *tx)
     return r;
 }
 
-// frees memory allocated for tx
+// releases a reference to tx, and frees memory allocated for tx once the last reference is released
 void BRTransactionFree(BRTransaction *tx)
 {
     assert(tx != NULL);
+    assert(! tx || tx->refCount > 0);
     
-    if (tx) {
+    // acquire-release so any other thread that held a reference is done with tx before it's freed
+    if (tx && __atomic_sub_fetch(&tx->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
         for (size_t i = 0; i < tx->inCount; i++) {
             BRTxInputSetScript(&tx->inputs[i], NULL, 0);
             BRTxInputSetSignature(&tx->inputs[i], NULL, 0);
@@ -621,6 +834,7 @@ void BRTransactionFree(BRTransaction *tx)
             BRTxOutputSetScript(&tx->outputs[i], NULL, 0);
         }
 
+        if (tx->scriptData) array_free(tx->scriptData);
         array_free(tx->outputs);
         array_free(tx->inputs);
         free(tx);
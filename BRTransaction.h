@@ -93,6 +93,8 @@ typedef struct {
     uint32_t lockTime;
     uint32_t blockHeight;
     uint32_t timestamp; // time interval since unix epoch
+    uint8_t *scriptData; // parsed or copied scripts and signatures, stored in a single allocation instead of one each
+    unsigned refCount; // references held to tx, changed with BRTransactionRetain() and BRTransactionFree()
 } BRTransaction;
 
 // returns a newly allocated empty transaction that must be freed by calling BRTransactionFree()
@@ -101,10 +103,27 @@ BRTransaction *BRTransactionNew(void);
 // returns a deep copy of tx and that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionCopy(const BRTransaction *tx);
 
+// adds a reference to tx and returns it, so it can be shared instead of copied, each reference must be released by
+// calling BRTransactionFree(), and tx shouldn't be modified while it's shared, other than its block height/timestamp
+BRTransaction *BRTransactionRetain(BRTransaction *tx);
+
 // buf must contain a serialized tx
 // retruns a transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen);
 
+// returns the number of bytes in the serialized tx at the start of buf without parsing it, or 0 if buf doesn't contain
+// a complete tx, useful for finding where each tx starts in a serialized block
+size_t BRTransactionParseLength(const uint8_t *buf, size_t bufLen);
+
+// parses count serialized tx stored back to back in buf, like in a block message, and writes them to txs[] in order
+// the tx boundaries are found with BRTransactionParseLength(), then the tx are parsed and hashed in up to threadCount
+// parallel chunks on the library thread pool, and if txHashes isn't NULL, each tx hash is written to txHashes[]
+// txs[i] is NULL for a tx that couldn't be parsed, but txHashes[i] is still set so the merkle root can be checked
+// returns the number of bytes parsed, or 0 if buf doesn't contain count complete tx, in which case nothing is parsed
+// each tx in txs[] must be freed by calling BRTransactionFree()
+size_t BRTransactionParseMany(BRTransaction *txs[], UInt256 txHashes[], size_t count, const uint8_t *buf,
+                              size_t bufLen, size_t threadCount);
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
 // (tx->blockHeight and tx->timestamp are not serialized)
 size_t BRTransactionSerialize(const BRTransaction *tx, uint8_t *buf, size_t bufLen);
@@ -123,6 +142,9 @@ void BRTransactionShuffleOutputs(BRTransaction *tx);
 // size in bytes if signed, or estimated size assuming compact pubkey sigs
 size_t BRTransactionSize(const BRTransaction *tx);
 
+// bytes of heap memory held by tx, including its inputs, outputs, scripts and signatures, but not allocator overhead
+size_t BRTransactionMemorySize(const BRTransaction *tx);
+
 // minimum transaction fee needed for tx to relay across the bitcoin network
 uint64_t BRTransactionStandardFee(const BRTransaction *tx);
 
@@ -149,7 +171,7 @@ inline static int BRTransactionEq(const void *tx, const void *otherTx)
     return (tx == otherTx || UInt256Eq(((const BRTransaction *)tx)->txHash, ((const BRTransaction *)otherTx)->txHash));
 }
 
-// frees memory allocated for tx
+// releases a reference to tx, and frees memory allocated for tx once the last reference is released
 void BRTransactionFree(BRTransaction *tx);
 
 #ifdef __cplusplus
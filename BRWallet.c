@@ -24,7 +24,9 @@
 
 #include "BRWallet.h"
 #include "BRSet.h"
+#include "BRConcurrentSet.h"
 #include "BRAddress.h"
+#include "BRBase58.h"
 #include "BRArray.h"
 #include <stdlib.h>
 #include <inttypes.h>
@@ -33,6 +35,8 @@
 #include <pthread.h>
 #include <assert.h>
 
+#define ADDRESS_BATCH_SIZE 64 // addresses derived and hashed together by BRWalletUnusedAddrs()
+
 struct BRWalletStruct {
     uint64_t balance, totalSent, totalReceived, feePerKb, *balanceHist;
     uint32_t blockHeight;
@@ -41,6 +45,7 @@ struct BRWalletStruct {
     BRMasterPubKey masterPubKey;
     BRAddress *internalChain, *externalChain;
     BRSet *allTx, *invalidTx, *pendingTx, *spentOutputs, *usedAddrs, *allAddrs;
+    BRConcurrentSet *allTxHashes, *allAddrKeys; // copies of allTx hashes and allAddrs for lookups without the lock
     void *callbackInfo;
     void (*balanceChanged)(void *info, uint64_t balance);
     void (*txAdded)(void *info, BRTransaction *tx);
@@ -57,6 +62,15 @@ inline static uint64_t _txFee(uint64_t feePerKb, size_t size)
     return (fee > standardFee) ? fee : standardFee;
 }
 
+// zero padded copy of addr, so equal addresses are equal allAddrKeys keys
+inline static BRAddress _addrKey(const char *addr)
+{
+    BRAddress key = BR_ADDRESS_NONE;
+
+    strncpy(key.s, addr, sizeof(key.s) - 1);
+    return key;
+}
+
 // chain position of first tx output address that appears in chain
 inline static size_t _txChainIndex(const BRTransaction *tx, const BRAddress *addrChain)
 {
@@ -148,16 +162,31 @@ static int _BRWalletContainsTx(BRWallet *wallet, const BRTransaction *tx)
 //    return r;
 //}
 
+// keeps utxos that aren't in the spent output set, and subtracts the amount of each spent one from the balance
+static int _BRWalletUTXOIsUnspent(void *info, const BRUTXO *utxo)
+{
+    BRWallet *wallet = ((void **)info)[0];
+    uint64_t *balance = ((void **)info)[1];
+    BRTransaction *t;
+
+    if (! BRSetContains(wallet->spentOutputs, utxo)) return 1;
+    t = BRSetGet(wallet->allTx, &utxo->hash);
+    *balance -= t->outputs[utxo->n].amount;
+    return 0;
+}
+
 static void _BRWalletUpdateBalance(BRWallet *wallet)
 {
     int isInvalid, isPending;
     uint64_t balance = 0, prevBalance = 0;
     time_t now = time(NULL);
     size_t i, j;
-    BRTransaction *tx, *t;
+    BRTransaction *tx;
+    void *unspentInfo[] = { wallet, &balance };
     
     array_clear(wallet->utxos);
     array_clear(wallet->balanceHist);
+    array_reserve(wallet->balanceHist, array_count(wallet->transactions));
     BRSetClear(wallet->spentOutputs);
     BRSetClear(wallet->invalidTx);
     BRSetClear(wallet->pendingTx);
@@ -227,12 +256,8 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
         }
 
         // transaction ordering is not guaranteed, so check the entire UTXO set against the entire spent output set
-        for (j = array_count(wallet->utxos); j > 0; j--) {
-            if (! BRSetContains(wallet->spentOutputs, &wallet->utxos[j - 1])) continue;
-            t = BRSetGet(wallet->allTx, &wallet->utxos[j - 1].hash);
-            balance -= t->outputs[wallet->utxos[j - 1].n].amount;
-            array_rm(wallet->utxos, j - 1);
-        }
+        // spent utxos are removed in one compacting pass, keeping the rest in order for coin selection
+        array_filter(wallet->utxos, unspentInfo, _BRWalletUTXOIsUnspent);
         
         if (prevBalance < balance) wallet->totalReceived += balance - prevBalance;
         if (balance < prevBalance) wallet->totalSent += prevBalance - balance;
@@ -266,12 +291,15 @@ BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPub
     wallet->spentOutputs = BRSetNew(BRUTXOHash, BRUTXOEq, txCount + 100);
     wallet->usedAddrs = BRSetNew(BRAddressHash, BRAddressEq, txCount + 100);
     wallet->allAddrs = BRSetNew(BRAddressHash, BRAddressEq, txCount + 100);
+    wallet->allTxHashes = BRConcurrentSetNew(sizeof(UInt256), txCount + 100);
+    wallet->allAddrKeys = BRConcurrentSetNew(sizeof(BRAddress), txCount + 100);
     pthread_mutex_init(&wallet->lock, NULL);
 
     for (size_t i = 0; transactions && i < txCount; i++) {
         tx = transactions[i];
         if (! BRTransactionIsSigned(tx) || BRSetContains(wallet->allTx, tx)) continue;
         BRSetAdd(wallet->allTx, tx);
+        BRConcurrentSetAdd(wallet->allTxHashes, &tx->txHash);
         _BRWalletInsertTx(wallet, tx);
 
         for (size_t j = 0; j < tx->outCount; j++) {
@@ -336,16 +364,33 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
     while (i > 0 && ! BRSetContains(wallet->usedAddrs, &addrChain[i - 1])) i--;
     
     while (i + gapLimit > count) { // generate new addresses up to gapLimit
+        size_t k, n = (i + gapLimit - count < ADDRESS_BATCH_SIZE) ? i + gapLimit - count : ADDRESS_BATCH_SIZE, len;
         BRKey key;
-        BRAddress address = BR_ADDRESS_NONE;
-        uint8_t pubKey[BRBIP32PubKey(NULL, 0, wallet->masterPubKey, chain, count)];
-        size_t len = BRBIP32PubKey(pubKey, sizeof(pubKey), wallet->masterPubKey, chain, (uint32_t)count);
+        BRAddress address;
+        uint8_t pubKeys[n*sizeof(BRECPoint)], hashes[n*sizeof(UInt160)], data[1 + sizeof(UInt160)];
         
-        if (! BRKeySetPubKey(&key, pubKey, len)) break;
-        if (! BRKeyAddress(&key, address.s, sizeof(address)) || BRAddressEq(&address, &BR_ADDRESS_NONE)) break;
-        array_add(addrChain, address);
-        count++;
-        if (BRSetContains(wallet->usedAddrs, &address)) i = count;
+        for (k = 0; k < n; k++) { // derive the next n public keys so they can be hashed together
+            len = BRBIP32PubKey(&pubKeys[k*sizeof(BRECPoint)], sizeof(BRECPoint), wallet->masterPubKey, chain,
+                                (uint32_t)(count + k));
+            if (! BRKeySetPubKey(&key, &pubKeys[k*sizeof(BRECPoint)], len)) break;
+        }
+        
+        BRHash160Batch(hashes, pubKeys, sizeof(BRECPoint), k);
+        data[0] = BITCOIN_PUBKEY_ADDRESS;
+#if BITCOIN_TESTNET
+        data[0] = BITCOIN_PUBKEY_ADDRESS_TEST;
+#endif
+        
+        for (len = k, k = 0; k < len; k++) {
+            address = BR_ADDRESS_NONE;
+            memcpy(&data[1], &hashes[k*sizeof(UInt160)], sizeof(UInt160));
+            if (! BRBase58CheckEncode(address.s, sizeof(address), data, sizeof(data))) break;
+            array_add(addrChain, address);
+            count++;
+            if (BRSetContains(wallet->usedAddrs, &address)) i = count;
+        }
+        
+        if (k < n) break; // key derivation or address encoding failed
     }
 
     if (addrs && i + gapLimit <= count) {
@@ -374,6 +419,9 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
         }
     }
 
+    // allAddrKeys holds copies, so only new addresses are added, and chain addresses are already zero padded
+    for (i = startCount; i < count; i++) BRConcurrentSetAdd(wallet->allAddrKeys, &addrChain[i]);
+
     pthread_mutex_unlock(&wallet->lock);
     return j;
 }
@@ -421,6 +469,23 @@ size_t BRWalletTransactions(BRWallet *wallet, BRTransaction *transactions[], siz
     return txCount;
 }
 
+static void _BRWalletAddTxMemorySize(void *info, void *tx)
+{
+    *(size_t *)info += BRTransactionMemorySize(tx);
+}
+
+// returns the bytes of heap memory held by all transactions registered in the wallet, see BRTransactionMemorySize()
+size_t BRWalletTransactionsMemorySize(BRWallet *wallet)
+{
+    size_t size = 0;
+
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    BRSetApply(wallet->allTx, &size, _BRWalletAddTxMemorySize);
+    pthread_mutex_unlock(&wallet->lock);
+    return size;
+}
+
 // writes transactions registered in the wallet, and that were unconfirmed before blockHeight, to the transactions array
 // returns the number of transactions written, or total number available if transactions is NULL
 size_t BRWalletTxUnconfirmedBefore(BRWallet *wallet, BRTransaction *transactions[], size_t txCount,
@@ -495,6 +560,21 @@ BRAddress BRWalletReceiveAddress(BRWallet *wallet)
     return addr;
 }
 
+// returns the number of addresses on the internal or external chain up to and including the last used one
+size_t BRWalletUsedAddrCount(BRWallet *wallet, int internal)
+{
+    BRAddress *addrChain;
+    size_t i;
+
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    addrChain = (internal) ? wallet->internalChain : wallet->externalChain;
+    i = array_count(addrChain);
+    while (i > 0 && ! BRSetContains(wallet->usedAddrs, &addrChain[i - 1])) i--;
+    pthread_mutex_unlock(&wallet->lock);
+    return i;
+}
+
 // writes all addresses previously genereated with BRWalletUnusedAddrs() to addrs
 // returns the number addresses written, or total number available if addrs is NULL
 size_t BRWalletAllAddrs(BRWallet *wallet, BRAddress addrs[], size_t addrsCount)
@@ -522,16 +602,16 @@ size_t BRWalletAllAddrs(BRWallet *wallet, BRAddress addrs[], size_t addrsCount)
 }
 
 // true if the address was previously generated by BRWalletUnusedAddrs() (even if it's now used)
+// doesn't take the wallet lock, so it's safe to call from any thread while the wallet is being updated
 int BRWalletContainsAddress(BRWallet *wallet, const char *addr)
 {
-    int r = 0;
+    BRAddress key;
 
     assert(wallet != NULL);
     assert(addr != NULL);
-    pthread_mutex_lock(&wallet->lock);
-    if (addr) r = BRSetContains(wallet->allAddrs, addr);
-    pthread_mutex_unlock(&wallet->lock);
-    return r;
+    if (! addr) return 0;
+    key = _addrKey(addr);
+    return BRConcurrentSetContains(wallet->allAddrKeys, &key);
 }
 
 // true if the address was previously used as an output in any wallet transaction
@@ -709,7 +789,9 @@ int BRWalletContainsTransaction(BRWallet *wallet, const BRTransaction *tx)
     return r;
 }
 
-// adds a transaction to the wallet, or returns false if it isn't associated with the wallet
+// adds a transaction to the wallet, or returns false if it isn't associated with the wallet or is already registered
+// on success the wallet takes over the caller's reference to tx, which may still be passed to BRPeerManagerPublishTx(),
+// before or after registering, since the publish list keeps its own reference, on failure the caller keeps it
 int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx)
 {
     int wasAdded = 0, r = 1;
@@ -726,17 +808,22 @@ int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx)
                 // TODO: handle tx replacement with input sequence numbers
                 //       (for now, replacements appear invalid until confirmation)
                 BRSetAdd(wallet->allTx, tx);
+                BRConcurrentSetAdd(wallet->allTxHashes, &tx->txHash);
                 _BRWalletInsertTx(wallet, tx);
                 _BRWalletUpdateBalance(wallet);
                 wasAdded = 1;
             }
             else { // keep track of unconfirmed non-wallet tx for invalid tx checks and child-pays-for-parent fees
                    // BUG: limit total non-wallet unconfirmed tx to avoid memory exhaustion attack
-                if (tx->blockHeight == TX_UNCONFIRMED) BRSetAdd(wallet->allTx, tx);
+                   // the wallet holds its own reference, since the caller keeps theirs when returning false
+                if (tx->blockHeight == TX_UNCONFIRMED) {
+                    BRSetAdd(wallet->allTx, BRTransactionRetain(tx));
+                    BRConcurrentSetAdd(wallet->allTxHashes, &tx->txHash);
+                }
                 r = 0;
-                // BUG: XXX memory leak if tx is not added to wallet->allTx, and we can't just free it
             }
         }
+        else r = 0; // already registered, the caller keeps its reference to tx
     
         pthread_mutex_unlock(&wallet->lock);
     }
@@ -791,6 +878,7 @@ void BRWalletRemoveTransaction(BRWallet *wallet, UInt256 txHash)
         }
         else {
             BRSetRemove(wallet->allTx, tx);
+            BRConcurrentSetRemove(wallet->allTxHashes, &tx->txHash);
             
             for (size_t i = array_count(wallet->transactions); i > 0; i--) {
                 if (! BRTransactionEq(wallet->transactions[i - 1], tx)) continue;
@@ -836,6 +924,15 @@ BRTransaction *BRWalletTransactionForHash(BRWallet *wallet, UInt256 txHash)
     return tx;
 }
 
+// true if a transaction with the given hash has been registered in the wallet, or is an unconfirmed non-wallet tx the
+// wallet is tracking, same as BRWalletTransactionForHash() != NULL, but doesn't take the wallet lock
+int BRWalletContainsTxHash(BRWallet *wallet, UInt256 txHash)
+{
+    assert(wallet != NULL);
+    assert(! UInt256IsZero(txHash));
+    return BRConcurrentSetContains(wallet->allTxHashes, &txHash);
+}
+
 // true if no previous wallet transaction spends any of the given transaction's inputs, and no inputs are invalid
 int BRWalletTransactionIsValid(BRWallet *wallet, const BRTransaction *tx)
 {
@@ -962,6 +1059,7 @@ void BRWalletUpdateTransactions(BRWallet *wallet, const UInt256 txHashes[], size
         }
         else if (blockHeight != TX_UNCONFIRMED) { // remove and free confirmed non-wallet tx
             BRSetRemove(wallet->allTx, tx);
+            BRConcurrentSetRemove(wallet->allTxHashes, &tx->txHash);
             BRTransactionFree(tx);
         }
     }
@@ -1168,25 +1266,28 @@ uint64_t BRWalletMaxOutputAmount(BRWallet *wallet)
     return (amount > fee) ? amount - fee : 0;
 }
 
+static void _BRWalletFreeTx(void *info, void *tx)
+{
+    BRTransactionFree(tx);
+}
+
 // frees memory allocated for wallet, and calls BRTransactionFree() for all registered transactions
 void BRWalletFree(BRWallet *wallet)
 {
     assert(wallet != NULL);
     pthread_mutex_lock(&wallet->lock);
     BRSetFree(wallet->allAddrs);
+    BRConcurrentSetFree(wallet->allAddrKeys);
     BRSetFree(wallet->usedAddrs);
+    BRSetApply(wallet->allTx, NULL, _BRWalletFreeTx); // wallet tx, and any unconfirmed non-wallet tx being tracked
     BRSetFree(wallet->allTx);
+    BRConcurrentSetFree(wallet->allTxHashes);
     BRSetFree(wallet->invalidTx);
     BRSetFree(wallet->pendingTx);
     BRSetFree(wallet->spentOutputs);
     array_free(wallet->internalChain);
     array_free(wallet->externalChain);
     array_free(wallet->balanceHist);
-
-    for (size_t i = array_count(wallet->transactions); i > 0; i--) {
-        BRTransactionFree(wallet->transactions[i - 1]);
-    }
-
     array_free(wallet->transactions);
     array_free(wallet->utxos);
     pthread_mutex_unlock(&wallet->lock);
@@ -86,11 +86,15 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
 // returns the first unused external address
 BRAddress BRWalletReceiveAddress(BRWallet *wallet);
 
+// returns the number of addresses on the internal or external chain up to and including the last used one
+size_t BRWalletUsedAddrCount(BRWallet *wallet, int internal);
+
 // writes all addresses previously genereated with BRWalletUnusedAddrs() to addrs
 // returns the number addresses written, or total number available if addrs is NULL
 size_t BRWalletAllAddrs(BRWallet *wallet, BRAddress addrs[], size_t addrsCount);
 
 // true if the address was previously generated by BRWalletUnusedAddrs() (even if it's now used)
+// doesn't take the wallet lock, so it's safe to call from any thread while the wallet is being updated
 int BRWalletContainsAddress(BRWallet *wallet, const char *addr);
 
 // true if the address was previously used as an input or output in any wallet transaction
@@ -100,6 +104,9 @@ int BRWalletAddressIsUsed(BRWallet *wallet, const char *addr);
 // returns the number of transactions written, or total number available if transactions is NULL
 size_t BRWalletTransactions(BRWallet *wallet, BRTransaction *transactions[], size_t txCount);
 
+// returns the bytes of heap memory held by all transactions registered in the wallet, see BRTransactionMemorySize()
+size_t BRWalletTransactionsMemorySize(BRWallet *wallet);
+
 // writes transactions registered in the wallet, and that were unconfirmed before blockHeight, to the transactions array
 // returns the number of transactions written, or total number available if transactions is NULL
 size_t BRWalletTxUnconfirmedBefore(BRWallet *wallet, BRTransaction *transactions[], size_t txCount,
@@ -138,7 +145,9 @@ int BRWalletSignTransaction(BRWallet *wallet, BRTransaction *tx, int forkId, con
 // true if the given transaction is associated with the wallet (even if it hasn't been registered)
 int BRWalletContainsTransaction(BRWallet *wallet, const BRTransaction *tx);
 
-// adds a transaction to the wallet, or returns false if it isn't associated with the wallet
+// adds a transaction to the wallet, or returns false if it isn't associated with the wallet or is already registered
+// on success the wallet takes over the caller's reference to tx, which may still be passed to BRPeerManagerPublishTx(),
+// before or after registering, since the publish list keeps its own reference, on failure the caller keeps it
 int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx);
 
 // removes a tx from the wallet and calls BRTransactionFree() on it, along with any tx that depend on its outputs
@@ -147,6 +156,10 @@ void BRWalletRemoveTransaction(BRWallet *wallet, UInt256 txHash);
 // returns the transaction with the given hash if it's been registered in the wallet
 BRTransaction *BRWalletTransactionForHash(BRWallet *wallet, UInt256 txHash);
 
+// true if a transaction with the given hash has been registered in the wallet, or is an unconfirmed non-wallet tx the
+// wallet is tracking, same as BRWalletTransactionForHash() != NULL, but doesn't take the wallet lock
+int BRWalletContainsTxHash(BRWallet *wallet, UInt256 txHash);
+
 // true if no previous wallet transaction spends any of the given transaction's inputs, and no inputs are invalid
 int BRWalletTransactionIsValid(BRWallet *wallet, const BRTransaction *tx);
 
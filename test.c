@@ -24,6 +24,7 @@
 
 #include "BRCrypto.h"
 #include "BRBloomFilter.h"
+#include "BRScriptMatcher.h"
 #include "BRMerkleBlock.h"
 #include "BRWallet.h"
 #include "BRKey.h"
@@ -40,6 +41,10 @@
 #include "BRInt.h"
 #include "BRArray.h"
 #include "BRSet.h"
+#include "BRConcurrentSet.h"
+#include "BRQueue.h"
+#include "BRCompletionQueue.h"
+#include "BRThreadPool.h"
 #include "BRTransaction.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +53,9 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 
 #define SKIP_BIP38 1
@@ -114,6 +122,11 @@ int BRIntsTests()
     return r;
 }
 
+inline static int _keep_odd(void *info, const int *i)
+{
+    return (*i % 2 != 0);
+}
+
 int BRArrayTests()
 {
     int r = 1;
@@ -160,8 +173,53 @@ int BRArrayTests()
     array_clear(a);                 // [ ]
     if (array_count(a) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: array_clear() test\n", __func__);
 
+    array_add_array(a, b, 3);       // [ 1, 2, 3 ]
+    array_add_array(a, c, 2);       // [ 1, 2, 3, 3, 2 ]
+    array_rm_swap(a, 1);            // [ 1, 2, 3, 3 ]
+    if (array_count(a) != 4 || a[1] != 2 || a[3] != 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: array_rm_swap() test\n", __func__);
+
+    array_rm_swap(a, 3);            // [ 1, 2, 3 ]
+    if (array_count(a) != 3 || a[2] != 3) r = 0, fprintf(stderr, "***FAILED*** %s: array_rm_swap() test 2\n", __func__);
+
+    array_add_array(a, c, 2);       // [ 1, 2, 3, 3, 2 ]
+    array_filter(a, NULL, _keep_odd); // [ 1, 3, 3 ]
+    if (array_count(a) != 3 || a[0] != 1 || a[1] != 3 || a[2] != 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: array_filter() test\n", __func__);
+
+    array_reserve(a, 100);          // [ 1, 3, 3 ]
+    if (array_count(a) != 3 || array_capacity(a) < 100 || a[2] != 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: array_reserve() test\n", __func__);
+
     array_free(a);
-    
+
+    int *d = NULL;
+
+    deque_new(d, 2);                // [ ]
+    if (deque_count(d) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: deque_new() test\n", __func__);
+
+    deque_add(d, 1);                // [ 1 ]
+    deque_add(d, 2);                // [ 1, 2 ]
+    deque_rm_first(d);              // [ 2 ]
+    deque_add(d, 3);                // [ 2, 3 ], wrapped around the end of the buffer
+    deque_add_front(d, 1);          // [ 1, 2, 3 ], grown
+    deque_add_front(d, 0);          // [ 0, 1, 2, 3 ]
+    if (deque_count(d) != 4) r = 0, fprintf(stderr, "***FAILED*** %s: deque_add() test\n", __func__);
+
+    for (size_t i = 0; i < deque_count(d); i++) {
+        if (deque_item(d, i) != (int)i) r = 0, fprintf(stderr, "***FAILED*** %s: deque_item() test\n", __func__);
+    }
+
+    deque_rm_first(d);              // [ 1, 2, 3 ]
+    deque_rm_last(d);               // [ 1, 2 ]
+    if (deque_count(d) != 2 || deque_item(d, 0) != 1 || deque_item(d, 1) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: deque_rm_first() test\n", __func__);
+
+    deque_clear(d);                 // [ ]
+    if (deque_count(d) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: deque_clear() test\n", __func__);
+
+    deque_free(d);
+
     printf("                                    ");
     return r;
 }
@@ -217,6 +275,349 @@ int BRSetTests()
     return r;
 }
 
+#define CSET_READERS 4
+#define CSET_LOOKUPS 200000 // lookups per reader thread
+
+typedef struct {
+    BRConcurrentSet *cset; // lock-free lookups when set, otherwise set is used with lock held
+    BRSet *set;
+    pthread_mutex_t lock;
+    int keys[2000]; // keys[0..999] are always in the set, keys[1000..1999] are added and removed while reading
+    int done, missed;
+} BRConcurrentSetBench;
+
+static int _csetContains(BRConcurrentSetBench *b, int *key)
+{
+    int r;
+
+    if (b->cset) return BRConcurrentSetContains(b->cset, key);
+    pthread_mutex_lock(&b->lock);
+    r = BRSetContains(b->set, key);
+    pthread_mutex_unlock(&b->lock);
+    return r;
+}
+
+static void _csetUpdate(BRConcurrentSetBench *b, int *key, int add)
+{
+    if (b->cset && add) BRConcurrentSetAdd(b->cset, key);
+    if (b->cset && ! add) BRConcurrentSetRemove(b->cset, key);
+    if (b->cset) return;
+    pthread_mutex_lock(&b->lock);
+    if (add) BRSetAdd(b->set, key);
+    if (! add) BRSetRemove(b->set, key);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void *_csetReader(void *info)
+{
+    BRConcurrentSetBench *b = info;
+
+    for (int i = 0; i < CSET_LOOKUPS; i++) {
+        if (! _csetContains(b, &b->keys[i % 1000])) __atomic_add_fetch(&b->missed, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&b->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// returns lookups per second with CSET_READERS threads reading while the calling thread adds and removes keys
+static double _csetBench(BRConcurrentSetBench *b)
+{
+    pthread_t threads[CSET_READERS];
+    struct timespec start, end;
+    size_t i, n;
+
+    b->done = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (n = 0; n < CSET_READERS; n++) {
+        if (pthread_create(&threads[n], NULL, _csetReader, b) != 0) break;
+    }
+
+    while (n > 0 && __atomic_load_n(&b->done, __ATOMIC_ACQUIRE) == 0) { // churn keys until the first reader finishes
+        for (i = 1000; i < 2000; i++) _csetUpdate(b, &b->keys[i], 1);
+        for (i = 1000; i < 2000; i++) _csetUpdate(b, &b->keys[i], 0);
+    }
+
+    for (i = 0; i < n; i++) pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return n*CSET_LOOKUPS/((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+}
+
+int BRConcurrentSetTests()
+{
+    int r = 1;
+    int i, x[1000];
+    BRConcurrentSet *s = BRConcurrentSetNew(sizeof(int), 0);
+    BRConcurrentSetBench *b;
+    double locked, lockFree;
+    
+    for (i = 0; i < 1000; i++) {
+        x[i] = i;
+        if (! BRConcurrentSetAdd(s, &x[i])) r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetAdd() test %d\n",
+                                                           __func__, i);
+    }
+    
+    if (BRConcurrentSetCount(s) != 1000 || BRConcurrentSetAdd(s, &x[10]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetAdd() test\n", __func__);
+    
+    for (i = 0; i < 1000; i += 2) {
+        if (! BRConcurrentSetRemove(s, &i))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetRemove() test %d\n", __func__, i);
+    }
+
+    for (i = 0; i < 1000; i++) {
+        if (BRConcurrentSetContains(s, &i) != (i % 2))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetContains() test %d\n", __func__, i);
+    }
+
+    if (BRConcurrentSetCount(s) != 500 || BRConcurrentSetRemove(s, &x[10]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetCount() test 1\n", __func__);
+
+    BRConcurrentSetClear(s);
+    
+    if (BRConcurrentSetCount(s) != 0 || BRConcurrentSetContains(s, &x[11]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetClear() test\n", __func__);
+    
+    BRConcurrentSetFree(s);
+    s = BRConcurrentSetNew(3, 10); // keys that aren't a multiple of 4 bytes
+    BRConcurrentSetAdd(s, "abc");
+    BRConcurrentSetAdd(s, "abd");
+    BRConcurrentSetRemove(s, "abd");
+    
+    if (! BRConcurrentSetContains(s, "abc") || BRConcurrentSetContains(s, "abd") || BRConcurrentSetCount(s) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetContains() test\n", __func__);
+
+    BRConcurrentSetFree(s);
+    s = BRConcurrentSetNew(sizeof(int), 0);
+
+    for (i = 0; i < 200000; i++) { // keep replacing keys, so deleted slots keep filling the table and it's rebuilt
+        BRConcurrentSetAdd(s, &i);
+        if (i >= 100) BRConcurrentSetRemove(s, &(int){ i - 100 });
+    }
+
+    if (BRConcurrentSetCount(s) != 100 || ! BRConcurrentSetContains(s, &(int){ i - 1 }) ||
+        BRConcurrentSetContains(s, &(int){ i - 101 }))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRConcurrentSetRemove() churn test\n", __func__);
+
+    BRConcurrentSetFree(s);
+
+    // compare lookup throughput with a mutex protected BRSet, while a writer keeps adding and removing keys
+    b = calloc(1, sizeof(*b));
+    b->set = BRSetNew(hash_int, eq_int, 2000);
+    pthread_mutex_init(&b->lock, NULL);
+    for (i = 0; i < 2000; i++) b->keys[i] = i;
+    for (i = 0; i < 1000; i++) BRSetAdd(b->set, &b->keys[i]);
+    locked = _csetBench(b);
+    b->cset = BRConcurrentSetNew(sizeof(int), 2000);
+    for (i = 0; i < 1000; i++) BRConcurrentSetAdd(b->cset, &b->keys[i]);
+    lockFree = _csetBench(b);
+    
+    if (b->missed != 0) r = 0, fprintf(stderr, "***FAILED*** %s: concurrent lookup test\n", __func__);
+    printf("\n%d readers: locked BRSet %.0f lookups/s, BRConcurrentSet %.0f lookups/s\n", CSET_READERS, locked,
+           lockFree);
+    BRConcurrentSetFree(b->cset);
+    BRSetFree(b->set);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+    printf("                                    ");
+    return r;
+}
+
+static void *_queueProducer(void *queue)
+{
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        if (! BRQueuePush(queue, (void *)i)) break;
+    }
+    
+    return NULL;
+}
+
+int BRQueueTests()
+{
+    int r = 1;
+    uintptr_t i, item;
+    BRQueue *q = BRQueueNew(4);
+    BRQueueStats stats;
+    pthread_t thread;
+    
+    if (BRQueueTryPop(q) != NULL || BRQueuePop(q, 0.01) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRQueuePop() test 0\n", __func__);
+    
+    if (pthread_create(&thread, NULL, _queueProducer, q) != 0) return 0;
+    
+    for (i = 1; i <= 10000; i++) { // items must come out in the order they went in
+        item = (uintptr_t)BRQueuePop(q, 10.0);
+        if (item != i) break;
+    }
+    
+    pthread_join(thread, NULL);
+    if (i != 10001) r = 0, fprintf(stderr, "***FAILED*** %s: BRQueuePop() test 1\n", __func__);
+    BRQueueGetStats(q, &stats);
+    
+    if (stats.pushCount != 10000 || stats.count != 0 || stats.maxCount == 0 || stats.maxCount > 4 ||
+        stats.occupancySum < stats.pushCount)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRQueueGetStats() test\n", __func__);
+    
+    BRQueuePush(q, (void *)1);
+    BRQueueClose(q);
+    
+    if (BRQueuePush(q, (void *)2) || BRQueuePop(q, 1.0) != NULL || BRQueueTryPop(q) != (void *)1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRQueueClose() test\n", __func__);
+    
+    BRQueueReopen(q);
+    
+    if (BRQueueIsClosed(q) || ! BRQueuePush(q, (void *)3) || BRQueuePop(q, 1.0) != (void *)3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRQueueReopen() test\n", __func__);
+    
+    BRQueueFree(q);
+    return r;
+}
+
+static void *_completionPoster(void *queue)
+{
+    for (uintptr_t i = 1; i <= 1000; i++) {
+        BRCompletionPendingPost(BRCompletionPendingNew(queue, BRCompletionPing, (void *)i, NULL), 1);
+    }
+
+    return NULL;
+}
+
+// true if fd is readable within timeout milliseconds
+static int _completionFdReady(int fd, int timeout)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+
+    return (poll(&pfd, 1, timeout) == 1 && (pfd.revents & POLLIN));
+}
+
+int BRCompletionQueueTests()
+{
+    int r = 1, fd;
+    uintptr_t i;
+    uint64_t handle;
+    BRCompletionQueue *q = BRCompletionQueueNew();
+    BRCompletion c;
+    pthread_t thread;
+    void *pending;
+
+    fd = BRCompletionQueueFd(q);
+    if (fd < 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueFd() test 0\n", __func__);
+
+    if (BRCompletionQueueTryGet(q, &c) || BRCompletionQueueWait(q, &c, 0.01) || _completionFdReady(fd, 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueTryGet() test 0\n", __func__);
+
+    pending = BRCompletionPendingNew(q, BRCompletionPublishTx, &r, &handle);
+    if (handle == 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionPendingNew() test\n", __func__);
+    BRCompletionPendingPost(pending, ETIMEDOUT);
+    BRCompletionQueuePost(q, (BRCompletion) { 0, BRCompletionSyncStopped, 0, NULL });
+
+    if (! _completionFdReady(fd, 0) || BRCompletionQueueCount(q) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueFd() test 1\n", __func__);
+
+    if (! BRCompletionQueueTryGet(q, &c) || c.handle != handle || c.type != BRCompletionPublishTx ||
+        c.result != ETIMEDOUT || c.info != &r)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionPendingPost() test\n", __func__);
+
+    if (! _completionFdReady(fd, 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueFd() test 2\n", __func__);
+
+    if (! BRCompletionQueueTryGet(q, &c) || c.handle != 0 || c.type != BRCompletionSyncStopped)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueTryGet() test 1\n", __func__);
+
+    if (_completionFdReady(fd, 0)) r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueFd() test 3\n", __func__);
+    if (pthread_create(&thread, NULL, _completionPoster, q) != 0) return 0;
+
+    for (i = 1; i <= 1000; i++) { // completions posted from another thread come out in order
+        if (! _completionFdReady(fd, 10000) || ! BRCompletionQueueWait(q, &c, 10.0) || c.info != (void *)i ||
+            c.type != BRCompletionPing || c.result != 1) break;
+    }
+
+    pthread_join(thread, NULL);
+    if (i != 1001) r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueWait() test\n", __func__);
+    if (_completionFdReady(fd, 0)) r = 0, fprintf(stderr, "***FAILED*** %s: BRCompletionQueueFd() test 4\n", __func__);
+    BRCompletionQueueFree(q);
+    return r;
+}
+
+static pthread_mutex_t _poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _poolCond = PTHREAD_COND_INITIALIZER;
+
+static void _poolSquare(void *arg, size_t i)
+{
+    ((size_t *)arg)[i] = i*i;
+}
+
+static void _poolTask(void *result)
+{
+    size_t x[100];
+
+    BRThreadPoolApply(_poolSquare, x, 100, BRTaskPriorityLow); // nested apply from a worker must not deadlock
+    pthread_mutex_lock(&_poolLock);
+    *(int *)result = (x[99] == 99*99) ? 1 : 2;
+    pthread_cond_signal(&_poolCond);
+    pthread_mutex_unlock(&_poolLock);
+}
+
+static int _poolWait(int *result)
+{
+    struct timespec ts = { time(NULL) + 10, 0 };
+    int r;
+
+    pthread_mutex_lock(&_poolLock);
+    while (*result == 0 && pthread_cond_timedwait(&_poolCond, &_poolLock, &ts) == 0);
+    r = *result;
+    pthread_mutex_unlock(&_poolLock);
+    return r;
+}
+
+static void *_poolExecutorThread(void *arg)
+{
+    void **args = arg;
+
+    ((void (*)(void *))args[0])(args[1]);
+    free(args);
+    return NULL;
+}
+
+static void _poolExecute(void *info, void (*task)(void *arg), void *arg, BRTaskPriority priority)
+{
+    void **args = malloc(2*sizeof(*args));
+    pthread_t thread;
+
+    (*(int *)info)++;
+    args[0] = (void *)task, args[1] = arg;
+    if (pthread_create(&thread, NULL, _poolExecutorThread, args) == 0) pthread_detach(thread);
+}
+
+int BRThreadPoolTests()
+{
+    int r = 1, result = 0, executeCount = 0;
+    size_t i, x[1000];
+    BRThreadPoolStats stats;
+
+    memset(x, 0, sizeof(x));
+    BRThreadPoolApply(_poolSquare, x, 1000, BRTaskPriorityLow);
+    for (i = 0; i < 1000 && x[i] == i*i; i++);
+    if (i != 1000) r = 0, fprintf(stderr, "***FAILED*** %s: BRThreadPoolApply() test\n", __func__);
+
+    if (! BRThreadPoolRun(_poolTask, &result, BRTaskPriorityHigh) || _poolWait(&result) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRThreadPoolRun() test\n", __func__);
+
+    BRThreadPoolGetStats(BRTaskPriorityHigh, &stats);
+    if (stats.taskCount == 0 || stats.maxLatency < stats.meanLatency)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRThreadPoolGetStats() test\n", __func__);
+
+    result = 0;
+    BRThreadPoolSetExecutor(&executeCount, _poolExecute);
+
+    if (! BRThreadPoolRun(_poolTask, &result, BRTaskPriorityHigh) || _poolWait(&result) != 1 || executeCount == 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRThreadPoolSetExecutor() test\n", __func__);
+
+    BRThreadPoolSetExecutor(NULL, NULL);
+    return r;
+}
+
 int BRBase58Tests()
 {
     int r = 1;
@@ -517,6 +918,23 @@ int BRHashTests()
     if (! UInt160Eq(*(UInt160 *)"\x0b\xdc\x9d\x2d\x25\x6b\x3e\xe9\xda\xae\x34\x7b\xe6\xf4\xdc\x83\x5a\x46\x7f\xfe",
                     *(UInt160 *)md)) r = 0, fprintf(stderr, "***FAILED*** %s: BRRMD160() test 6\n", __func__);
 
+    // test batched hash-160
+
+    uint8_t msgs[11*65], mds[11*20];
+    size_t lens[] = { 0, 33, 55, 56, 64, 65 };
+
+    for (size_t i = 0; i < sizeof(msgs); i++) msgs[i] = (uint8_t)(i*7 + 3);
+
+    for (size_t i = 0; i < sizeof(lens)/sizeof(*lens); i++) {
+        BRHash160Batch(mds, msgs, lens[i], 11);
+
+        for (size_t j = 0; j < 11; j++) {
+            BRHash160(md, &msgs[j*lens[i]], lens[i]);
+            if (! UInt160Eq(*(UInt160 *)md, *(UInt160 *)&mds[j*20]))
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRHash160Batch() test %zu\n", __func__, i + 1);
+        }
+    }
+
     // test md5
     
     s = "Free online MD5 Calculator, type text here...";
@@ -579,7 +997,48 @@ int BRHashTests()
     if (! UInt256Eq(*(UInt256 *)"\xc5\xd2\x46\x01\x86\xf7\x23\x3c\x92\x7e\x7d\xb2\xdc\xc7\x03\xc0\xe5\x00\xb6\x53\xca"
                     "\x82\x27\x3b\x7b\xfa\xd8\x04\x5d\x85\xa4\x70", *(UInt256 *)md))
         r = 0, fprintf(stderr, "***FAILED*** %s: Keccak-256() test 10\n", __func__);
-    
+
+    // test incremental keccak sponge
+
+    BRKeccakSponge sponge;
+    uint8_t msg[300];
+
+    for (size_t i = 0; i < sizeof(msg); i++) msg[i] = (uint8_t)(i*13 + 5);
+    BRSHA3_256(md, msg, sizeof(msg));
+    BRKeccakInit(&sponge, 136, 0x06);
+    BRKeccakAbsorb(&sponge, msg, 1);
+    BRKeccakAbsorb(&sponge, &msg[1], 7);
+    BRKeccakAbsorb(&sponge, &msg[8], 136);
+    BRKeccakAbsorb(&sponge, &msg[144], sizeof(msg) - 144);
+    BRKeccakSqueeze(&sponge, &md[32], 32);
+    if (! UInt256Eq(*(UInt256 *)md, *(UInt256 *)&md[32]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRKeccakAbsorb() test 1\n", __func__);
+
+    BRKeccakInit(&sponge, 168, 0x1f); // shake128
+    BRKeccakSqueeze(&sponge, md, 5);
+    BRKeccakSqueeze(&sponge, &md[5], 27);
+    if (! UInt256Eq(*(UInt256 *)"\x7f\x9c\x2b\xa4\xe8\x8f\x82\x7d\x61\x60\x45\x50\x76\x05\x85\x3e\xd7\x3b\x80\x93\xf6"
+                    "\xef\xbc\x88\xeb\x1a\x6e\xac\xfa\x66\xef\x26", *(UInt256 *)md))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRKeccakSqueeze() test 2\n", __func__);
+
+    // test incremental sha
+
+    BRSHAContext sha;
+    size_t mdLens[] = { 20, 28, 32 };
+    void (*hashes[])(void *, const void *, size_t) = { BRSHA1, BRSHA224, BRSHA256 };
+
+    for (size_t i = 0; i < sizeof(mdLens)/sizeof(*mdLens); i++) {
+        for (size_t len = 0; len <= 130; len += 13) {
+            hashes[i](md, msg, len);
+            BRSHAInit(&sha, mdLens[i]);
+            BRSHAUpdate(&sha, msg, len/3);
+            BRSHAUpdate(&sha, &msg[len/3], len - len/3);
+            BRSHAFinal(&sha, &md[32]);
+            if (memcmp(md, &md[32], mdLens[i]) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRSHAUpdate() test %zu\n", __func__, i + 1);
+        }
+    }
+
     return r;
 }
 
@@ -1219,6 +1678,27 @@ int BRKeyTests()
     if (! BRKeyVerify(&key, md, sig, sigLen))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRKeyVerify() test 7\n", __func__);
 
+    // batch verification
+    BRKey keys[4];
+    UInt256 mds[4];
+    uint8_t sigs[4][72];
+    const void *sigPtrs[4];
+    size_t sigLens[4];
+    int results[4];
+
+    for (size_t i = 0; i < 4; i++) {
+        BRSHA256(&mds[i], &i, sizeof(i));
+        BRKeySetSecret(&keys[i], (i < 3) ? &key.secret : &mds[i], 1); // last key differs from the first three
+        BRKeyPubKey(&keys[i], NULL, 0);
+        sigLens[i] = BRKeySign(&keys[i], sigs[i], sizeof(sigs[i]), mds[i]);
+        sigPtrs[i] = sigs[i];
+    }
+
+    mds[1].u8[0] ^= 1; // signature 1 no longer matches its digest
+    if (BRKeyVerifyBatch(keys, mds, sigPtrs, sigLens, 4, results) != 3 || ! results[0] || results[1] || ! results[2] ||
+        ! results[3])
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRKeyVerifyBatch() test\n", __func__);
+
     // compact signing
     BRKeySetSecret(&key, &uint256("0000000000000000000000000000000000000000000000000000000000000001"), 1);
     msg = "foo";
@@ -1426,6 +1906,26 @@ int BRAddressTests()
     if (script3Len != sizeof(script2) || memcmp(script2, script3, sizeof(script2)))
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRAddressScriptPubKey() test", __func__);
 
+    const uint8_t *hash = NULL;
+    UInt160 keyHash = BRKeyHash160(&k);
+
+    if (BRScriptPubKeyTemplate(script, scriptLen, &hash) != BRScriptTemplateP2PKH || ! hash ||
+        memcmp(hash, keyHash.u8, sizeof(keyHash)) != 0)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRScriptPubKeyTemplate() test 1", __func__);
+
+    if (BRScriptPubKeyTemplate((uint8_t *)script2, sizeof(script2), &hash) != BRScriptTemplateP2WPKH ||
+        hash != (uint8_t *)&script2[2])
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRScriptPubKeyTemplate() test 2", __func__);
+
+    if (BRScriptPubKeyTemplate(script, scriptLen - 1, &hash) != BRScriptTemplateNone || hash != NULL)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRScriptPubKeyTemplate() test 3", __func__);
+
+    uint8_t script4[BRScriptPubKeyFromTemplate(NULL, 0, BRScriptTemplateP2PKH, keyHash.u8)];
+    size_t script4Len = BRScriptPubKeyFromTemplate(script4, sizeof(script4), BRScriptTemplateP2PKH, keyHash.u8);
+
+    if (script4Len != scriptLen || memcmp(script, script4, scriptLen) != 0)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRScriptPubKeyFromTemplate() test", __func__);
+
     if (! r) fprintf(stderr, "\n                                    ");
     return r;
 }
@@ -1735,6 +2235,32 @@ int BRTransactionTests()
     
     if (len2 != len3 || memcmp(buf2, buf3, len2) != 0)
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionSerialize() test 1", __func__);
+    if (BRTransactionParseLength(buf2, len2) != len2 || BRTransactionParseLength(buf2, len2 - 1) != 0)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionParseLength() test 0", __func__);
+
+    size_t txCount = 1000; // enough tx to be parsed in more than one chunk
+    uint8_t *txsBuf = malloc(txCount*len2);
+    BRTransaction **txs = calloc(txCount, sizeof(*txs));
+    UInt256 *txHashes = calloc(txCount, sizeof(*txHashes));
+
+    for (size_t i = 0; i < txCount; i++) memcpy(&txsBuf[i*len2], buf2, len2);
+
+    if (BRTransactionParseMany(txs, txHashes, txCount, txsBuf, txCount*len2 - 1, 4) != 0)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionParseMany() test 0", __func__);
+
+    if (BRTransactionParseMany(txs, txHashes, txCount, txsBuf, txCount*len2, 4) != txCount*len2)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionParseMany() test 1", __func__);
+
+    for (size_t i = 0; i < txCount; i++) {
+        if (txs[i] && UInt256Eq(txs[i]->txHash, tx->txHash) && UInt256Eq(txHashes[i], tx->txHash)) continue;
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionParseMany() test 2", __func__);
+        break;
+    }
+
+    for (size_t i = 0; i < txCount; i++) if (txs[i]) BRTransactionFree(txs[i]);
+    free(txHashes);
+    free(txs);
+    free(txsBuf);
     BRTransactionFree(tx);
     
     tx = BRTransactionNew();
@@ -1804,6 +2330,33 @@ int BRTransactionTests()
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionCopy() test 3", __func__);
     BRTransactionFree(tgt);
     BRTransactionFree(src);
+
+    src = BRTransactionParse(buf4, len4);
+    tgt = BRTransactionRetain(src);
+    if (tgt != src || src->refCount != 2)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionRetain() test", __func__);
+    BRTransactionFree(tgt);
+    if (src->refCount != 1 || ! UInt256Eq(src->txHash, tgt->txHash))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionFree() release test", __func__);
+    BRTransactionFree(src);
+
+    src = BRTransactionParse(buf4, len4);
+    tgt = BRTransactionNew();
+    for (size_t i = 0; src && i < src->inCount; i++) {
+        BRTransactionAddInput(tgt, src->inputs[i].txHash, src->inputs[i].index, src->inputs[i].amount,
+                              src->inputs[i].script, src->inputs[i].scriptLen, src->inputs[i].signature,
+                              src->inputs[i].sigLen, src->inputs[i].sequence);
+    }
+    for (size_t i = 0; src && i < src->outCount; i++) {
+        BRTransactionAddOutput(tgt, src->outputs[i].amount, src->outputs[i].script, src->outputs[i].scriptLen);
+    }
+    if (! src || ! src->scriptData || tgt->scriptData || BRTransactionMemorySize(src) >= BRTransactionMemorySize(tgt))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionMemorySize() test", __func__);
+    if (src && src->inCount > 0) BRTxInputSetSignature(&src->inputs[0], tgt->inputs[0].signature, 1);
+    if (src && (src->inputs[0].sigLen != 1 || src->inputs[0].signature[0] != tgt->inputs[0].signature[0]))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTxInputSetSignature() stored script test", __func__);
+    BRTransactionFree(tgt);
+    if (src) BRTransactionFree(src);
     
     if (! r) fprintf(stderr, "\n                                    ");
     return r;
@@ -1830,6 +2383,48 @@ static void walletTxDeleted(void *info, UInt256 txHash, int notifyUser, int reco
     printf("tx deleted: %s\n", u256hex(txHash));
 }
 
+void BRPeerManagerRelayTxTest(BRPeerManager *manager, BRPeer *peer, BRTransaction *tx);
+void BRPeerManagerLookaheadTest(BRPeerManager *manager, uint32_t blockHeight, uint32_t blockCount, size_t lookahead[2],
+                                double addrsPerBlock[2]);
+
+// returns a signed tx spending output n of inHash, paying SATOSHIS to each of addrs
+static BRTransaction *_walletTestTx(BRKey *key, UInt256 inHash, uint32_t n, const BRAddress addrs[], size_t count)
+{
+    BRTransaction *tx = BRTransactionNew();
+    BRAddress addr;
+
+    BRKeyAddress(key, addr.s, sizeof(addr));
+    uint8_t inScript[BRAddressScriptPubKey(NULL, 0, addr.s)];
+    size_t inScriptLen = BRAddressScriptPubKey(inScript, sizeof(inScript), addr.s);
+
+    BRTransactionAddInput(tx, inHash, n, 1, inScript, inScriptLen, NULL, 0, TXIN_SEQUENCE);
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t script[BRAddressScriptPubKey(NULL, 0, addrs[i].s)];
+        size_t scriptLen = BRAddressScriptPubKey(script, sizeof(script), addrs[i].s);
+
+        BRTransactionAddOutput(tx, SATOSHIS, script, scriptLen);
+    }
+
+    BRTransactionSign(tx, 0, key, 1);
+    return tx;
+}
+
+void BRPeerManagerRelayBlockTest(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block, uint32_t peerLastBlock);
+
+typedef struct {
+    BRMerkleBlock **blocks; // copies of every block saved
+    int replaced;
+} BRSaveBlocksTestResult;
+
+static void _walletTestSaveBlocks(void *info, int replace, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    BRSaveBlocksTestResult *result = info;
+
+    if (replace) result->replaced++;
+    for (size_t i = 0; i < blocksCount; i++) array_add(result->blocks, BRMerkleBlockCopy(blocks[i]));
+}
+
 // TODO: test standard free transaction no change
 // TODO: test free transaction who's inputs are too new to hit min free priority
 // TODO: test transaction with change below min allowable output
@@ -1847,7 +2442,12 @@ int BRWalletTests()
             inHash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
     BRKey k;
     BRAddress addr, recvAddr = BRWalletReceiveAddress(w);
-    BRTransaction *tx;
+    BRTransaction *tx, *t, *u;
+    BRPeerManager *manager;
+    BRCompletionQueue *q;
+    BRCompletion completion;
+    uint64_t handles[3];
+    int i;
     
     printf("\n");
     
@@ -1884,10 +2484,21 @@ int BRWalletTests()
     if (BRWalletTransactions(w, NULL, 0) != 1)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletTransactions() test 2\n", __func__);
 
-    BRWalletRegisterTransaction(w, tx); // test adding same tx twice
-    if (BRWalletBalance(w) != SATOSHIS)
+    if (BRWalletUsedAddrCount(w, 0) != 1 || BRWalletUsedAddrCount(w, 1) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletUsedAddrCount() test\n", __func__);
+
+    if (BRWalletTransactionsMemorySize(w) != BRTransactionMemorySize(tx))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletTransactionsMemorySize() test\n", __func__);
+
+    if (BRWalletRegisterTransaction(w, tx) || BRWalletBalance(w) != SATOSHIS) // test adding same tx twice
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRegisterTransaction() test 3\n", __func__);
 
+    t = BRTransactionCopy(tx); // test adding another instance of the same tx, which the caller keeps
+    if (BRWalletRegisterTransaction(w, t) || BRWalletTransactionForHash(w, tx->txHash) != tx ||
+        BRWalletTransactions(w, NULL, 0) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRegisterTransaction() test 3b\n", __func__);
+    BRTransactionFree(t);
+
     tx = BRTransactionNew();
     BRTransactionAddInput(tx, inHash, 1, 1, inScript, inScriptLen, NULL, 0, TXIN_SEQUENCE - 1);
     BRTransactionAddOutput(tx, SATOSHIS, outScript, outScriptLen);
@@ -1982,7 +2593,240 @@ int BRWalletTests()
 
     BRTransactionFree(tx);
     BRWalletFree(w);
-    
+
+    // register then publish one tx, and publish then register another, the same pointer can be passed to both, since
+    // the wallet takes over the caller's reference and the publish list keeps its own
+    w = BRWalletNew(NULL, 0, mpk);
+    manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w, 0, NULL, 0, NULL, 0);
+    tx = BRTransactionNew();
+    BRTransactionAddInput(tx, inHash, 0, 1, inScript, inScriptLen, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, SATOSHIS, outScript, outScriptLen);
+    BRTransactionSign(tx, 0, &k, 1);
+    t = BRTransactionNew();
+    BRTransactionAddInput(t, inHash, 1, 1, inScript, inScriptLen, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(t, SATOSHIS, outScript, outScriptLen);
+    BRTransactionSign(t, 0, &k, 1);
+
+    if (! BRWalletRegisterTransaction(w, tx))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRegisterTransaction() test 6\n", __func__);
+
+    BRPeerManagerPublishTx(manager, tx, NULL, NULL);
+    BRPeerManagerPublishTx(manager, t, NULL, NULL);
+
+    if (! BRWalletRegisterTransaction(w, t))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRegisterTransaction() test 7\n", __func__);
+
+    BRWalletUpdateTransactions(w, &tx->txHash, 1, 1000, 1); // confirm tx
+
+    // every publish completion is posted, even when the publish list doesn't keep it
+    q = BRCompletionQueueNew();
+    handles[0] = BRPeerManagerPublishTxAsync(manager, t, q, NULL); // pending until freed
+    handles[1] = BRPeerManagerPublishTxAsync(manager, t, q, NULL); // already pending
+    handles[2] = BRPeerManagerPublishTxAsync(manager, tx, q, NULL); // already confirmed
+
+    // BRPeerManagerPublishTxs() takes over the caller's reference, so a tx that's only published is freed with the list
+    u = BRTransactionNew();
+    BRTransactionAddInput(u, inHash, 2, 1, inScript, inScriptLen, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(u, SATOSHIS, outScript, outScriptLen);
+    BRTransactionSign(u, 0, &k, 1);
+    BRPeerManagerPublishTxs(manager, &u, 1, NULL, NULL);
+    BRPeerManagerFree(manager); // releases the publish list references
+
+    for (i = 0; BRCompletionQueueTryGet(q, &completion); i++) {
+        if ((completion.handle == handles[0] && completion.result == ECANCELED) ||
+            (completion.handle == handles[1] && completion.result == EALREADY) ||
+            (completion.handle == handles[2] && completion.result == EINVAL)) continue;
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPublishTxAsync() test %d\n", __func__, i);
+    }
+
+    if (i != 3) r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPublishTxAsync() test\n", __func__);
+    BRCompletionQueueFree(q);
+
+    if (BRWalletTransactionForHash(w, tx->txHash) != tx || tx->blockHeight != 1000 ||
+        BRWalletTransactionForHash(w, t->txHash) != t || BRWalletBalance(w) != SATOSHIS*2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPublishTx() test\n", __func__);
+
+    BRWalletFree(w);
+
+    // each wallet added to a manager gets its own copy of a relayed tx it matches, and a removed wallet stops getting
+    // them, while the wallet the manager was created with only gets its own tx
+    BRWallet *w1 = BRWalletNew(NULL, 0, BRBIP32MasterPubKey("1", 1)), *w2 = BRWalletNew(NULL, 0,
+                                                                                         BRBIP32MasterPubKey("2", 1));
+    BRAddress addrs[2] = { BRWalletReceiveAddress(w1), BRWalletReceiveAddress(w2) };
+    BRPeer *p = BRPeerNew(BR_CHAIN_PARAMS.magicNumber);
+
+    w = BRWalletNew(NULL, 0, mpk);
+    manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w, 0, NULL, 0, NULL, 0);
+    BRPeerManagerAddWallet(manager, w1);
+    BRPeerManagerAddWallet(manager, w2);
+    BRPeerManagerAddWallet(manager, w1); // already added
+    tx = _walletTestTx(&k, inHash, 0, addrs, 2);
+    hash = tx->txHash;
+    BRPeerManagerRelayTxTest(manager, p, tx); // releases tx
+
+    if (BRWalletTransactions(w, NULL, 0) != 0 || BRWalletBalance(w1) != SATOSHIS || BRWalletBalance(w2) != SATOSHIS ||
+        ! BRWalletTransactionForHash(w1, hash) ||
+        BRWalletTransactionForHash(w1, hash) == BRWalletTransactionForHash(w2, hash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerAddWallet() test\n", __func__);
+
+    BRPeerManagerRemoveWallet(manager, w2);
+    BRPeerManagerRemoveWallet(manager, w2); // already removed
+    addrs[1] = BRWalletReceiveAddress(w2);
+    tx = _walletTestTx(&k, inHash, 1, addrs, 2);
+    hash = tx->txHash;
+    BRPeerManagerRelayTxTest(manager, p, tx);
+
+    if (BRWalletBalance(w1) != SATOSHIS*2 || ! BRWalletTransactionForHash(w1, hash) ||
+        BRWalletTransactionForHash(w2, hash) || BRWalletBalance(w2) != SATOSHIS)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRemoveWallet() test\n", __func__);
+
+    addrs[0] = BRWalletReceiveAddress(w);
+    tx = _walletTestTx(&k, inHash, 2, addrs, 1);
+    hash = tx->txHash;
+    BRPeerManagerRelayTxTest(manager, p, tx);
+
+    if (BRWalletBalance(w) != SATOSHIS || BRWalletTransactionForHash(w1, hash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRelayTxTest() test\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRWalletFree(w1);
+    BRWalletFree(w2);
+
+    // the lookahead averages new address use into the previous rate, doesn't count addresses of wallets added since the
+    // last filter load as new use, and keeps the rate when used addresses go backwards
+    BRAddress used[3];
+    size_t lookahead[2];
+    double rate[2];
+
+    w1 = BRWalletNew(NULL, 0, BRBIP32MasterPubKey("3", 1));
+    w2 = BRWalletNew(NULL, 0, BRBIP32MasterPubKey("4", 1));
+    manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w1, 0, NULL, 0, NULL, 0);
+    BRPeerManagerLookaheadTest(manager, 1000, 0, lookahead, rate);
+
+    if (rate[0] != 0 || rate[1] != 0 || lookahead[0] != 100 || lookahead[1] != 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerLookaheadTest() test 1\n", __func__);
+
+    addrs[0] = BRWalletReceiveAddress(w1);
+    tx = _walletTestTx(&k, inHash, 4, addrs, 1);
+    hash = tx->txHash;
+    BRWalletRegisterTransaction(w1, tx);
+    BRPeerManagerLookaheadTest(manager, 1010, 10000, lookahead, rate); // one address used in 10 blocks
+
+    if (rate[0] != 0.05 || rate[1] != 0 || lookahead[0] != 507 || lookahead[1] != 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerLookaheadTest() test 2\n", __func__);
+
+    BRPeerManagerLookaheadTest(manager, 1020, 100000, lookahead, rate); // no new use, and the max lookahead
+
+    if (rate[0] != 0.025 || lookahead[0] != 2000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerLookaheadTest() test 3\n", __func__);
+
+    BRWalletUnusedAddrs(w2, used, 3, 0);
+    BRWalletRegisterTransaction(w2, _walletTestTx(&k, inHash, 5, used, 3));
+    BRPeerManagerAddWallet(manager, w2);
+    BRPeerManagerLookaheadTest(manager, 1030, 0, lookahead, rate);
+
+    if (rate[0] != 0.0125 || lookahead[0] != 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerAddWallet() lookahead test\n", __func__);
+
+    BRPeerManagerRemoveWallet(manager, w2);
+    BRPeerManagerLookaheadTest(manager, 1040, 0, lookahead, rate);
+
+    if (rate[0] != 0.00625 || lookahead[0] != 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRemoveWallet() lookahead test\n", __func__);
+
+    BRWalletRemoveTransaction(w1, hash); // used addresses drop from one to none
+    BRPeerManagerLookaheadTest(manager, 1050, 10000, lookahead, rate);
+
+    if (BRWalletUsedAddrCount(w1, 0) != 0 || rate[0] != 0.00625 || lookahead[0] != 100 || lookahead[1] != 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerLookaheadTest() test 4\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRWalletFree(w1);
+    BRWalletFree(w2);
+
+    // while syncing, each periodic save appends only the blocks since the previous one, and a manager rebuilt from the
+    // saved blocks resumes at the last of them
+    const BRCheckPoint *cp = &BR_CHAIN_PARAMS.checkpoints[BR_CHAIN_PARAMS.checkpointsCount - 1];
+    BRSaveBlocksTestResult saved = { NULL, 0 };
+    UInt256 prevBlock = UInt256Reverse(cp->hash);
+    uint32_t lastSave = (cp->height + 1100)/500*500; // saves are every 500 blocks
+    BRMerkleBlock *block;
+
+    array_new(saved.blocks, 1000);
+    manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    BRPeerManagerSetCallbacks(manager, &saved, NULL, NULL, NULL, _walletTestSaveBlocks, NULL, NULL, NULL);
+    BRPeerManagerSetFixedPeer(manager, (UInt128) { .u8 = { [15] = 1 } }, BR_CHAIN_PARAMS.standardPort);
+    BRPeerManagerSetFullBlockSync(manager, 1); // so headers are accepted without a bloom filter
+
+    for (uint32_t n = 1; n <= 1100; n++) { // headers past the last checkpoint, from a peer with 2000 more blocks
+        block = BRMerkleBlockNew();
+        block->blockHash.u32[0] = n;
+        block->blockHash.u32[7] = 1;
+        block->prevBlock = prevBlock;
+        block->timestamp = cp->timestamp + n*150;
+        block->target = cp->target;
+        prevBlock = block->blockHash;
+        BRPeerManagerRelayBlockTest(manager, p, block, cp->height + 2000);
+    }
+
+    if (saved.replaced != 0 || array_count(saved.blocks) != lastSave - cp->height + 1 ||
+        BRPeerManagerLastBlockHeight(manager) != cp->height + 1100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerSetCallbacks() saveBlocks test\n", __func__);
+
+    BRPeerManagerFree(manager);
+    manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w, (uint32_t)time(NULL), saved.blocks, array_count(saved.blocks),
+                               NULL, 0);
+
+    if (BRPeerManagerLastBlockHeight(manager) != lastSave)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerNew() saved blocks test\n", __func__);
+
+    BRPeerManagerFree(manager);
+    array_free(saved.blocks);
+
+    // per wallet cost of serving 10, 100 and 1000 wallets from one manager, connections and the header chain are
+    // shared, so what grows is each wallet's share of the bloom filter, and the time to add it and route relayed tx,
+    // once the filter reaches BLOOM_MAX_FILTER_LENGTH its bytes stop growing and the false positive rate rises instead
+    printf("\n");
+
+    for (size_t n = 10; n <= 1000; n *= 10) {
+        BRWallet **wallets = calloc(n, sizeof(*wallets));
+        struct timespec start, end;
+        size_t elemCount = 0;
+        double addTime, relayTime;
+        BRBloomFilter *f;
+
+        manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w, 0, NULL, 0, NULL, 0);
+        for (uint32_t j = 0; j < n; j++) wallets[j] = BRWalletNew(NULL, 0, BRBIP32MasterPubKey(&j, sizeof(j)));
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t j = 0; j < n; j++) BRPeerManagerAddWallet(manager, wallets[j]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        addTime = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+        addrs[0] = BRWalletReceiveAddress(wallets[n - 1]);
+        tx = _walletTestTx(&k, inHash, 3, addrs, 1);
+        hash = tx->txHash;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        BRPeerManagerRelayTxTest(manager, p, tx);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        relayTime = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+
+        if (! BRWalletTransactionForHash(wallets[n - 1], hash))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerAddWallet() test %zu\n", __func__, n);
+
+        // count the 100 spare addresses per chain the filter adds for each wallet without deriving them here
+        for (size_t j = 0; j < n; j++) elemCount += BRWalletAllAddrs(wallets[j], NULL, 0) + 2*100;
+        f = BRBloomFilterNew(BLOOM_DEFAULT_FALSEPOSITIVE_RATE, elemCount, 0, BLOOM_UPDATE_ALL);
+        printf("%zu wallets: %.1f filter elements, %.1f filter bytes, add %.2fus, relay %.3fus per wallet\n", n,
+               (double)elemCount/n, (double)f->length/n, addTime*1e6/n, relayTime*1e6/n);
+        BRBloomFilterFree(f);
+        BRPeerManagerFree(manager);
+        for (size_t j = 0; j < n; j++) BRWalletFree(wallets[j]);
+        free(wallets);
+    }
+
+    printf("                                    ");
+    BRPeerFree(p);
+    BRWalletFree(w);
+
     amt = BRBitcoinAmount(50000, 50000);
     if (amt != SATOSHIS) r = 0, fprintf(stderr, "***FAILED*** %s: BRBitcoinAmount() test 1\n", __func__);
 
@@ -2069,7 +2913,119 @@ int BRBloomFilterTests()
     if (len2 != sizeof(d2) - 1 || memcmp(buf2, d2, len2) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterSerialize() test 2\n", __func__);
     
-    BRBloomFilterFree(f);    
+    BRBloomFilterFree(f);
+
+    if (BRBloomFilterOptimalRate(100, 3, 1e12, 0.00005, 0.0005) != 0.00005 ||
+        BRBloomFilterOptimalRate(100, 3, 1.0, 0.00005, 0.0005) != 0.0005 ||
+        BRBloomFilterOptimalRate(100, 3, 0.0, 0.00005, 0.0005) != 0.0005)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterOptimalRate() test\n", __func__);
+
+    // simulated bytes downloaded per synced block: { wallet elements, blocks, tx per block }
+    double sims[][3] = { { 300, 100000, 40 }, { 300, 144, 40 }, { 3000, 2000, 20 }, { 300, 100000, 2000 } };
+
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(sims)/sizeof(*sims); i++) {
+        double rates[] = { BLOOM_REDUCED_FALSEPOSITIVE_RATE, BLOOM_DEFAULT_FALSEPOSITIVE_RATE,
+                           BRBloomFilterOptimalRate(sims[i][0], 3, sims[i][1]*sims[i][2]*400, 0.00005, 0.0005) },
+               bytes[3];
+
+        for (size_t j = 0; j < 3; j++) {
+            f = BRBloomFilterNew(rates[j], sims[i][0], 0, BLOOM_UPDATE_ALL);
+            bytes[j] = (3*f->length + rates[j]*sims[i][1]*sims[i][2]*400)/sims[i][1];
+            BRBloomFilterFree(f);
+        }
+
+        printf("%.0f elements, %.0f blocks, %.0f tx per block: reduced %.3f, default %.3f, adaptive %.3f (rate %f)\n",
+               sims[i][0], sims[i][1], sims[i][2], bytes[0], bytes[1], bytes[2], rates[2]);
+
+        if (bytes[2] > bytes[0] + 3/sims[i][1] || bytes[2] > bytes[1] + 3/sims[i][1])
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterOptimalRate() test %zu\n", __func__, i + 2);
+    }
+
+    printf("                                    ");
+    return r;
+}
+
+int BRScriptMatcherTests()
+{
+    int r = 1;
+    uint8_t script1[] = "\x76\xa9\x14\x99\x10\x8a\xd8\xed\x9b\xb6\x27\x4d\x39\x80\xba\xb5\xa8\x5c\x04\x8f\x09\x50\xc8"
+                        "\x88\xac",
+            script2[] = "\xa9\x14\xb5\xa2\xc7\x86\xd9\xef\x46\x58\x28\x7c\xed\x59\x14\xb3\x7a\x1b\x4a\xa3\x2e\xee\x87";
+    UInt256 hash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    BRScriptMatcher *m = BRScriptMatcherNew(10);
+    BRTransaction *txs[2] = { BRTransactionNew(), BRTransactionNew() };
+    int matches[2];
+
+    BRScriptMatcherAddScript(m, script1, sizeof(script1) - 1);
+    BRScriptMatcherAddScript(m, script1, sizeof(script1) - 1);
+
+    if (! BRScriptMatcherContainsScript(m, script1, sizeof(script1) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherContainsScript() test 1\n", __func__);
+
+    if (BRScriptMatcherContainsScript(m, script2, sizeof(script2) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherContainsScript() test 2\n", __func__);
+
+    if (BRScriptMatcherCount(m) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherCount() test 1\n", __func__);
+
+    // tx 0 pays to a watched script, tx 1 spends it further along in the same block
+    BRTransactionAddInput(txs[0], hash, 0, 1, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(txs[0], 100000000, script2, sizeof(script2) - 1);
+    BRTransactionAddOutput(txs[0], 100000000, script1, sizeof(script1) - 1);
+    txs[0]->txHash = uint256("0000000000000000000000000000000000000000000000000000000000000002");
+    BRTransactionAddInput(txs[1], txs[0]->txHash, 1, 1, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(txs[1], 100000000, script2, sizeof(script2) - 1);
+
+    if (! BRScriptMatcherMatchesTx(m, txs[0]) || BRScriptMatcherMatchesTx(m, txs[1]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherMatchesTx() test\n", __func__);
+
+    if (BRScriptMatcherMatchTxs(m, txs, 2, matches) != 2 || ! matches[0] || ! matches[1])
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherMatchTxs() test\n", __func__);
+
+    if (! BRScriptMatcherContainsOutpoint(m, txs[0]->txHash, 1) ||
+        BRScriptMatcherContainsOutpoint(m, txs[0]->txHash, 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherContainsOutpoint() test 1\n", __func__);
+
+    for (uint32_t i = 0; i < 20000; i++) { // grow well past the initial capacity
+        hash.u32[0] = i;
+        BRScriptMatcherAddOutpoint(m, hash, i % 3);
+    }
+
+    for (uint32_t i = 0; i < 20000; i++) {
+        hash.u32[0] = i;
+        if (BRScriptMatcherContainsOutpoint(m, hash, i % 3) && ! BRScriptMatcherContainsOutpoint(m, hash, 3)) continue;
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherContainsOutpoint() test 2\n", __func__);
+        break;
+    }
+
+    if (BRScriptMatcherCount(m) != 20002)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherCount() test 2\n", __func__);
+
+    BRScriptMatcherFree(m);
+    m = BRScriptMatcherNew(0);
+    hash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+
+    for (uint32_t i = 0; i < 1000; i++) { // outpoints that differ only after the first 8 bytes of their tx hash
+        hash.u32[7] = i;
+        BRScriptMatcherAddOutpoint(m, hash, 0);
+        BRScriptMatcherAddOutpoint(m, hash, 0);
+    }
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        hash.u32[7] = i;
+        if (BRScriptMatcherContainsOutpoint(m, hash, 0)) continue;
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherContainsOutpoint() test 3\n", __func__);
+        break;
+    }
+
+    if (BRScriptMatcherCount(m) != 1000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptMatcherCount() test 3\n", __func__);
+
+    BRTransactionFree(txs[0]);
+    BRTransactionFree(txs[1]);
+    BRScriptMatcherFree(m);
     return r;
 }
 
@@ -2122,6 +3078,20 @@ int BRMerkleBlockTests()
     if (BRMerkleBlockSerialize(b, block2, sizeof(block2)) != sizeof(block2) ||
         memcmp(block, block2, sizeof(block2)) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSerialize() test\n", __func__);
+
+    if (! BRMerkleBlockHeaderIsPlausible(block2, sizeof(block2), (uint32_t)time(NULL)) ||
+        BRMerkleBlockHeaderIsPlausible(block2, sizeof(block2), b->timestamp - BLOCK_MAX_TIME_DRIFT - 1) ||
+        BRMerkleBlockHeaderIsPlausible(block2, 79, (uint32_t)time(NULL)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockHeaderIsPlausible() test 1\n", __func__);
+
+    UInt32SetLE(&block2[72], 0xff000001); // target far out of range
+    if (BRMerkleBlockHeaderIsPlausible(block2, sizeof(block2), (uint32_t)time(NULL)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockHeaderIsPlausible() test 2\n", __func__);
+
+    b->target = 0xff000001;
+    if (BRMerkleBlockIsValid(b, (uint32_t)time(NULL)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValid() target range test\n", __func__);
+    b->target = UInt32GetLE((uint8_t *)&block[72]);
     
     if (! BRMerkleBlockContainsTxHash(b, uint256("4c30b63cfcdc2d35e3329421b9805ef0c6565d35381ca857762ea0b3a5a128bb")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockContainsTxHash() test\n", __func__);
@@ -2162,11 +3132,75 @@ int BRMerkleBlockTests()
 
     if (c) BRMerkleBlockFree(c);
 
+    UInt256 blockTxHashes[7], matchedHashes[7];
+    int matches[7] = { 0, 1, 0, 0, 0, 0, 1 };
+
+    for (size_t i = 0; i < 7; i++) BRSHA256(&blockTxHashes[i], &i, sizeof(i));
+    c = BRMerkleBlockCopy(b);
+    BRMerkleBlockSetMatchedTxHashes(c, blockTxHashes, 7, matches);
+    
+    if (BRMerkleBlockTxHashes(c, matchedHashes, 7) != 2 || ! UInt256Eq(matchedHashes[0], blockTxHashes[1]) ||
+        ! UInt256Eq(matchedHashes[1], blockTxHashes[6]) || c->totalTx != 7)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSetMatchedTxHashes() test 1\n", __func__);
+
+    for (size_t i = 0; i < 7; i++) matches[i] = 1;
+    BRMerkleBlockSetMatchedTxHashes(c, blockTxHashes, 7, matches);
+
+    if (BRMerkleBlockTxHashes(c, matchedHashes, 7) != 7 || ! UInt256Eq(matchedHashes[3], blockTxHashes[3]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSetMatchedTxHashes() test 2\n", __func__);
+
+    if (c) BRMerkleBlockFree(c);
 
     if (b) BRMerkleBlockFree(b);
     return r;
 }
 
+int BRPowHashCacheTests()
+{
+    int r = 1;
+    uint8_t header[] = // block 10001 header
+    "\x01\x00\x00\x00\x06\xe5\x33\xfd\x1a\xda\x86\x39\x1f\x3f\x6c\x34\x32\x04\xb0\xd2\x78\xd4\xaa\xec\x1c"
+    "\x0b\x20\xaa\x27\xba\x03\x00\x00\x00\x00\x00\x6a\xbb\xb3\xeb\x3d\x73\x3a\x9f\xe1\x89\x67\xfd\x7d\x4c"
+    "\x11\x7e\x4c\xcb\xba\xc5\xbe\xc4\xd9\x10\xd9\x00\xb3\xae\x07\x93\xe7\x7f\x54\x24\x1b\x4d\x4c\x86\x04"
+    "\x1b\x40\x89\xcc\x9b";
+    BRPowHashCache *cache = BRPowHashCacheNew();
+    BRMerkleBlock *b, *c;
+    UInt256 powHash;
+
+    b = BRPowHashCacheParseBlock(cache, header, 80);
+
+    if (! b || ! UInt256Eq(b->blockHash,
+                           UInt256Reverse(uint256("00000000000080b66c911bd5ba14a74260057311eaeb1982802f7010f1a9f090"))))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPowHashCacheParseBlock() test 1\n", __func__);
+
+    if (b) BRPowHashCacheAddBlock(cache, b);
+    BRPowHashCacheRelease(BRPowHashCacheRetain(cache));
+    c = BRPowHashCacheParseBlock(cache, header, 80);
+
+    if (! b || ! c || ! UInt256Eq(b->blockHash, c->blockHash) || ! UInt256Eq(b->powHash, c->powHash) ||
+        c->timestamp != b->timestamp || c->nonce != b->nonce)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPowHashCacheParseBlock() test 2\n", __func__);
+
+    if (c) BRMerkleBlockFree(c);
+    header[76] ^= 0x01; // a different nonce must not reuse the recorded proof-of-work hash
+    c = BRPowHashCacheParseBlock(cache, header, 80);
+
+    if (! b || ! c || UInt256Eq(b->powHash, c->powHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPowHashCacheParseBlock() test 3\n", __func__);
+
+    if (BRPowHashCacheParseBlock(cache, header, 79) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPowHashCacheParseBlock() test 4\n", __func__);
+
+    if (! b || ! c || ! BRPowHashCacheGet(cache, b->blockHash, &powHash) || ! UInt256Eq(powHash, b->powHash) ||
+        BRPowHashCacheGet(cache, c->blockHash, &powHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPowHashCacheGet() test\n", __func__);
+
+    if (c) BRMerkleBlockFree(c);
+    if (b) BRMerkleBlockFree(b);
+    BRPowHashCacheRelease(cache);
+    return r;
+}
+
 int BRPaymentProtocolTests()
 {
     int r = 1;
@@ -2502,6 +3536,16 @@ int BRPaymentProtocolTests()
     
     // check for a chain of 2 certificates
     if (i != 2) r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequestCert() test 2\n", __func__);
+
+    uint8_t md1[32], md2[32];
+    size_t sigLen = req->sigLen;
+
+    req->sigLen = 0; // digest is the hash of the request serialized with a 0 byte signature
+    len = BRPaymentProtocolRequestSerialize(req, buf8, sizeof(buf8));
+    BRSHA256(md1, buf8, len);
+    req->sigLen = sigLen;
+    if (BRPaymentProtocolRequestDigest(req, md2, sizeof(md2)) != 32 || memcmp(md1, md2, sizeof(md1)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequestDigest() test 1\n", __func__);
     
     if (req->details->expires == 0 || req->details->expires >= time(NULL)) // check that request is expired
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequest->details->expires test 2\n", __func__);
@@ -2599,19 +3643,119 @@ int BRPaymentProtocolEncryptionTests()
     if (outLen != sizeof(buf) - 1 || memcmp(buf, out, outLen) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolEncryptedMessageDecrypt() test 2\n", __func__);
     
+    BRPaymentProtocolSession *session = BRPaymentProtocolSessionNew(&receiverKey, &senderKey);
+    
+    if (msg2) outLen = BRPaymentProtocolSessionDecrypt(session, msg2, out, sizeof(out));
+    
+    if (outLen != sizeof(buf) - 1 || memcmp(buf, out, outLen) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolSessionDecrypt() test 1\n", __func__);
+    
+    if (msg2) BRPaymentProtocolEncryptedMessageFree(msg2);
+    msg2 = BRPaymentProtocolSessionEncrypt(session, BRPaymentProtocolMessageTypeACK, (uint8_t *)buf, sizeof(buf) - 1,
+                                           time(NULL) + 1, id, sizeof(id), 1, NULL);
+    
+    if (! msg2 || ! BRPaymentProtocolEncryptedMessageVerify(msg2, &receiverKey))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolSessionEncrypt() test\n", __func__);
+    
+    if (msg2) outLen = BRPaymentProtocolEncryptedMessageDecrypt(msg2, out, sizeof(out), &senderKey);
+    
+    if (outLen != sizeof(buf) - 1 || memcmp(buf, out, outLen) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolSessionDecrypt() test 2\n", __func__);
+    
+    BRPaymentProtocolSessionFree(session);
+    session = BRPaymentProtocolSessionNew(&senderKey, &receiverKey); // session with the keys swapped
+    
+    if (msg2 && BRPaymentProtocolSessionDecrypt(session, msg2, out, sizeof(out)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolSessionDecrypt() test 3\n", __func__);
+    
+    BRPaymentProtocolSessionFree(session);
     if (msg2) BRPaymentProtocolEncryptedMessageFree(msg2);
     return r;
 }
 
 void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t len, const char *type);
 
+typedef struct {
+    int disconnected, error, cleanups, msgCleanups;
+} BRPeerTestResult;
+
+typedef struct {
+    BRPeerTestResult *result;
+} BRPeerTestInfo; // allocated per connection and freed by threadCleanup, like a peer manager's callback info
+
+static void _peerTestDisconnected(void *info, int error)
+{
+    BRPeerTestResult *result = ((BRPeerTestInfo *)info)->result;
+
+    result->error = error;
+    __atomic_add_fetch(&result->disconnected, 1, __ATOMIC_RELEASE);
+}
+
+static void _peerTestThreadCleanup(void *info)
+{
+    BRPeerTestResult *result = ((BRPeerTestInfo *)info)->result;
+
+    free(info);
+    __atomic_add_fetch(&result->cleanups, 1, __ATOMIC_RELEASE);
+}
+
+static void _peerTestMsgThreadCleanup(void *info)
+{
+    __atomic_add_fetch(&((BRPeerTestInfo *)info)->result->msgCleanups, 1, __ATOMIC_RELEASE);
+}
+
 int BRPeerTests()
 {
-    int r = 1;
+    int r = 1, listener, fd = -1, i;
     BRPeer *p = BRPeerNew(BR_CHAIN_PARAMS.magicNumber);
     const char msg[] = "my message";
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addrLen = sizeof(addr);
+    BRPeerTestResult result = { 0, 0, 0, 0 };
+    BRPeerTestInfo *info = calloc(1, sizeof(*info));
+    struct pollfd pfd;
+    uint8_t buf[1024];
     
     BRPeerAcceptMessageTest(p, (const uint8_t *)msg, sizeof(msg) - 1, "inv");
+    BRPeerFree(p);
+
+    // connect to a loopback listener that hangs up after the version message, the disconnect must run each callback
+    // once, with info freed only by the socket thread's cleanup, after the message thread has exited
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addrLen) < 0) {
+        if (listener >= 0) close(listener);
+        free(info);
+        return r; // no loopback networking available
+    }
+
+    p = BRPeerNew(BR_CHAIN_PARAMS.magicNumber);
+    p->address = (UInt128) { .u16 = { 0, 0, 0, 0, 0, 0xffff, 0, 0 } };
+    p->address.u32[3] = addr.sin_addr.s_addr;
+    p->port = ntohs(addr.sin_port);
+    info->result = &result;
+    BRPeerSetCallbacks(p, info, NULL, _peerTestDisconnected, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                       _peerTestThreadCleanup);
+    BRPeerSetMessageThreadCleanup(p, _peerTestMsgThreadCleanup);
+    BRPeerConnect(p);
+    pfd.fd = listener;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 5000) == 1) fd = accept(listener, NULL, NULL);
+    pfd.fd = fd;
+    if (fd >= 0 && poll(&pfd, 1, 5000) == 1 && read(fd, buf, sizeof(buf)) <= 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerConnect() test\n", __func__);
+    if (fd < 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerConnect() test\n", __func__);
+    if (fd >= 0) close(fd);
+
+    for (i = 0; i < 500 && __atomic_load_n(&result.cleanups, __ATOMIC_ACQUIRE) == 0; i++) usleep(10000);
+
+    if (result.disconnected != 1 || result.error == 0 || result.cleanups != 1 || result.msgCleanups != 1 ||
+        BRPeerConnectStatus(p) != BRPeerStatusDisconnected)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerDisconnect() test\n", __func__);
+
+    if (result.cleanups == 1) BRPeerFree(p); // else the socket thread may still be using p
+    close(listener);
     return r;
 }
 
@@ -2625,6 +3769,14 @@ int BRRunTests()
     printf("%s\n", (BRArrayTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRSetTests...                       ");
     printf("%s\n", (BRSetTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRConcurrentSetTests...             ");
+    printf("%s\n", (BRConcurrentSetTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRQueueTests...                     ");
+    printf("%s\n", (BRQueueTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRCompletionQueueTests...           ");
+    printf("%s\n", (BRCompletionQueueTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRThreadPoolTests...                ");
+    printf("%s\n", (BRThreadPoolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRBase58Tests...                    ");
     printf("%s\n", (BRBase58Tests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRBech32Tests...                    ");
@@ -2659,12 +3811,18 @@ int BRRunTests()
     printf("%s\n", (BRWalletTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRBloomFilterTests...               ");
     printf("%s\n", (BRBloomFilterTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRScriptMatcherTests...             ");
+    printf("%s\n", (BRScriptMatcherTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRMerkleBlockTests...               ");
     printf("%s\n", (BRMerkleBlockTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPowHashCacheTests...              ");
+    printf("%s\n", (BRPowHashCacheTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolTests...           ");
     printf("%s\n", (BRPaymentProtocolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolEncryptionTests... ");
     printf("%s\n", (BRPaymentProtocolEncryptionTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerTests...                      ");
+    printf("%s\n", (BRPeerTests()) ? "success" : (fail++, "***FAIL***"));
     printf("\n");
     
     if (fail > 0) printf("%d TEST FUNCTION(S) ***FAILED***\n", fail);